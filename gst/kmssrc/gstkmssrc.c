@@ -24,7 +24,9 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <linux/netlink.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -34,6 +36,11 @@
 #include <gst/base/gstpushsrc.h>
 #include <gst/allocators/gstdmabuf.h>
 
+#ifdef HAVE_RGA
+#include <rga/rga.h>
+#include <rga/RgaApi.h>
+#endif
+
 #ifndef DRM_FORMAT_NV12_10
 #define DRM_FORMAT_NV12_10 fourcc_code('N', 'A', '1', '2')
 #endif
@@ -44,8 +51,30 @@
 
 #define DEFAULT_PROP_FRAMERATE_LIMIT 120
 
+/* Cached imported FBs, revalidated on every hit since FB IDs get reused.
+ * Shared by all the planes when compositing, hence room for a few swapchains */
+#define KMS_SRC_FB_CACHE_SIZE 16
+
+/* Beyond this many damaged rects, treat the whole frame as damaged */
+#define KMS_SRC_MAX_DAMAGE_RECTS 16
+
+/* Retry period when the CRTC delivers no vblank events (e.g. disabled) */
+#define KMS_SRC_FALLBACK_PERIOD (GST_SECOND / 60)
+
 static gboolean DEFAULT_PROP_DMA_FEATURE = FALSE;
 
+typedef enum
+{
+  GST_KMS_SRC_COPY_NONE,
+  GST_KMS_SRC_COPY_RGA,
+} GstKmsSrcCopyMode;
+
+#define DEFAULT_PROP_TRACK_DAMAGE FALSE
+#define DEFAULT_PROP_COMPOSITE FALSE
+
+#define DEFAULT_PROP_COPY_MODE GST_KMS_SRC_COPY_NONE
+#define DEFAULT_PROP_COPY_FORMAT GST_VIDEO_FORMAT_UNKNOWN
+
 #define GST_TYPE_KMS_SRC (gst_kms_src_get_type())
 G_DECLARE_FINAL_TYPE (GstKmsSrc, gst_kms_src, GST, KMS_SRC, GstPushSrc);
 
@@ -73,16 +102,74 @@ struct _GstKmsSrc {
   guint fps_d;
   gboolean sync_fb;
   gboolean sync_vblank;
+  gboolean track_damage;
 
   GstPoll *poll;
   GstPollFD pollfd;
+  gboolean flushing;
+
+  gboolean vblank_pending;
+
+  /* monotonic time of the latest vblank, when the driver reports it */
+  gboolean monotonic_vblank;
+  GstClockTime vblank_time;
+
+  /* sequence of the latest vblank, when waited for one */
+  gboolean vblank_seq_valid;
+  guint vblank_seq;
+
+  /* resolved display topology, until hotplug or a failed lookup */
+  gboolean topology_valid;
+  guint cur_crtc_id;
+  guint cur_crtc_pipe;
+  /* plane scanning out the tracked FB */
+  guint damage_plane_id;
+  /* plane ID to its struct kmssrc_plane_props */
+  GHashTable *plane_props;
+
+  /* kernel uevents for DRM hotplug */
+  GstPollFD uevent_pollfd;
+
+  /* imported FBs, most recently used first */
+  GQueue fb_cache;
 
   guint last_fb_id;
   GstClockTime last_frame_time;
 
+  /* damage accumulated since the last frame (GstVideoRectangle) */
+  GArray *damage;
+  gboolean damage_full;
+  guint damage_prop_id;
+  guint fb_prop_id;
+  guint damage_fb_id;
+  guint damage_blob_id;
+  gboolean damage_seq_valid;
+  guint damage_seq;
+
   GstClockTime start_time;
+
+  GstKmsSrcCopyMode copy_mode;
+  GstVideoFormat copy_format;
+  gboolean composite;
+
+  /* requested crop and output size, 0 for the whole source */
+  gint crop_x;
+  gint crop_y;
+  gint crop_w;
+  gint crop_h;
+  guint width;
+  guint height;
+
+  /* copied frames' video info, source rect and their pool */
+  GstVideoInfo copy_info;
+  GstVideoRectangle copy_crop;
+  GstBufferPool *pool;
 };
 
+static void gst_kms_src_purge_fb_cache (GstKmsSrc * self);
+static GstBuffer *gst_kms_src_import_drm_fb (GstKmsSrc * self, guint fb_id,
+    GstVideoInfo * info);
+
 #define parent_class gst_kms_src_parent_class
 G_DEFINE_TYPE (GstKmsSrc, gst_kms_src, GST_TYPE_PUSH_SRC);
 
@@ -110,6 +197,13 @@ enum
   PROP_FRAMERATE_LIMIT,
   PROP_SYNC_FB,
   PROP_SYNC_VBLANK,
+  PROP_TRACK_DAMAGE,
+  PROP_COPY_MODE,
+  PROP_COPY_FORMAT,
+  PROP_COMPOSITE,
+  PROP_CROP_RECTANGLE,
+  PROP_WIDTH,
+  PROP_HEIGHT,
   PROP_LAST,
 };
 
@@ -122,6 +216,38 @@ struct kmssrc_fb {
   guint fourcc;
 };
 
+struct kmssrc_fb_cache {
+  guint fb_id;
+
+  /* FB layout, without handles */
+  struct kmssrc_fb fb;
+
+  /* first plane's dma-buf, identifying the FB's buffer */
+  dev_t dev;
+  ino_t ino;
+
+  /* memories and video meta */
+  GstBuffer *buf;
+  GstVideoInfo info;
+};
+
+#define GST_TYPE_KMS_SRC_COPY_MODE (gst_kms_src_copy_mode_get_type ())
+static GType
+gst_kms_src_copy_mode_get_type (void)
+{
+  static GType copy_mode = 0;
+
+  if (!copy_mode) {
+    static const GEnumValue modes[] = {
+      {GST_KMS_SRC_COPY_NONE, "Export the live FB", "none"},
+      {GST_KMS_SRC_COPY_RGA, "Copy the FB with RGA", "rga"},
+      {0, NULL, NULL}
+    };
+    copy_mode = g_enum_register_static ("GstKmsSrcCopyMode", modes);
+  }
+  return copy_mode;
+}
+
 static void
 gst_kms_src_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -139,15 +265,19 @@ gst_kms_src_set_property (GObject * object, guint prop_id,
       break;
     case PROP_CRTC_ID:
       self->crtc_id = g_value_get_uint (value);
+      self->topology_valid = FALSE;
       break;
     case PROP_ENCODER_ID:
       self->encoder_id = g_value_get_uint (value);
+      self->topology_valid = FALSE;
       break;
     case PROP_CONNECTOR_ID:
       self->connector_id = g_value_get_uint (value);
+      self->topology_valid = FALSE;
       break;
     case PROP_PLANE_ID:
       self->plane_id = g_value_get_uint (value);
+      self->topology_valid = FALSE;
       break;
     case PROP_FB_ID:
       self->fb_id = g_value_get_uint (value);
@@ -164,6 +294,52 @@ gst_kms_src_set_property (GObject * object, guint prop_id,
     case PROP_SYNC_VBLANK:
       self->sync_vblank = g_value_get_boolean (value);
       break;
+    case PROP_TRACK_DAMAGE:
+      self->track_damage = g_value_get_boolean (value);
+      break;
+    case PROP_COPY_MODE:
+      self->copy_mode = g_value_get_enum (value);
+      break;
+    case PROP_COPY_FORMAT:
+      self->copy_format = g_value_get_enum (value);
+      break;
+    case PROP_COMPOSITE:
+      self->composite = g_value_get_boolean (value);
+      break;
+    case PROP_CROP_RECTANGLE:{
+      const GValue *v;
+      gint rect[4], i;
+
+      if (gst_value_array_get_size (value) != 4) {
+        GST_WARNING_OBJECT (self, "too less values for crop-rectangle");
+        break;
+      }
+
+      for (i = 0; i < 4; i++) {
+        v = gst_value_array_get_value (value, i);
+        if (!G_VALUE_HOLDS_INT (v))
+          break;
+
+        rect[i] = g_value_get_int (v);
+      }
+
+      if (i < 4) {
+        GST_WARNING_OBJECT (self, "crop-rectangle needs int values");
+        break;
+      }
+
+      self->crop_x = rect[0];
+      self->crop_y = rect[1];
+      self->crop_w = rect[2];
+      self->crop_h = rect[3];
+      break;
+    }
+    case PROP_WIDTH:
+      self->width = g_value_get_uint (value);
+      break;
+    case PROP_HEIGHT:
+      self->height = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -210,57 +386,132 @@ gst_kms_src_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_SYNC_VBLANK:
       g_value_set_boolean (value, self->sync_vblank);
       break;
+    case PROP_TRACK_DAMAGE:
+      g_value_set_boolean (value, self->track_damage);
+      break;
+    case PROP_COPY_MODE:
+      g_value_set_enum (value, self->copy_mode);
+      break;
+    case PROP_COPY_FORMAT:
+      g_value_set_enum (value, self->copy_format);
+      break;
+    case PROP_COMPOSITE:
+      g_value_set_boolean (value, self->composite);
+      break;
+    case PROP_CROP_RECTANGLE:{
+      GValue v = G_VALUE_INIT;
+      gint rect[4] = { self->crop_x, self->crop_y, self->crop_w,
+        self->crop_h
+      };
+      gint i;
+
+      g_value_init (&v, G_TYPE_INT);
+      for (i = 0; i < 4; i++) {
+        g_value_set_int (&v, rect[i]);
+        gst_value_array_append_value (value, &v);
+      }
+      g_value_unset (&v);
+      break;
+    }
+    case PROP_WIDTH:
+      g_value_set_uint (value, self->width);
+      break;
+    case PROP_HEIGHT:
+      g_value_set_uint (value, self->height);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
-static guint
-gst_kms_src_get_crtc_fb (GstKmsSrc * self, guint crtc_id)
+/* Anything but a zero-copy crop needs RGA */
+static gboolean
+gst_kms_src_use_rga (GstKmsSrc * self)
 {
-  drmModeCrtcPtr crtc;
-  guint fb_id;
+  return self->copy_mode == GST_KMS_SRC_COPY_RGA || self->composite ||
+      self->width || self->height;
+}
 
-  crtc = drmModeGetCrtc (self->fd, crtc_id);
-  if (!crtc)
-    return 0;
+/* Crop rect within the source, aligned to its chroma subsampling */
+static void
+gst_kms_src_get_crop (GstKmsSrc * self, GstVideoFormat format, gint width,
+    gint height, GstVideoRectangle * crop)
+{
+  const GstVideoFormatInfo *finfo = gst_video_format_get_info (format);
+  gint xalign = 1 << GST_VIDEO_FORMAT_INFO_W_SUB (finfo, 1);
+  gint yalign = 1 << GST_VIDEO_FORMAT_INFO_H_SUB (finfo, 1);
 
-  fb_id = crtc->buffer_id;
+  /* Packed bit formats can't be cropped horizontally */
+  if (!GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, 0))
+    xalign = width;
 
-  drmModeFreeCrtc (crtc);
-  return fb_id;
+  crop->x = GST_ROUND_DOWN_N (CLAMP (self->crop_x, 0, width - 1), xalign);
+  crop->y = GST_ROUND_DOWN_N (CLAMP (self->crop_y, 0, height - 1), yalign);
+
+  crop->w = width - crop->x;
+  crop->h = height - crop->y;
+
+  if (self->crop_w && self->crop_w < crop->w)
+    crop->w = MAX (GST_ROUND_DOWN_N (self->crop_w, xalign), xalign);
+
+  if (self->crop_h && self->crop_h < crop->h)
+    crop->h = MAX (GST_ROUND_DOWN_N (self->crop_h, yalign), yalign);
 }
 
-static guint
-gst_kms_src_get_encoder_fb (GstKmsSrc * self, guint encoder_id)
+/* Crop by pointing the video meta into the FB, no copy involved.
+ * Downstream must honour the meta's plane offsets, including the first one,
+ * or it will see the FB's top-left corner instead (use copy-mode=rga then) */
+static void
+gst_kms_src_crop_buffer (GstKmsSrc * self, GstBuffer * buf)
 {
-  drmModeEncoderPtr encoder;
-  guint fb_id;
+  GstVideoInfo *info = &self->info;
+  const GstVideoFormatInfo *finfo = info->finfo;
+  GstVideoRectangle crop;
+  GstVideoMeta *meta;
+  gsize offset[GST_VIDEO_MAX_PLANES] = { 0, };
+  guint i;
 
-  encoder = drmModeGetEncoder (self->fd, encoder_id);
-  if (!encoder)
-      return 0;
+  gst_kms_src_get_crop (self, GST_VIDEO_INFO_FORMAT (info),
+      GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info), &crop);
 
-  fb_id = gst_kms_src_get_crtc_fb (self, encoder->crtc_id);
+  if (crop.w == GST_VIDEO_INFO_WIDTH (info) &&
+      crop.h == GST_VIDEO_INFO_HEIGHT (info))
+    return;
 
-  drmModeFreeEncoder (encoder);
-  return fb_id;
+  /* The first component of each plane has the plane's subsampling */
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++)
+    offset[i] = GST_VIDEO_INFO_PLANE_OFFSET (info, i) +
+        GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, i, crop.y) *
+        GST_VIDEO_INFO_PLANE_STRIDE (info, i) +
+        GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, i, crop.x) *
+        GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, i);
+
+  meta = gst_buffer_get_video_meta (buf);
+  if (meta)
+    gst_buffer_remove_meta (buf, (GstMeta *) meta);
+
+  gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info), crop.w, crop.h,
+      GST_VIDEO_INFO_N_PLANES (info), offset, info->stride);
 }
 
 static guint
-gst_kms_src_get_connector_fb (GstKmsSrc * self, guint connector_id)
+gst_kms_src_get_crtc_fb (GstKmsSrc * self, guint crtc_id)
 {
-  drmModeConnectorPtr connector;
+  drmModeCrtcPtr crtc;
   guint fb_id;
 
-  connector = drmModeGetConnector (self->fd, connector_id);
-  if (!connector)
+  if (!crtc_id)
     return 0;
 
-  fb_id = gst_kms_src_get_encoder_fb (self, connector->encoder_id);
+  crtc = drmModeGetCrtc (self->fd, crtc_id);
+  if (!crtc)
+    return 0;
 
-  drmModeFreeConnector (connector);
+  fb_id = crtc->buffer_id;
+
+  drmModeFreeCrtc (crtc);
   return fb_id;
 }
 
@@ -280,27 +531,6 @@ gst_kms_src_get_plane_fb (GstKmsSrc * self, guint plane_id)
   return fb_id;
 }
 
-static guint
-gst_kms_src_get_fb_id (GstKmsSrc * self)
-{
-  if (self->fb_id)
-    return self->fb_id;
-
-  if (self->plane_id)
-    return gst_kms_src_get_plane_fb (self, self->plane_id);
-
-  if (self->connector_id)
-    return gst_kms_src_get_connector_fb (self, self->connector_id);
-
-  if (self->encoder_id)
-    return gst_kms_src_get_encoder_fb (self, self->encoder_id);
-
-  if (self->crtc_id)
-    return gst_kms_src_get_crtc_fb (self, self->crtc_id);
-
-  return 0;
-}
-
 static guint
 gst_kms_src_get_encoder_crtc (GstKmsSrc * self, guint encoder_id)
 {
@@ -391,130 +621,1120 @@ gst_kms_src_get_crtc_pipe (GstKmsSrc * self, guint crtc_id)
   return crtc_pipe;
 }
 
+static void
+gst_kms_src_update_topology (GstKmsSrc * self)
+{
+  self->cur_crtc_id = gst_kms_src_get_crtc_id (self);
+  self->cur_crtc_pipe = gst_kms_src_get_crtc_pipe (self, self->cur_crtc_id);
+  self->topology_valid = self->cur_crtc_id != 0;
+
+  /* Looked up again when tracking damage or compositing */
+  self->damage_plane_id = 0;
+  g_hash_table_remove_all (self->plane_props);
+
+  GST_DEBUG_OBJECT (self, "resolved CRTC: %d(%d)", self->cur_crtc_id,
+      self->cur_crtc_pipe);
+}
+
+static guint
+gst_kms_src_get_fb_id (GstKmsSrc * self)
+{
+  gboolean resolved = FALSE;
+  guint fb_id;
+
+  if (self->fb_id)
+    return self->fb_id;
+
+  if (self->plane_id)
+    return gst_kms_src_get_plane_fb (self, self->plane_id);
+
+  if (!self->topology_valid) {
+    gst_kms_src_update_topology (self);
+    resolved = TRUE;
+  }
+
+  fb_id = gst_kms_src_get_crtc_fb (self, self->cur_crtc_id);
+  if (fb_id || resolved)
+    return fb_id;
+
+  /* The cached CRTC might be stale */
+  GST_DEBUG_OBJECT (self, "cached CRTC lookup failed");
+  gst_kms_src_update_topology (self);
+  return gst_kms_src_get_crtc_fb (self, self->cur_crtc_id);
+}
+
+static void
+gst_kms_src_handle_uevents (GstKmsSrc * self)
+{
+  gchar buf[4096];
+  gssize len;
+
+  while ((len = recv (self->uevent_pollfd.fd, buf, sizeof (buf) - 1, 0)) > 0) {
+    gboolean drm = FALSE, hotplug = FALSE;
+    gchar *line;
+
+    buf[len] = '\0';
+
+    /* "action@devpath\0KEY=VALUE\0..." */
+    for (line = buf; line < buf + len; line += strlen (line) + 1) {
+      if (!strcmp (line, "SUBSYSTEM=drm"))
+        drm = TRUE;
+      else if (!strcmp (line, "HOTPLUG=1"))
+        hotplug = TRUE;
+    }
+
+    if (drm && hotplug) {
+      GST_DEBUG_OBJECT (self, "DRM hotplug, invalidating topology");
+      self->topology_valid = FALSE;
+      gst_kms_src_purge_fb_cache (self);
+    }
+  }
+}
+
 static void
 sync_handler (gint fd, guint frame, guint sec, guint usec, gpointer data)
 {
-  gboolean *waiting;
+  GstKmsSrc *self = data;
 
   (void) fd;
-  (void) frame;
-  (void) sec;
-  (void) usec;
 
-  waiting = data;
-  *waiting = FALSE;
+  self->vblank_seq = frame;
+  self->vblank_seq_valid = TRUE;
+
+  if (self->monotonic_vblank)
+    self->vblank_time = sec * GST_SECOND + usec * GST_USECOND;
+
+  self->vblank_pending = FALSE;
 }
 
 static gboolean
-gst_kms_src_sync_vblank (GstKmsSrc * self)
+gst_kms_src_request_vblank (GstKmsSrc * self)
 {
-  gboolean waiting;
-  drmEventContext evctxt = {
-    .version = DRM_EVENT_CONTEXT_VERSION,
-    .vblank_handler = sync_handler,
-  };
   drmVBlank vbl = {
     .request = {
           .type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT,
           .sequence = 1,
-          .signal = (gulong) & waiting,
+          .signal = (gulong) self,
         },
   };
-  guint crtc_id = gst_kms_src_get_crtc_id (self);
-  guint crtc_pipe = gst_kms_src_get_crtc_pipe (self, crtc_id);
+  guint crtc_id, crtc_pipe;
+
+  if (!self->topology_valid)
+    gst_kms_src_update_topology (self);
+
+  crtc_id = self->cur_crtc_id;
+  crtc_pipe = self->cur_crtc_pipe;
+
+  if (!crtc_id)
+    return FALSE;
+
+  if (crtc_pipe == 1)
+    vbl.request.type |= DRM_VBLANK_SECONDARY;
+  else if (crtc_pipe > 1)
+    vbl.request.type |= crtc_pipe << DRM_VBLANK_HIGH_CRTC_SHIFT;
+
+  if (drmWaitVBlank (self->fd, &vbl)) {
+    /* Re-resolve next time */
+    self->topology_valid = FALSE;
+    return FALSE;
+  }
+
+  GST_LOG_OBJECT (self, "requested vblank of CRTC: %d(%d)", crtc_id,
+      crtc_pipe);
+
+  self->vblank_pending = TRUE;
+  return TRUE;
+}
+
+/* Wait for the next vblank event, or the one requested earlier */
+static gboolean
+gst_kms_src_wait_vblank (GstKmsSrc * self)
+{
+  drmEventContext evctxt = {
+    .version = DRM_EVENT_CONTEXT_VERSION,
+    .vblank_handler = sync_handler,
+  };
   gint ret;
 
-  if (crtc_pipe == 1)
-    vbl.request.type |= DRM_VBLANK_SECONDARY;
-  else if (crtc_pipe > 1)
-    vbl.request.type |= crtc_pipe << DRM_VBLANK_HIGH_CRTC_SHIFT;
+  if (!self->vblank_pending && !gst_kms_src_request_vblank (self))
+    return FALSE;
+
+  while (self->vblank_pending) {
+    do {
+      ret = gst_poll_wait (self->poll, 3 * GST_SECOND);
+    } while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
+    /* Flushing, timeout or error */
+    if (ret <= 0)
+      return FALSE;
+
+    if (gst_poll_fd_can_read (self->poll, &self->uevent_pollfd))
+      gst_kms_src_handle_uevents (self);
+
+    if (!gst_poll_fd_can_read (self->poll, &self->pollfd))
+      continue;
+
+    if (drmHandleEvent (self->fd, &evctxt))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+gst_kms_src_wait_until (GstKmsSrc * self, GstClockTime time)
+{
+  GstClockTimeDiff diff = GST_CLOCK_DIFF (gst_util_get_timestamp (), time);
+
+  /* No DRM events requested, so this only times out, gets flushed or
+   * wakes up for uevents */
+  while (diff > 0 && gst_poll_wait (self->poll, diff) > 0) {
+    if (!gst_poll_fd_can_read (self->poll, &self->uevent_pollfd))
+      break;
+
+    gst_kms_src_handle_uevents (self);
+    diff = GST_CLOCK_DIFF (gst_util_get_timestamp (), time);
+  }
+}
+
+static guint
+gst_kms_src_find_plane (GstKmsSrc * self, guint fb_id)
+{
+  drmModePlaneResPtr res;
+  drmModePlanePtr plane;
+  guint plane_id = 0;
+  guint i;
+
+  if (self->plane_id)
+    return self->plane_id;
+
+  res = drmModeGetPlaneResources (self->fd);
+  if (!res)
+    return 0;
+
+  for (i = 0; i < res->count_planes && !plane_id; i++) {
+    plane = drmModeGetPlane (self->fd, res->planes[i]);
+    if (!plane)
+      continue;
+
+    if (plane->fb_id == fb_id)
+      plane_id = plane->plane_id;
+
+    drmModeFreePlane (plane);
+  }
+
+  drmModeFreePlaneResources (res);
+  return plane_id;
+}
+
+/* Damage blob of the plane's latest commit, 0 when none was given */
+static guint
+gst_kms_src_get_damage_blob (GstKmsSrc * self, guint plane_id, guint * fb_id)
+{
+  drmModeObjectPropertiesPtr props;
+  drmModePropertyPtr prop;
+  guint blob_id = 0;
+  guint i;
+
+  *fb_id = 0;
+
+  props = drmModeObjectGetProperties (self->fd, plane_id,
+      DRM_MODE_OBJECT_PLANE);
+  if (!props)
+    return 0;
+
+  for (i = 0; i < props->count_props; i++) {
+    if (!self->damage_prop_id || !self->fb_prop_id) {
+      prop = drmModeGetProperty (self->fd, props->props[i]);
+      if (!prop)
+        continue;
+
+      if (!strcmp (prop->name, "FB_DAMAGE_CLIPS"))
+        self->damage_prop_id = prop->prop_id;
+      else if (!strcmp (prop->name, "FB_ID"))
+        self->fb_prop_id = prop->prop_id;
+
+      drmModeFreeProperty (prop);
+    }
+
+    if (props->props[i] == self->damage_prop_id)
+      blob_id = props->prop_values[i];
+    else if (props->props[i] == self->fb_prop_id)
+      *fb_id = props->prop_values[i];
+  }
+
+  drmModeFreeObjectProperties (props);
+  return blob_id;
+}
+
+static void
+gst_kms_src_reset_damage (GstKmsSrc * self, gboolean full)
+{
+  g_array_set_size (self->damage, 0);
+  self->damage_full = full;
+}
+
+/* Accumulate the damage of the commits seen since the last frame */
+static void
+gst_kms_src_track_damage (GstKmsSrc * self, guint fb_id)
+{
+  GstVideoInfo *info = &self->info;
+  drmModePropertyBlobPtr blob;
+  struct drm_mode_rect *clips;
+  GstVideoRectangle crop;
+  guint blob_id = 0, plane_fb_id = 0;
+  guint i, n_clips;
+  gboolean missed;
+
+  if (!fb_id)
+    return;
+
+  /* The plane is cached, as long as it still scans out the FB */
+  if (self->damage_plane_id)
+    blob_id = gst_kms_src_get_damage_blob (self, self->damage_plane_id,
+        &plane_fb_id);
+
+  if (plane_fb_id != fb_id) {
+    self->damage_plane_id = gst_kms_src_find_plane (self, fb_id);
+
+    blob_id = 0;
+    if (self->damage_plane_id)
+      blob_id = gst_kms_src_get_damage_blob (self, self->damage_plane_id,
+          &plane_fb_id);
+  }
+
+  /* The commits of the skipped vblanks were never seen */
+  missed = self->vblank_seq_valid && self->damage_seq_valid &&
+      self->vblank_seq - self->damage_seq > 1;
+  if (missed)
+    GST_LOG_OBJECT (self, "missed vblanks %u-%u", self->damage_seq + 1,
+        self->vblank_seq - 1);
+
+  self->damage_seq_valid = self->vblank_seq_valid;
+  self->damage_seq = self->vblank_seq;
+
+  if (!missed && fb_id == self->damage_fb_id &&
+      blob_id == self->damage_blob_id)
+    return;
+
+  self->damage_fb_id = fb_id;
+  self->damage_blob_id = blob_id;
+
+  if (self->damage_full)
+    return;
+
+  if (missed) {
+    self->damage_full = TRUE;
+    return;
+  }
+
+  /* Committed without damage clips, assume everything changed */
+  blob = blob_id ? drmModeGetPropertyBlob (self->fd, blob_id) : NULL;
+  if (!blob) {
+    self->damage_full = TRUE;
+    return;
+  }
+
+  /* Only the damage within the crop is of interest */
+  gst_kms_src_get_crop (self, GST_VIDEO_INFO_FORMAT (info),
+      GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info), &crop);
+
+  clips = blob->data;
+  n_clips = blob->length / sizeof (*clips);
+
+  for (i = 0; i < n_clips; i++) {
+    GstVideoRectangle rect;
+    gint x1 = MAX (clips[i].x1, crop.x);
+    gint y1 = MAX (clips[i].y1, crop.y);
+    gint x2 = MIN (clips[i].x2, crop.x + crop.w);
+    gint y2 = MIN (clips[i].y2, crop.y + crop.h);
+
+    if (x1 >= x2 || y1 >= y2)
+      continue;
+
+    rect.x = x1;
+    rect.y = y1;
+    rect.w = x2 - x1;
+    rect.h = y2 - y1;
+    g_array_append_val (self->damage, rect);
+  }
+
+  if (self->damage->len > KMS_SRC_MAX_DAMAGE_RECTS)
+    gst_kms_src_reset_damage (self, TRUE);
+
+  drmModeFreePropertyBlob (blob);
+}
+
+static void
+gst_kms_src_add_damage_meta (GstKmsSrc * self, GstBuffer * buf)
+{
+  GstVideoInfo *info = &self->info;
+  GstVideoRectangle crop;
+  gint out_w, out_h;
+  guint i;
+
+  if (self->damage_full)
+    return;
+
+  /* Map the damage from the FB to the output */
+  gst_kms_src_get_crop (self, GST_VIDEO_INFO_FORMAT (info),
+      GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info), &crop);
+  out_w = self->width ? (gint) self->width : crop.w;
+  out_h = self->height ? (gint) self->height : crop.h;
+
+  for (i = 0; i < self->damage->len; i++) {
+    GstVideoRectangle *rect =
+        &g_array_index (self->damage, GstVideoRectangle, i);
+    gint x1 = MAX (rect->x, crop.x) - crop.x;
+    gint y1 = MAX (rect->y, crop.y) - crop.y;
+    gint x2 = MIN (rect->x + rect->w, crop.x + crop.w) - crop.x;
+    gint y2 = MIN (rect->y + rect->h, crop.y + crop.h) - crop.y;
+
+    if (x1 >= x2 || y1 >= y2)
+      continue;
+
+    x1 = gst_util_uint64_scale_int (x1, out_w, crop.w);
+    y1 = gst_util_uint64_scale_int (y1, out_h, crop.h);
+    x2 = gst_util_uint64_scale_int_ceil (x2, out_w, crop.w);
+    y2 = gst_util_uint64_scale_int_ceil (y2, out_h, crop.h);
+
+    gst_buffer_add_video_region_of_interest_meta (buf, "damage", x1, y1,
+        x2 - x1, y2 - y1);
+  }
+}
+
+static GstClockTime
+gst_kms_src_get_frame_duration (GstKmsSrc * self)
+{
+  if (self->fps_d && self->fps_n)
+    return gst_util_uint64_scale (GST_SECOND, self->fps_d, self->fps_n);
+
+  if (self->framerate_limit)
+    return GST_SECOND / self->framerate_limit;
+
+  return 0;
+}
+
+static guint
+gst_kms_src_get_next_fb_id (GstKmsSrc * self)
+{
+  GstClockTime deadline;
+  /* Any plane might change when compositing */
+  gboolean sync_fb = self->sync_fb && !self->fb_id && !self->composite;
+  guint fb_id;
+
+  deadline = self->last_frame_time + gst_kms_src_get_frame_duration (self);
+
+  self->vblank_time = GST_CLOCK_TIME_NONE;
+  self->vblank_seq_valid = FALSE;
+
+  if (!self->sync_vblank && !sync_fb) {
+    gst_kms_src_wait_until (self, deadline);
+    return self->flushing ? 0 : gst_kms_src_get_fb_id (self);
+  }
+
+  /* Emit on the first vblank after the deadline (with a new FB if syncing) */
+  while (1) {
+    if (!gst_kms_src_wait_vblank (self)) {
+      self->vblank_time = GST_CLOCK_TIME_NONE;
+      self->vblank_seq_valid = FALSE;
+
+      if (self->flushing)
+        return 0;
+
+      GST_LOG_OBJECT (self, "no vblank event, sleeping");
+      gst_kms_src_wait_until (self, MAX (deadline,
+              gst_util_get_timestamp () + KMS_SRC_FALLBACK_PERIOD));
+
+      if (self->flushing)
+        return 0;
+    }
+
+    if (GST_CLOCK_DIFF (gst_util_get_timestamp (), deadline) > 0) {
+      /* Don't miss the damage of the commits in between */
+      if (self->track_damage && !self->composite)
+        gst_kms_src_track_damage (self, gst_kms_src_get_fb_id (self));
+
+      continue;
+    }
+
+    fb_id = gst_kms_src_get_fb_id (self);
+    if (!fb_id)
+      return 0;
+
+    if (!sync_fb || fb_id != self->last_fb_id)
+      return fb_id;
+  }
+
+  return 0;
+}
+
+#ifndef HAS_DRM_CLOSE_HANDLE
+/* From libdrm 2.4.109 : xf86drm.c */
+static int
+drmCloseBufferHandle(int fd, uint32_t handle)
+{
+  struct drm_gem_close args;
+
+  memset(&args, 0, sizeof(args));
+  args.handle = handle;
+  return drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &args);
+}
+#endif
+
+static void
+gst_kms_src_free_fb (GstKmsSrc * self, struct kmssrc_fb * fb)
+{
+  guint i, j;
+
+  for (i = 0; i < 4; i++) {
+    if (!fb->handles[i])
+      continue;
+
+    /* Planes in the same buffer share the handle */
+    drmCloseBufferHandle (self->fd, fb->handles[i]);
+    for (j = i + 1; j < 4; j++) {
+      if (fb->handles[j] == fb->handles[i])
+        fb->handles[j] = 0;
+    }
+
+    fb->handles[i] = 0;
+  }
+}
+
+#ifdef HAVE_RGA
+/* Pool of dumb buffers for the RGA copies */
+#define GST_TYPE_KMS_SRC_POOL (gst_kms_src_pool_get_type())
+G_DECLARE_FINAL_TYPE (GstKmsSrcPool, gst_kms_src_pool, GST, KMS_SRC_POOL,
+    GstBufferPool);
+
+struct _GstKmsSrcPool {
+  GstBufferPool parent;
+
+  /* not reffed, the pool is owned by it */
+  GstKmsSrc *src;
+  GstVideoInfo info;
+};
+
+G_DEFINE_TYPE (GstKmsSrcPool, gst_kms_src_pool, GST_TYPE_BUFFER_POOL);
+
+static GstMemory *
+gst_kms_src_alloc_dumb (GstKmsSrc * self, GstVideoInfo * info)
+{
+  struct drm_mode_create_dumb arg = { 0, };
+  GstMemory *mem;
+  gint dmafd;
+
+  arg.bpp = 8;
+  arg.width = GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+  arg.height = (GST_VIDEO_INFO_SIZE (info) + arg.width - 1) / arg.width;
+
+  if (drmIoctl (self->fd, DRM_IOCTL_MODE_CREATE_DUMB, &arg) < 0) {
+    GST_ERROR_OBJECT (self, "could not create dumb buffer");
+    return NULL;
+  }
+
+  if (drmPrimeHandleToFD (self->fd, arg.handle, DRM_CLOEXEC | DRM_RDWR,
+        &dmafd) < 0) {
+    GST_ERROR_OBJECT (self, "could not export dumb buffer");
+    drmCloseBufferHandle (self->fd, arg.handle);
+    return NULL;
+  }
+
+  /* The dma-buf holds the buffer now */
+  drmCloseBufferHandle (self->fd, arg.handle);
+
+  mem = gst_dmabuf_allocator_alloc (self->allocator, dmafd, arg.size);
+  if (!mem) {
+    close (dmafd);
+    return NULL;
+  }
+
+  gst_memory_resize (mem, 0, GST_VIDEO_INFO_SIZE (info));
+  return mem;
+}
+
+static GstFlowReturn
+gst_kms_src_pool_alloc_buffer (GstBufferPool * pool, GstBuffer ** buffer,
+    GstBufferPoolAcquireParams * params)
+{
+  GstKmsSrcPool *self = GST_KMS_SRC_POOL (pool);
+  GstVideoInfo *info = &self->info;
+  GstVideoMeta *meta;
+  GstMemory *mem;
+
+  (void) params;
+
+  mem = gst_kms_src_alloc_dumb (self->src, info);
+  if (!mem)
+    return GST_FLOW_ERROR;
+
+  *buffer = gst_buffer_new ();
+  gst_buffer_append_memory (*buffer, mem);
+
+  meta = gst_buffer_add_video_meta_full (*buffer, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info),
+      GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info),
+      GST_VIDEO_INFO_N_PLANES (info), info->offset, info->stride);
+  GST_META_FLAG_SET (meta, GST_META_FLAG_POOLED);
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_kms_src_pool_init (GstKmsSrcPool * self)
+{
+  (void) self;
+}
+
+static void
+gst_kms_src_pool_class_init (GstKmsSrcPoolClass * klass)
+{
+  GstBufferPoolClass *pool_class = GST_BUFFER_POOL_CLASS (klass);
+
+  pool_class->alloc_buffer = gst_kms_src_pool_alloc_buffer;
+}
+
+static GstBufferPool *
+gst_kms_src_pool_new (GstKmsSrc * src, GstVideoInfo * info)
+{
+  GstKmsSrcPool *self;
+  GstStructure *config;
+  GstCaps *caps;
+
+  self = g_object_new (GST_TYPE_KMS_SRC_POOL, NULL);
+  gst_object_ref_sink (self);
+
+  self->src = src;
+  self->info = *info;
+
+  caps = gst_video_info_to_caps (info);
+  config = gst_buffer_pool_get_config (GST_BUFFER_POOL (self));
+  gst_buffer_pool_config_set_params (config, caps,
+      GST_VIDEO_INFO_SIZE (info), 2, 0);
+  gst_caps_unref (caps);
+
+  if (!gst_buffer_pool_set_config (GST_BUFFER_POOL (self), config) ||
+      !gst_buffer_pool_set_active (GST_BUFFER_POOL (self), TRUE)) {
+    gst_object_unref (self);
+    return NULL;
+  }
+
+  return GST_BUFFER_POOL (self);
+}
+
+static RgaSURF_FORMAT
+gst_kms_src_get_rga_format (GstVideoFormat format)
+{
+#define KMSSRC_CASE_RGA(gst, rga) \
+  case GST_VIDEO_FORMAT_ ## gst: return RK_FORMAT_ ## rga;
+
+  switch (format) {
+    KMSSRC_CASE_RGA (BGRA, BGRA_8888);
+    KMSSRC_CASE_RGA (BGRx, BGRX_8888);
+    KMSSRC_CASE_RGA (RGBA, RGBA_8888);
+    KMSSRC_CASE_RGA (RGBx, RGBX_8888);
+    KMSSRC_CASE_RGA (BGR, BGR_888);
+    KMSSRC_CASE_RGA (RGB, RGB_888);
+    KMSSRC_CASE_RGA (BGR16, RGB_565);
+    KMSSRC_CASE_RGA (NV12, YCbCr_420_SP);
+    KMSSRC_CASE_RGA (NV21, YCrCb_420_SP);
+    KMSSRC_CASE_RGA (I420, YCbCr_420_P);
+    KMSSRC_CASE_RGA (YV12, YCrCb_420_P);
+    KMSSRC_CASE_RGA (NV16, YCbCr_422_SP);
+    KMSSRC_CASE_RGA (NV61, YCrCb_422_SP);
+    KMSSRC_CASE_RGA (Y42B, YCbCr_422_P);
+  default:
+    return RK_FORMAT_UNKNOWN;
+  }
+}
+
+static gboolean
+gst_kms_src_set_rga_info (rga_info_t * rga_info, GstVideoInfo * info,
+    gint fd)
+{
+  RgaSURF_FORMAT format;
+  guint hstride, vstride;
+
+  format = gst_kms_src_get_rga_format (GST_VIDEO_INFO_FORMAT (info));
+  if (format == RK_FORMAT_UNKNOWN || GST_VIDEO_INFO_PLANE_OFFSET (info, 0))
+    return FALSE;
+
+  hstride = GST_VIDEO_INFO_PLANE_STRIDE (info, 0) /
+      GST_VIDEO_INFO_COMP_PSTRIDE (info, 0);
+
+  if (GST_VIDEO_INFO_N_PLANES (info) == 1)
+    vstride = GST_VIDEO_INFO_HEIGHT (info);
+  else
+    vstride = GST_VIDEO_INFO_PLANE_OFFSET (info, 1) /
+        GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+
+  memset (rga_info, 0, sizeof (*rga_info));
+  rga_info->fd = fd;
+  rga_info->mmuFlag = 1;
+
+  rga_set_rect (&rga_info->rect, 0, 0, GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info), hstride, vstride, format);
+  return TRUE;
+}
+
+static gboolean
+gst_kms_src_get_crtc_size (GstKmsSrc * self, guint * width, guint * height)
+{
+  drmModeCrtcPtr crtc;
+
+  if (!self->topology_valid)
+    gst_kms_src_update_topology (self);
+
+  crtc = drmModeGetCrtc (self->fd, self->cur_crtc_id);
+  if (!crtc)
+    return FALSE;
+
+  *width = crtc->mode.hdisplay;
+  *height = crtc->mode.vdisplay;
+
+  drmModeFreeCrtc (crtc);
+  return *width && *height;
+}
+
+static gboolean
+gst_kms_src_update_copy_info (GstKmsSrc * self)
+{
+  GstVideoInfo *info = &self->copy_info;
+  GstVideoFormat format = self->copy_format;
+  GstVideoFormat src_format;
+  GstVideoAlignment align;
+  guint src_width, src_height;
+  guint width, height;
+
+  if (self->composite) {
+    /* The composition covers the whole CRTC */
+    if (!gst_kms_src_get_crtc_size (self, &src_width, &src_height)) {
+      GST_ERROR_OBJECT (self, "could not get CRTC size");
+      return FALSE;
+    }
+
+    if (format == GST_VIDEO_FORMAT_UNKNOWN)
+      format = GST_VIDEO_FORMAT_BGRx;
+
+    src_format = format;
+  } else {
+    src_width = GST_VIDEO_INFO_WIDTH (&self->info);
+    src_height = GST_VIDEO_INFO_HEIGHT (&self->info);
+    src_format = GST_VIDEO_INFO_FORMAT (&self->info);
+
+    if (format == GST_VIDEO_FORMAT_UNKNOWN)
+      format = src_format;
+  }
+
+  if (gst_kms_src_get_rga_format (format) == RK_FORMAT_UNKNOWN) {
+    GST_ERROR_OBJECT (self, "format not supported by RGA %s",
+        gst_video_format_to_string (format));
+    return FALSE;
+  }
+
+  gst_kms_src_get_crop (self, src_format, src_width, src_height,
+      &self->copy_crop);
+
+  width = self->width ? self->width : (guint) self->copy_crop.w;
+  height = self->height ? self->height : (guint) self->copy_crop.h;
+
+  gst_video_info_set_format (info, format, width, height);
+
+  /* MPP prefers 16 aligned strides */
+  gst_video_alignment_reset (&align);
+  align.padding_right = GST_ROUND_UP_16 (width) - width;
+  align.padding_bottom = GST_ROUND_UP_16 (height) - height;
+  gst_video_info_align (info, &align);
+
+  return TRUE;
+}
+
+static GstBuffer *
+gst_kms_src_acquire_copy_buffer (GstKmsSrc * self)
+{
+  GstBuffer *buf = NULL;
+
+  if (!gst_kms_src_update_copy_info (self))
+    return NULL;
+
+  if (self->pool && !gst_video_info_is_equal (&self->copy_info,
+          &GST_KMS_SRC_POOL (self->pool)->info)) {
+    gst_buffer_pool_set_active (self->pool, FALSE);
+    gst_clear_object (&self->pool);
+  }
+
+  if (!self->pool) {
+    self->pool = gst_kms_src_pool_new (self, &self->copy_info);
+    if (!self->pool)
+      return NULL;
+  }
+
+  if (gst_buffer_pool_acquire_buffer (self->pool, &buf, NULL) != GST_FLOW_OK)
+    return NULL;
+
+  return buf;
+}
+
+/* Blit the FB into a pooled buffer, so that it can't change under us */
+static GstBuffer *
+gst_kms_src_copy_rga (GstKmsSrc * self, GstBuffer * fb_buf)
+{
+  GstBuffer *buf;
+  rga_info_t src_info, dst_info;
+  gint src_fd, dst_fd;
+
+  buf = gst_kms_src_acquire_copy_buffer (self);
+  if (!buf)
+    return NULL;
+
+  src_fd = gst_dmabuf_memory_get_fd (gst_buffer_peek_memory (fb_buf, 0));
+  dst_fd = gst_dmabuf_memory_get_fd (gst_buffer_peek_memory (buf, 0));
+
+  if (!gst_kms_src_set_rga_info (&src_info, &self->info, src_fd) ||
+      !gst_kms_src_set_rga_info (&dst_info, &self->copy_info, dst_fd)) {
+    GST_ERROR_OBJECT (self, "unsupported RGA copy");
+    goto err;
+  }
+
+  src_info.rect.xoffset = self->copy_crop.x;
+  src_info.rect.yoffset = self->copy_crop.y;
+  src_info.rect.width = self->copy_crop.w;
+  src_info.rect.height = self->copy_crop.h;
+
+  if (c_RkRgaBlit (&src_info, &dst_info, NULL) < 0) {
+    GST_ERROR_OBJECT (self, "failed to blit");
+    goto err;
+  }
+
+  return buf;
+err:
+  gst_buffer_unref (buf);
+  return NULL;
+}
+
+enum
+{
+  KMSSRC_PLANE_PROP_SRC_X,
+  KMSSRC_PLANE_PROP_SRC_Y,
+  KMSSRC_PLANE_PROP_SRC_W,
+  KMSSRC_PLANE_PROP_SRC_H,
+  KMSSRC_PLANE_PROP_CRTC_X,
+  KMSSRC_PLANE_PROP_CRTC_Y,
+  KMSSRC_PLANE_PROP_CRTC_W,
+  KMSSRC_PLANE_PROP_CRTC_H,
+  KMSSRC_PLANE_PROP_ZPOS,
+  KMSSRC_PLANE_PROP_LAST,
+};
+
+struct kmssrc_plane {
+  guint plane_id;
+  guint fb_id;
+  guint64 zpos;
+
+  /* source rect in FB pixels and destination rect on the CRTC */
+  GstVideoRectangle src;
+  GstVideoRectangle dst;
+};
+
+static gint
+gst_kms_src_compare_plane (gconstpointer a, gconstpointer b)
+{
+  const struct kmssrc_plane *pa = a;
+  const struct kmssrc_plane *pb = b;
+
+  if (pa->zpos != pb->zpos)
+    return pa->zpos < pb->zpos ? -1 : 1;
+
+  return pa->plane_id < pb->plane_id ? -1 : 1;
+}
+
+/* Property IDs of a plane, resolved once per topology */
+struct kmssrc_plane_props {
+  guint ids[KMSSRC_PLANE_PROP_LAST];
+};
+
+static const gchar *kmssrc_plane_prop_names[KMSSRC_PLANE_PROP_LAST] = {
+  [KMSSRC_PLANE_PROP_SRC_X] = "SRC_X",
+  [KMSSRC_PLANE_PROP_SRC_Y] = "SRC_Y",
+  [KMSSRC_PLANE_PROP_SRC_W] = "SRC_W",
+  [KMSSRC_PLANE_PROP_SRC_H] = "SRC_H",
+  [KMSSRC_PLANE_PROP_CRTC_X] = "CRTC_X",
+  [KMSSRC_PLANE_PROP_CRTC_Y] = "CRTC_Y",
+  [KMSSRC_PLANE_PROP_CRTC_W] = "CRTC_W",
+  [KMSSRC_PLANE_PROP_CRTC_H] = "CRTC_H",
+  [KMSSRC_PLANE_PROP_ZPOS] = "zpos",
+};
+
+static struct kmssrc_plane_props *
+gst_kms_src_get_plane_props (GstKmsSrc * self, guint plane_id,
+    drmModeObjectPropertiesPtr props)
+{
+  struct kmssrc_plane_props *plane_props;
+  drmModePropertyPtr prop;
+  guint i, j;
+
+  plane_props = g_hash_table_lookup (self->plane_props,
+      GUINT_TO_POINTER (plane_id));
+  if (plane_props)
+    return plane_props;
+
+  plane_props = g_new0 (struct kmssrc_plane_props, 1);
+
+  for (i = 0; i < props->count_props; i++) {
+    prop = drmModeGetProperty (self->fd, props->props[i]);
+    if (!prop)
+      continue;
+
+    for (j = 0; j < KMSSRC_PLANE_PROP_LAST; j++) {
+      if (!strcmp (prop->name, kmssrc_plane_prop_names[j]))
+        plane_props->ids[j] = prop->prop_id;
+    }
+
+    drmModeFreeProperty (prop);
+  }
+
+  g_hash_table_insert (self->plane_props, GUINT_TO_POINTER (plane_id),
+      plane_props);
+  return plane_props;
+}
 
-  waiting = TRUE;
-  ret = drmWaitVBlank (self->fd, &vbl);
-  if (ret)
+static gboolean
+gst_kms_src_get_plane_state (GstKmsSrc * self, guint plane_id,
+    struct kmssrc_plane *plane)
+{
+  struct kmssrc_plane_props *plane_props;
+  drmModeObjectPropertiesPtr props;
+  guint64 values[KMSSRC_PLANE_PROP_LAST] = { 0, };
+  guint i, j;
+
+  props = drmModeObjectGetProperties (self->fd, plane_id,
+      DRM_MODE_OBJECT_PLANE);
+  if (!props)
     return FALSE;
 
-  while (waiting) {
-    do {
-      ret = gst_poll_wait (self->poll, 3 * GST_SECOND);
-    } while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+  plane_props = gst_kms_src_get_plane_props (self, plane_id, props);
 
-    ret = drmHandleEvent (self->fd, &evctxt);
-    if (ret)
-      return FALSE;
+  for (i = 0; i < props->count_props; i++) {
+    for (j = 0; j < KMSSRC_PLANE_PROP_LAST; j++) {
+      if (props->props[i] == plane_props->ids[j])
+        values[j] = props->prop_values[i];
+    }
   }
 
-  GST_DEBUG_OBJECT (self, "sync vblank with CRTC: %d(%d)", crtc_id, crtc_pipe);
-  return TRUE;
+  drmModeFreeObjectProperties (props);
+
+  /* SRC_* are 16.16 fixed point, CRTC_X/Y are signed */
+  plane->src.x = values[KMSSRC_PLANE_PROP_SRC_X] >> 16;
+  plane->src.y = values[KMSSRC_PLANE_PROP_SRC_Y] >> 16;
+  plane->src.w = values[KMSSRC_PLANE_PROP_SRC_W] >> 16;
+  plane->src.h = values[KMSSRC_PLANE_PROP_SRC_H] >> 16;
+  plane->dst.x = (gint64) values[KMSSRC_PLANE_PROP_CRTC_X];
+  plane->dst.y = (gint64) values[KMSSRC_PLANE_PROP_CRTC_Y];
+  plane->dst.w = values[KMSSRC_PLANE_PROP_CRTC_W];
+  plane->dst.h = values[KMSSRC_PLANE_PROP_CRTC_H];
+  plane->zpos = values[KMSSRC_PLANE_PROP_ZPOS];
+
+  return plane->src.w && plane->src.h && plane->dst.w && plane->dst.h;
 }
 
-static guint
-gst_kms_src_get_next_fb_id (GstKmsSrc * self)
+/* Active planes of the CRTC, bottom first */
+static GArray *
+gst_kms_src_get_planes (GstKmsSrc * self)
 {
-  GstClockTimeDiff diff;
-  gboolean sync_fb = self->sync_fb && !self->fb_id;
-  guint duration = 0;
-  guint fb_id;
+  drmModePlaneResPtr res;
+  drmModePlanePtr plane;
+  GArray *planes;
+  guint i;
 
-  if (self->sync_vblank)
-    gst_kms_src_sync_vblank (self);
+  if (!self->topology_valid)
+    gst_kms_src_update_topology (self);
 
-  if (self->fps_d && self->fps_n)
-    duration =
-        gst_util_uint64_scale (GST_SECOND, self->fps_d, self->fps_n);
-  else if (self->framerate_limit)
-    duration = GST_SECOND / self->framerate_limit;
+  res = drmModeGetPlaneResources (self->fd);
+  if (!res)
+    return NULL;
 
-  while (1) {
-    diff = GST_CLOCK_DIFF (self->last_frame_time, gst_util_get_timestamp ());
+  planes = g_array_new (FALSE, TRUE, sizeof (struct kmssrc_plane));
 
-    fb_id = gst_kms_src_get_fb_id (self);
-    if (!fb_id)
-      return 0;
+  for (i = 0; i < res->count_planes; i++) {
+    struct kmssrc_plane state = { 0, };
+
+    plane = drmModeGetPlane (self->fd, res->planes[i]);
+    if (!plane)
+      continue;
 
-    if (!sync_fb || fb_id != self->last_fb_id) {
-      sync_fb = FALSE;
+    if (plane->fb_id && plane->crtc_id == self->cur_crtc_id) {
+      state.plane_id = plane->plane_id;
+      state.fb_id = plane->fb_id;
 
-      if (diff >= duration)
-        return fb_id;
+      if (gst_kms_src_get_plane_state (self, plane->plane_id, &state))
+        g_array_append_val (planes, state);
     }
 
-    g_usleep (1000);
+    drmModeFreePlane (plane);
   }
 
-  return 0;
+  drmModeFreePlaneResources (res);
+
+  g_array_sort (planes, gst_kms_src_compare_plane);
+  return planes;
 }
 
-#ifndef HAS_DRM_CLOSE_HANDLE
-/* From libdrm 2.4.109 : xf86drm.c */
-static int
-drmCloseBufferHandle(int fd, uint32_t handle)
+/* Clip the plane to the cropped CRTC, cropping the source proportionally */
+static gboolean
+gst_kms_src_clip_plane (struct kmssrc_plane *plane, GstVideoRectangle * crop)
 {
-  struct drm_gem_close args;
+  GstVideoRectangle *src = &plane->src;
+  GstVideoRectangle *dst = &plane->dst;
+  gint x1 = MAX (dst->x, crop->x);
+  gint y1 = MAX (dst->y, crop->y);
+  gint x2 = MIN (dst->x + dst->w, crop->x + crop->w);
+  gint y2 = MIN (dst->y + dst->h, crop->y + crop->h);
+
+  if (x1 >= x2 || y1 >= y2)
+    return FALSE;
 
-  memset(&args, 0, sizeof(args));
-  args.handle = handle;
-  return drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &args);
+  src->x += (gint64) (x1 - dst->x) * src->w / dst->w;
+  src->y += (gint64) (y1 - dst->y) * src->h / dst->h;
+  src->w = (gint64) (x2 - x1) * src->w / dst->w;
+  src->h = (gint64) (y2 - y1) * src->h / dst->h;
+
+  dst->x = x1 - crop->x;
+  dst->y = y1 - crop->y;
+  dst->w = x2 - x1;
+  dst->h = y2 - y1;
+
+  return src->w && src->h;
 }
-#endif
 
+/* RGA requires YUV rects aligned to 2 */
 static void
-gst_kms_src_free_fb (GstKmsSrc * self, struct kmssrc_fb * fb)
+gst_kms_src_align_rga_rect (rga_rect_t * rect, GstVideoInfo * info)
+{
+  gint x2 = rect->xoffset + rect->width;
+  gint y2 = rect->yoffset + rect->height;
+
+  if (!GST_VIDEO_INFO_IS_YUV (info))
+    return;
+
+  rect->xoffset &= ~1;
+  rect->yoffset &= ~1;
+  rect->width = MAX ((x2 & ~1) - rect->xoffset, 0);
+  rect->height = MAX ((y2 & ~1) - rect->yoffset, 0);
+}
+
+/* Compose all the planes of the CRTC into a pooled buffer */
+static GstBuffer *
+gst_kms_src_composite_rga (GstKmsSrc * self)
 {
+  GstVideoInfo *info = &self->copy_info;
+  GstVideoRectangle *crop = &self->copy_crop;
+  GstVideoInfo plane_info;
+  GstBuffer *buf, *fb_buf;
+  GArray *planes;
+  rga_info_t src_info, dst_info;
+  guint64 bottom_zpos;
+  gint dst_fd;
   guint i;
 
-  for (i = 0; i < 4; i++) {
-    if (fb->handles[i])
-      drmCloseBufferHandle (self->fd, fb->handles[i]);
+  planes = gst_kms_src_get_planes (self);
+  if (!planes)
+    return NULL;
 
-    fb->handles[i] = 0;
+  buf = gst_kms_src_acquire_copy_buffer (self);
+  if (!buf)
+    goto err;
+
+  dst_fd = gst_dmabuf_memory_get_fd (gst_buffer_peek_memory (buf, 0));
+  if (!gst_kms_src_set_rga_info (&dst_info, info, dst_fd))
+    goto err;
+
+  /* Black background, planes might not cover the whole CRTC */
+  dst_info.color = 0xff000000;
+  if (c_RkRgaColorFill (&dst_info) < 0) {
+    GST_ERROR_OBJECT (self, "failed to fill");
+    goto err;
+  }
+
+  /* Sorted by zpos, the bottom one has nothing to blend with */
+  bottom_zpos = planes->len ?
+      g_array_index (planes, struct kmssrc_plane, 0).zpos : 0;
+
+  for (i = 0; i < planes->len; i++) {
+    struct kmssrc_plane *plane =
+        &g_array_index (planes, struct kmssrc_plane, i);
+    gint src_fd;
+
+    if (!gst_kms_src_clip_plane (plane, crop))
+      continue;
+
+    /* Imported through the FB cache, keeping self->info for the main FB */
+    fb_buf = gst_kms_src_import_drm_fb (self, plane->fb_id, &plane_info);
+    if (!fb_buf) {
+      GST_WARNING_OBJECT (self, "could not import FB %d", plane->fb_id);
+      continue;
+    }
+
+    src_fd = gst_dmabuf_memory_get_fd (gst_buffer_peek_memory (fb_buf, 0));
+    if (!gst_kms_src_set_rga_info (&src_info, &plane_info, src_fd)) {
+      GST_WARNING_OBJECT (self, "unsupported plane %d", plane->plane_id);
+      gst_buffer_unref (fb_buf);
+      continue;
+    }
+
+    src_info.rect.xoffset = plane->src.x;
+    src_info.rect.yoffset = plane->src.y;
+    src_info.rect.width = plane->src.w;
+    src_info.rect.height = plane->src.h;
+
+    /* Scale from the crop to the output */
+    dst_info.rect.xoffset =
+        plane->dst.x * GST_VIDEO_INFO_WIDTH (info) / crop->w;
+    dst_info.rect.yoffset =
+        plane->dst.y * GST_VIDEO_INFO_HEIGHT (info) / crop->h;
+    dst_info.rect.width =
+        plane->dst.w * GST_VIDEO_INFO_WIDTH (info) / crop->w;
+    dst_info.rect.height =
+        plane->dst.h * GST_VIDEO_INFO_HEIGHT (info) / crop->h;
+
+    gst_kms_src_align_rga_rect (&src_info.rect, &plane_info);
+    gst_kms_src_align_rga_rect (&dst_info.rect, info);
+
+    if (!src_info.rect.width || !src_info.rect.height ||
+        !dst_info.rect.width || !dst_info.rect.height) {
+      GST_DEBUG_OBJECT (self, "plane %d too small to blit", plane->plane_id);
+      gst_buffer_unref (fb_buf);
+      continue;
+    }
+
+    /* Pre-multiplied source over, as KMS blends by default */
+    if (GST_VIDEO_INFO_HAS_ALPHA (&plane_info) && plane->zpos > bottom_zpos)
+      src_info.blend = 0xff0405;
+
+    if (c_RkRgaBlit (&src_info, &dst_info, NULL) < 0)
+      GST_WARNING_OBJECT (self, "failed to blit plane %d (%s %dx%d) to "
+          "<%d,%d,%d,%d>", plane->plane_id,
+          gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (&plane_info)),
+          src_info.rect.width, src_info.rect.height, dst_info.rect.xoffset,
+          dst_info.rect.yoffset, dst_info.rect.width, dst_info.rect.height);
+
+    gst_buffer_unref (fb_buf);
   }
+
+  g_array_free (planes, TRUE);
+  return buf;
+err:
+  if (buf)
+    gst_buffer_unref (buf);
+  g_array_free (planes, TRUE);
+  return NULL;
 }
+#endif
 
 static gboolean
-gst_kms_src_update_info (GstKmsSrc * self, struct kmssrc_fb * fb)
+gst_kms_src_update_info (GstKmsSrc * self, struct kmssrc_fb * fb,
+    GstVideoInfo * info)
 {
-  GstVideoInfo *info = &self->info;
   GstVideoFormat format;
   guint i;
 
@@ -624,10 +1844,11 @@ gst_kms_src_get_fb (GstKmsSrc * self, guint fb_id, struct kmssrc_fb * kmssrc_fb)
   return TRUE;
 }
 
-static GstBuffer *
-gst_kms_src_import_drm_fb (GstKmsSrc * self, guint fb_id)
+static gboolean
+gst_kms_src_import_fb (GstKmsSrc * self, guint fb_id,
+    struct kmssrc_fb_cache *cache)
 {
-  GstVideoInfo *info = &self->info;
+  GstVideoInfo vinfo, *info = &vinfo;
   GstBuffer *buf = NULL;
   GstMemory *mem;
   struct kmssrc_fb fb;
@@ -636,10 +1857,10 @@ gst_kms_src_import_drm_fb (GstKmsSrc * self, guint fb_id)
 
   if (!gst_kms_src_get_fb (self, fb_id, &fb)) {
     GST_ERROR_OBJECT (self, "could not get DRM FB %d", fb_id);
-    return NULL;
+    return FALSE;
   }
 
-  if (!gst_kms_src_update_info (self, &fb))
+  if (!gst_kms_src_update_info (self, &fb, info))
     goto err;
 
   buf = gst_buffer_new ();
@@ -694,13 +1915,158 @@ gst_kms_src_import_drm_fb (GstKmsSrc * self, guint fb_id)
       GST_VIDEO_INFO_N_PLANES (info), info->offset, info->stride);
 
   gst_kms_src_free_fb (self, &fb);
-  return buf;
+
+  cache->fb_id = fb_id;
+  cache->fb = fb;
+  cache->dev = st[0].st_dev;
+  cache->ino = st[0].st_ino;
+  cache->buf = buf;
+  cache->info = *info;
+  return TRUE;
 err:
   if (buf)
     gst_buffer_unref (buf);
 
   gst_kms_src_free_fb (self, &fb);
-  return NULL;
+  return FALSE;
+}
+
+static void
+gst_kms_src_free_fb_cache (struct kmssrc_fb_cache *cache)
+{
+  gst_buffer_unref (cache->buf);
+  g_free (cache);
+}
+
+static void
+gst_kms_src_clear_fb_cache (GstKmsSrc * self)
+{
+  struct kmssrc_fb_cache *cache;
+
+  while ((cache = g_queue_pop_head (&self->fb_cache)))
+    gst_kms_src_free_fb_cache (cache);
+}
+
+/* Drop the entries of destroyed FBs, instead of waiting for their IDs */
+static void
+gst_kms_src_purge_fb_cache (GstKmsSrc * self)
+{
+  struct kmssrc_fb_cache *cache;
+  struct kmssrc_fb fb;
+  GList *l, *next;
+
+  for (l = self->fb_cache.head; l; l = next) {
+    next = l->next;
+    cache = l->data;
+
+    if (gst_kms_src_get_fb (self, cache->fb_id, &fb)) {
+      gst_kms_src_free_fb (self, &fb);
+      continue;
+    }
+
+    GST_DEBUG_OBJECT (self, "DRM FB %d destroyed, evicting", cache->fb_id);
+    g_queue_delete_link (&self->fb_cache, l);
+    gst_kms_src_free_fb_cache (cache);
+  }
+}
+
+/* Check that the FB ID still refers to the same buffer and layout */
+static gboolean
+gst_kms_src_validate_fb (GstKmsSrc * self, struct kmssrc_fb_cache *cache)
+{
+  struct kmssrc_fb fb;
+  struct stat st;
+  gboolean ret = FALSE;
+  gint dmafd;
+
+  /* Destroyed */
+  if (!gst_kms_src_get_fb (self, cache->fb_id, &fb))
+    return FALSE;
+
+  /* Cheap layout check first */
+  if (fb.width != cache->fb.width || fb.height != cache->fb.height ||
+      fb.fourcc != cache->fb.fourcc ||
+      memcmp (fb.pitches, cache->fb.pitches, sizeof (fb.pitches)) ||
+      memcmp (fb.offsets, cache->fb.offsets, sizeof (fb.offsets)))
+    goto out;
+
+  /* The GEM handles are new for every query, compare the dma-buf instead */
+  if (fb.handles[0] && drmPrimeHandleToFD (self->fd, fb.handles[0],
+          DRM_CLOEXEC, &dmafd) >= 0) {
+    ret = !fstat (dmafd, &st) &&
+        st.st_dev == cache->dev && st.st_ino == cache->ino;
+    close (dmafd);
+  }
+
+out:
+  gst_kms_src_free_fb (self, &fb);
+  return ret;
+}
+
+/* Import the FB through the cache, returning its info */
+static GstBuffer *
+gst_kms_src_import_drm_fb (GstKmsSrc * self, guint fb_id, GstVideoInfo * info)
+{
+  struct kmssrc_fb_cache *cache = NULL;
+  GList *l;
+
+  for (l = self->fb_cache.head; l; l = l->next) {
+    if (((struct kmssrc_fb_cache *) l->data)->fb_id == fb_id) {
+      cache = l->data;
+      g_queue_delete_link (&self->fb_cache, l);
+      break;
+    }
+  }
+
+  /* The ID may have been destroyed and reused for another buffer */
+  if (cache && !gst_kms_src_validate_fb (self, cache)) {
+    GST_DEBUG_OBJECT (self, "DRM FB %d changed, evicting", fb_id);
+    gst_kms_src_free_fb_cache (cache);
+    cache = NULL;
+  }
+
+  if (!cache) {
+    gst_kms_src_purge_fb_cache (self);
+
+    cache = g_new0 (struct kmssrc_fb_cache, 1);
+    if (!gst_kms_src_import_fb (self, fb_id, cache)) {
+      g_free (cache);
+      return NULL;
+    }
+
+    while (g_queue_get_length (&self->fb_cache) >= KMS_SRC_FB_CACHE_SIZE)
+      gst_kms_src_free_fb_cache (g_queue_pop_tail (&self->fb_cache));
+  }
+
+  g_queue_push_head (&self->fb_cache, cache);
+
+  *info = cache->info;
+
+  /* Sharing the cached memories */
+  return gst_buffer_copy (cache->buf);
+}
+
+/* Map a monotonic time into the running time of the pipeline clock */
+static GstClockTime
+gst_kms_src_get_running_time (GstKmsSrc * self, GstClockTime time)
+{
+  GstClock *clock;
+  GstClockTime now, base_time;
+  GstClockTimeDiff age;
+
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (!clock)
+    return time - self->start_time;
+
+  age = MAX (GST_CLOCK_DIFF (time, gst_util_get_timestamp ()), 0);
+  now = gst_clock_get_time (clock);
+  base_time = gst_element_get_base_time (GST_ELEMENT (self));
+  gst_object_unref (clock);
+
+  if (now < base_time + age)
+    return 0;
+
+  return now - base_time - age;
 }
 
 static GstFlowReturn
@@ -708,30 +2074,85 @@ gst_kms_src_create (GstPushSrc * src, GstBuffer ** ret)
 {
   GstKmsSrc *self = GST_KMS_SRC (src);
   GstBuffer *buf;
+  GstClockTime frame_time;
   guint fb_id;
 
   GST_DEBUG_OBJECT (self, "creating buffer");
 
+again:
   fb_id = gst_kms_src_get_next_fb_id (self);
   if (!fb_id) {
+    if (self->flushing)
+      return GST_FLOW_FLUSHING;
+
     GST_ERROR_OBJECT (self, "could not get valid FB");
     goto err;
   }
 
+  /* Prefer the scanout time to our wakeup time */
+  frame_time = self->vblank_time;
+  if (!GST_CLOCK_TIME_IS_VALID (frame_time))
+    frame_time = gst_util_get_timestamp ();
+
+  if (self->track_damage && !self->composite) {
+    gst_kms_src_track_damage (self, fb_id);
+
+    /* Nothing visible changed, tell downstream instead of repeating it */
+    if (!self->damage_full && !self->damage->len) {
+      GST_LOG_OBJECT (self, "FB %d unchanged", fb_id);
+
+      gst_pad_push_event (GST_BASE_SRC_PAD (self),
+          gst_event_new_gap (gst_kms_src_get_running_time (self,
+                  self->last_frame_time),
+              frame_time - self->last_frame_time));
+
+      self->last_frame_time = frame_time;
+      goto again;
+    }
+  }
+
   GST_DEBUG_OBJECT (self, "importing DRM FB %d (old: %d)",
       fb_id, self->last_fb_id);
 
-  buf = gst_kms_src_import_drm_fb (self, fb_id);
+#ifdef HAVE_RGA
+  if (self->composite)
+    buf = gst_kms_src_composite_rga (self);
+  else
+#endif
+    buf = gst_kms_src_import_drm_fb (self, fb_id, &self->info);
+
   if (!buf) {
     GST_ERROR_OBJECT (self, "could not import FB %d", fb_id);
     goto err;
   }
 
-  self->last_frame_time = gst_util_get_timestamp ();
+#ifdef HAVE_RGA
+  if (gst_kms_src_use_rga (self) && !self->composite) {
+    GstBuffer *fb_buf = buf;
+
+    buf = gst_kms_src_copy_rga (self, fb_buf);
+    gst_buffer_unref (fb_buf);
+
+    if (!buf) {
+      GST_ERROR_OBJECT (self, "could not copy FB %d", fb_id);
+      goto err;
+    }
+  }
+#endif
+
+  if (!gst_kms_src_use_rga (self))
+    gst_kms_src_crop_buffer (self, buf);
+
+  if (self->track_damage && !self->composite) {
+    gst_kms_src_add_damage_meta (self, buf);
+    gst_kms_src_reset_damage (self, FALSE);
+  }
+
+  self->last_frame_time = frame_time;
   self->last_fb_id = fb_id;
 
   GST_BUFFER_DTS (buf) = GST_BUFFER_PTS (buf) =
-      self->last_frame_time - self->start_time;
+      gst_kms_src_get_running_time (self, frame_time);
 
   *ret = buf;
 
@@ -773,6 +2194,27 @@ gst_kms_src_set_caps (GstBaseSrc * basesrc, GstCaps * caps)
   return TRUE;
 }
 
+static gboolean
+gst_kms_src_query (GstBaseSrc * basesrc, GstQuery * query)
+{
+  GstKmsSrc *self = GST_KMS_SRC (basesrc);
+  GstClockTime latency;
+
+  switch (GST_QUERY_TYPE (query)) {
+  case GST_QUERY_LATENCY:
+    /* Frames are timestamped at scanout, and pushed within a frame */
+    latency = gst_kms_src_get_frame_duration (self);
+
+    GST_DEBUG_OBJECT (self, "latency: %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (latency));
+
+    gst_query_set_latency (query, TRUE, latency, latency);
+    return TRUE;
+  default:
+    return GST_BASE_SRC_CLASS (parent_class)->query (basesrc, query);
+  }
+}
+
 static GstCaps *
 gst_kms_src_get_caps (GstBaseSrc * basesrc, GstCaps * filter)
 {
@@ -791,14 +2233,32 @@ gst_kms_src_get_caps (GstBaseSrc * basesrc, GstCaps * filter)
     return NULL;
   }
 
-  if (!gst_kms_src_update_info (self, &fb)) {
+  if (!gst_kms_src_update_info (self, &fb, &self->info)) {
     gst_kms_src_free_fb (self, &fb);
     return NULL;
   }
 
   gst_kms_src_free_fb (self, &fb);
 
-  caps = gst_video_info_to_caps (&self->info);
+#ifdef HAVE_RGA
+  if (gst_kms_src_use_rga (self)) {
+    if (!gst_kms_src_update_copy_info (self))
+      return NULL;
+
+    caps = gst_video_info_to_caps (&self->copy_info);
+  } else
+#endif
+  {
+    GstVideoRectangle crop;
+
+    gst_kms_src_get_crop (self, GST_VIDEO_INFO_FORMAT (&self->info),
+        GST_VIDEO_INFO_WIDTH (&self->info),
+        GST_VIDEO_INFO_HEIGHT (&self->info), &crop);
+
+    caps = gst_video_info_to_caps (&self->info);
+    gst_caps_set_simple (caps, "width", G_TYPE_INT, crop.w,
+        "height", G_TYPE_INT, crop.h, NULL);
+  }
 
   if (self->dma_feature)
     gst_caps_set_features (caps, 0,
@@ -821,6 +2281,26 @@ gst_kms_src_get_caps (GstBaseSrc * basesrc, GstCaps * filter)
   return caps;
 }
 
+static gboolean
+gst_kms_src_unlock (GstBaseSrc * basesrc)
+{
+  GstKmsSrc *self = GST_KMS_SRC (basesrc);
+
+  self->flushing = TRUE;
+  gst_poll_set_flushing (self->poll, TRUE);
+  return TRUE;
+}
+
+static gboolean
+gst_kms_src_unlock_stop (GstBaseSrc * basesrc)
+{
+  GstKmsSrc *self = GST_KMS_SRC (basesrc);
+
+  self->flushing = FALSE;
+  gst_poll_set_flushing (self->poll, FALSE);
+  return TRUE;
+}
+
 static gboolean
 gst_kms_src_stop (GstBaseSrc * basesrc)
 {
@@ -830,6 +2310,24 @@ gst_kms_src_stop (GstBaseSrc * basesrc)
   gst_poll_restart (self->poll);
   gst_poll_fd_init (&self->pollfd);
 
+  self->vblank_pending = FALSE;
+  self->topology_valid = FALSE;
+
+  gst_kms_src_clear_fb_cache (self);
+
+  if (self->uevent_pollfd.fd >= 0) {
+    gst_poll_remove_fd (self->poll, &self->uevent_pollfd);
+    close (self->uevent_pollfd.fd);
+    gst_poll_fd_init (&self->uevent_pollfd);
+  }
+
+#ifdef HAVE_RGA
+  if (self->pool) {
+    gst_buffer_pool_set_active (self->pool, FALSE);
+    gst_clear_object (&self->pool);
+  }
+#endif
+
   if (self->allocator)
     g_object_unref (self->allocator);
 
@@ -868,10 +2366,38 @@ gst_kms_src_find_best_crtc (GstKmsSrc * self)
   return crtc_id;
 }
 
+static gint
+gst_kms_src_open_uevent (GstKmsSrc * self)
+{
+  struct sockaddr_nl addr = {
+    .nl_family = AF_NETLINK,
+    .nl_groups = 1,             /* kernel uevents */
+  };
+  gint fd;
+
+  fd = socket (AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+      NETLINK_KOBJECT_UEVENT);
+  if (fd < 0)
+    goto err;
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+    close (fd);
+    goto err;
+  }
+
+  return fd;
+err:
+  /* Only re-resolve on failed lookups then */
+  GST_WARNING_OBJECT (self, "unable to monitor uevents: %s",
+      g_strerror (errno));
+  return -1;
+}
+
 static gboolean
 gst_kms_src_start (GstBaseSrc * basesrc)
 {
   GstKmsSrc *self = GST_KMS_SRC (basesrc);
+  guint64 cap;
 
   self->allocator = gst_dmabuf_allocator_new ();
   if (!self->allocator)
@@ -891,6 +2417,39 @@ gst_kms_src_start (GstBaseSrc * basesrc)
     return FALSE;
   }
 
+  /* Vblank timestamps are only usable in the monotonic clock */
+  if (drmGetCap (self->fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) < 0)
+    cap = 0;
+  self->monotonic_vblank = !!cap;
+
+  /* Plane states and damage clips are atomic properties */
+  if ((self->composite || self->track_damage) &&
+      drmSetClientCap (self->fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0)
+    GST_WARNING_OBJECT (self, "atomic not supported, planes might be hidden");
+
+  if (self->composite && self->fb_id) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
+        ("Composite requires a CRTC, not a FB"), (NULL));
+    gst_kms_src_stop (basesrc);
+    return FALSE;
+  }
+
+#ifdef HAVE_RGA
+  if (gst_kms_src_use_rga (self) && c_RkRgaInit () < 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("Could not init RGA"),
+        (NULL));
+    gst_kms_src_stop (basesrc);
+    return FALSE;
+  }
+#else
+  if (gst_kms_src_use_rga (self)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("RGA disabled at build time"),
+        (NULL));
+    gst_kms_src_stop (basesrc);
+    return FALSE;
+  }
+#endif
+
   if (!self->fb_id && !self->plane_id && !self->connector_id &&
       !self->encoder_id && !self->crtc_id) {
     self->crtc_id = gst_kms_src_find_best_crtc (self);
@@ -902,6 +2461,16 @@ gst_kms_src_start (GstBaseSrc * basesrc)
   }
 
   self->last_fb_id = 0;
+  self->vblank_pending = FALSE;
+  self->vblank_time = GST_CLOCK_TIME_NONE;
+
+  /* The first frame is fully damaged */
+  gst_kms_src_reset_damage (self, TRUE);
+  self->damage_fb_id = 0;
+  self->damage_blob_id = 0;
+  self->damage_seq_valid = FALSE;
+  self->damage_plane_id = 0;
+
   self->last_frame_time = gst_util_get_timestamp ();
   self->start_time = gst_util_get_timestamp ();
 
@@ -909,6 +2478,14 @@ gst_kms_src_start (GstBaseSrc * basesrc)
   gst_poll_add_fd (self->poll, &self->pollfd);
   gst_poll_fd_ctl_read (self->poll, &self->pollfd, TRUE);
 
+  self->topology_valid = FALSE;
+
+  self->uevent_pollfd.fd = gst_kms_src_open_uevent (self);
+  if (self->uevent_pollfd.fd >= 0) {
+    gst_poll_add_fd (self->poll, &self->uevent_pollfd);
+    gst_poll_fd_ctl_read (self->poll, &self->uevent_pollfd, TRUE);
+  }
+
   return TRUE;
 }
 
@@ -922,6 +2499,8 @@ gst_kms_src_finalize (GObject * object)
   g_clear_pointer (&self->bus_id, g_free);
 
   gst_poll_free (self->poll);
+  g_array_free (self->damage, TRUE);
+  g_hash_table_destroy (self->plane_props);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -942,16 +2521,25 @@ gst_kms_src_init (GstKmsSrc * self)
   self->framerate_limit = DEFAULT_PROP_FRAMERATE_LIMIT;
   self->sync_fb = TRUE;
   self->sync_vblank = TRUE;
+  self->track_damage = DEFAULT_PROP_TRACK_DAMAGE;
   self->fps_n = 0;
   self->fps_d = 1;
 
+  self->copy_mode = DEFAULT_PROP_COPY_MODE;
+  self->copy_format = DEFAULT_PROP_COPY_FORMAT;
+  self->composite = DEFAULT_PROP_COMPOSITE;
+
   gst_video_info_init (&self->info);
 
   gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
   gst_base_src_set_live (GST_BASE_SRC (self), TRUE);
 
   gst_poll_fd_init (&self->pollfd);
+  gst_poll_fd_init (&self->uevent_pollfd);
   self->poll = gst_poll_new (TRUE);
+
+  self->damage = g_array_new (FALSE, FALSE, sizeof (GstVideoRectangle));
+  self->plane_props = g_hash_table_new_full (NULL, NULL, NULL, g_free);
 }
 
 static void
@@ -1036,6 +2624,50 @@ gst_kms_src_class_init (GstKmsSrcClass * klass)
           "Sync with vblank", TRUE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_TRACK_DAMAGE,
+      g_param_spec_boolean ("track-damage", "Track damage",
+          "Send GAP events for unchanged frames and annotate the changed "
+          "ones with damage region of interest metas",
+          DEFAULT_PROP_TRACK_DAMAGE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COPY_MODE,
+      g_param_spec_enum ("copy-mode", "Copy mode",
+          "Copy the FB into a pool instead of exporting the live one",
+          GST_TYPE_KMS_SRC_COPY_MODE, DEFAULT_PROP_COPY_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COPY_FORMAT,
+      g_param_spec_enum ("copy-format", "Copy format",
+          "Format of the copied frames (unknown = FB format)",
+          GST_TYPE_VIDEO_FORMAT, DEFAULT_PROP_COPY_FORMAT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COMPOSITE,
+      g_param_spec_boolean ("composite", "Composite",
+          "Compose all the planes of the CRTC with RGA, instead of capturing "
+          "a single FB", DEFAULT_PROP_COMPOSITE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CROP_RECTANGLE,
+      gst_param_spec_array ("crop-rectangle", "Crop Rectangle",
+          "The crop rectangle ('<x, y, width, height>'), without copying "
+          "it requires downstream to honour the video meta's offsets",
+          g_param_spec_int ("rect-value", "Rectangle Value",
+              "One of x, y, width or height value.", 0, G_MAXINT, 0,
+              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WIDTH,
+      g_param_spec_uint ("width", "Width",
+          "Width of the output, scaled with RGA (0 = cropped width)",
+          0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_HEIGHT,
+      g_param_spec_uint ("height", "Height",
+          "Height of the output, scaled with RGA (0 = cropped height)",
+          0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_element_class_set_static_metadata (gstelement_class,
       "KMS Video Source",
       "Source/Video",
@@ -1046,8 +2678,11 @@ gst_kms_src_class_init (GstKmsSrcClass * klass)
 
   gstbase_src_class->set_caps = GST_DEBUG_FUNCPTR (gst_kms_src_set_caps);
   gstbase_src_class->get_caps = GST_DEBUG_FUNCPTR (gst_kms_src_get_caps);
+  gstbase_src_class->query = GST_DEBUG_FUNCPTR (gst_kms_src_query);
   gstbase_src_class->start = GST_DEBUG_FUNCPTR (gst_kms_src_start);
   gstbase_src_class->stop = GST_DEBUG_FUNCPTR (gst_kms_src_stop);
+  gstbase_src_class->unlock = GST_DEBUG_FUNCPTR (gst_kms_src_unlock);
+  gstbase_src_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_kms_src_unlock_stop);
   gstpush_src_class->create = GST_DEBUG_FUNCPTR (gst_kms_src_create);
 }
 
@@ -58,6 +58,11 @@
 #define RKXIMAGE_COLOR_KEY 0x010203
 #define RK_COLOR_KEY_EN (1UL << 31)
 
+/* From linux 6.8 : drm.h */
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
+
 GST_DEBUG_CATEGORY (gst_debug_x_image_sink);
 #define GST_CAT_DEFAULT gst_debug_x_image_sink
 
@@ -110,8 +115,28 @@ enum
   PROP_CONNECTOR_ID,
   PROP_PLANE_ID,
   PROP_FORCE_ASPECT_RATIO,
+  PROP_PRESENT_MODE,
 };
 
+#define GST_TYPE_RKXIMAGE_PRESENT_MODE (gst_rkximage_present_mode_get_type ())
+static GType
+gst_rkximage_present_mode_get_type (void)
+{
+  static GType present_mode = 0;
+
+  if (!present_mode) {
+    static const GEnumValue modes[] = {
+      {GST_RKXIMAGE_PRESENT_VSYNC, "Queue frames on vsync", "vsync"},
+      {GST_RKXIMAGE_PRESENT_MAILBOX,
+          "Replace the frame waiting for vsync with the newest one", "mailbox"},
+      {GST_RKXIMAGE_PRESENT_ASYNC, "Flip immediately, might tear", "async"},
+      {0, NULL, NULL}
+    };
+    present_mode = g_enum_register_static ("GstRkXImagePresentMode", modes);
+  }
+  return present_mode;
+}
+
 /* ============================================================= */
 /*                                                               */
 /*                       Public Methods                          */
@@ -360,12 +385,13 @@ drm_get_caps (GstRkXImageSink * self)
     self->has_prime_export = (gboolean) (has_prime & DRM_PRIME_CAP_EXPORT);
   }
 
+  /* The flips are atomic commits, the legacy cap doesn't apply to them */
   has_async_page_flip = 0;
-  ret = drmGetCap (self->fd, DRM_CAP_ASYNC_PAGE_FLIP, &has_async_page_flip);
+  ret = drmGetCap (self->fd, DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP,
+      &has_async_page_flip);
   if (ret)
-    GST_WARNING_OBJECT (self, "could not get async page flip capability");
-  else
-    self->has_async_page_flip = (gboolean) has_async_page_flip;
+    GST_INFO_OBJECT (self, "no atomic async page flip capability");
+  self->has_async_page_flip = (gboolean) has_async_page_flip;
 
   GST_INFO_OBJECT (self,
       "prime import (%s) / prime export (%s) / async page flip (%s)",
@@ -547,6 +573,58 @@ drm_plane_set_property (GstRkXImageSink * self, drmModePlane * plane,
   return ret < 0 ? FALSE : TRUE;
 }
 
+static const gchar *drm_plane_prop_names[RKXIMAGE_PLANE_PROP_COUNT] = {
+  [RKXIMAGE_PLANE_PROP_FB_ID] = "FB_ID",
+  [RKXIMAGE_PLANE_PROP_CRTC_ID] = "CRTC_ID",
+  [RKXIMAGE_PLANE_PROP_SRC_X] = "SRC_X",
+  [RKXIMAGE_PLANE_PROP_SRC_Y] = "SRC_Y",
+  [RKXIMAGE_PLANE_PROP_SRC_W] = "SRC_W",
+  [RKXIMAGE_PLANE_PROP_SRC_H] = "SRC_H",
+  [RKXIMAGE_PLANE_PROP_CRTC_X] = "CRTC_X",
+  [RKXIMAGE_PLANE_PROP_CRTC_Y] = "CRTC_Y",
+  [RKXIMAGE_PLANE_PROP_CRTC_W] = "CRTC_W",
+  [RKXIMAGE_PLANE_PROP_CRTC_H] = "CRTC_H",
+};
+
+static gboolean
+drm_plane_get_atomic_props (GstRkXImageSink * self)
+{
+  drmModeObjectPropertiesPtr props;
+  drmModePropertyPtr prop;
+  int i, j;
+
+  props = drmModeObjectGetProperties (self->fd, self->plane_id,
+      DRM_MODE_OBJECT_PLANE);
+  if (!props)
+    return FALSE;
+
+  memset (self->plane_props, 0, sizeof (self->plane_props));
+
+  for (i = 0; i < props->count_props; i++) {
+    prop = drmModeGetProperty (self->fd, props->props[i]);
+    if (!prop)
+      continue;
+
+    for (j = 0; j < RKXIMAGE_PLANE_PROP_COUNT; j++) {
+      if (!strcmp (prop->name, drm_plane_prop_names[j]))
+        self->plane_props[j] = prop->prop_id;
+    }
+    drmModeFreeProperty (prop);
+  }
+
+  drmModeFreeObjectProperties (props);
+
+  for (j = 0; j < RKXIMAGE_PLANE_PROP_COUNT; j++) {
+    if (!self->plane_props[j]) {
+      GST_WARNING_OBJECT (self, "plane %d has no %s property",
+          self->plane_id, drm_plane_prop_names[j]);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
 static gboolean
 drm_prepare_planes (GstRkXImageSink * self, drmModeRes * res,
     drmModePlaneRes * pres)
@@ -682,8 +760,9 @@ gst_kms_sink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
     }
   }
 
-  /* we need at least 2 buffer because we hold on to the last one */
-  gst_query_add_allocation_pool (query, pool, size, 2, 0);
+  /* we need at least 3 buffers because we hold on to the last one, and to
+   * the previous one until its page flip completes */
+  gst_query_add_allocation_pool (query, pool, size, 3, 0);
   if (pool)
     gst_object_unref (pool);
 
@@ -970,6 +1049,243 @@ event_failed:
   }
 }
 
+static gint
+gst_kms_sink_atomic_commit (GstRkXImageSink * self, guint32 fb_id,
+    GstVideoRectangle * dst, GstVideoRectangle * src, guint32 flags)
+{
+  drmModeAtomicReqPtr req;
+  guint64 values[RKXIMAGE_PLANE_PROP_COUNT];
+  gint i, count, ret;
+
+  values[RKXIMAGE_PLANE_PROP_FB_ID] = fb_id;
+  values[RKXIMAGE_PLANE_PROP_CRTC_ID] = self->crtc_id;
+  /* source/cropping coordinates are given in Q16 */
+  values[RKXIMAGE_PLANE_PROP_SRC_X] = (guint64) src->x << 16;
+  values[RKXIMAGE_PLANE_PROP_SRC_Y] = (guint64) src->y << 16;
+  values[RKXIMAGE_PLANE_PROP_SRC_W] = (guint64) src->w << 16;
+  values[RKXIMAGE_PLANE_PROP_SRC_H] = (guint64) src->h << 16;
+  /* CRTC_X/Y are signed */
+  values[RKXIMAGE_PLANE_PROP_CRTC_X] = (gint64) dst->x;
+  values[RKXIMAGE_PLANE_PROP_CRTC_Y] = (gint64) dst->y;
+  values[RKXIMAGE_PLANE_PROP_CRTC_W] = dst->w;
+  values[RKXIMAGE_PLANE_PROP_CRTC_H] = dst->h;
+
+  req = drmModeAtomicAlloc ();
+  if (!req)
+    return -ENOMEM;
+
+  /* Async flips may only change the FB_ID, the rest must stay as is */
+  if (flags & DRM_MODE_PAGE_FLIP_ASYNC)
+    count = RKXIMAGE_PLANE_PROP_FB_ID + 1;
+  else
+    count = RKXIMAGE_PLANE_PROP_COUNT;
+
+  for (i = 0; i < count; i++)
+    drmModeAtomicAddProperty (req, self->plane_id, self->plane_props[i],
+        values[i]);
+
+  ret = drmModeAtomicCommit (self->fd, req, DRM_MODE_PAGE_FLIP_EVENT | flags,
+      self);
+
+  drmModeAtomicFree (req);
+
+  if (!ret) {
+    self->committed = TRUE;
+    self->committed_dst = *dst;
+    self->committed_src = *src;
+  }
+
+  return ret;
+}
+
+static gboolean
+gst_kms_sink_geometry_committed (GstRkXImageSink * self,
+    GstVideoRectangle * dst, GstVideoRectangle * src)
+{
+  GstVideoRectangle *cdst = &self->committed_dst;
+  GstVideoRectangle *csrc = &self->committed_src;
+
+  if (!self->committed)
+    return FALSE;
+
+  return dst->x == cdst->x && dst->y == cdst->y && dst->w == cdst->w &&
+      dst->h == cdst->h && src->x == csrc->x && src->y == csrc->y &&
+      src->w == csrc->w && src->h == csrc->h;
+}
+
+static gpointer gst_kms_sink_flip_thread (GstRkXImageSink * self);
+
+static void
+gst_kms_sink_start_flip_thread (GstRkXImageSink * self)
+{
+  if (self->flip_thread)
+    return;
+
+  self->flip_thread_active = TRUE;
+  self->flip_thread = g_thread_new ("rkximage-flip",
+      (GThreadFunc) gst_kms_sink_flip_thread, self);
+}
+
+/* Commit the buffer, called with the flip_lock and no flip pending */
+static gboolean
+gst_kms_sink_present (GstRkXImageSink * self, GstBuffer * buffer,
+    GstVideoRectangle * dst, GstVideoRectangle * src)
+{
+  GstVideoRectangle rect = *src;
+  guint32 fb_id, flags = DRM_MODE_ATOMIC_NONBLOCK;
+  gint ret;
+
+  fb_id = gst_kms_memory_get_fb_id (gst_buffer_peek_memory (buffer, 0));
+
+  /* Geometry changes need a full commit, which can't be async */
+  if (self->present_mode == GST_RKXIMAGE_PRESENT_ASYNC &&
+      self->has_async_page_flip &&
+      gst_kms_sink_geometry_committed (self, dst, &rect))
+    flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+
+  GST_TRACE_OBJECT (self,
+      "atomic commit at (%i,%i) %ix%i sourcing at (%i,%i) %ix%i",
+      dst->x, dst->y, dst->w, dst->h, rect.x, rect.y, rect.w, rect.h);
+
+  ret = gst_kms_sink_atomic_commit (self, fb_id, dst, &rect, flags);
+  if (ret == -EBUSY) {
+    /* The previous commit is still being completed (its event might have
+     * arrived already), let the kernel wait for it */
+    GST_DEBUG_OBJECT (self, "previous commit busy, committing blocking");
+    flags &= ~DRM_MODE_ATOMIC_NONBLOCK;
+
+    ret = gst_kms_sink_atomic_commit (self, fb_id, dst, &rect, flags);
+  }
+
+  if (ret && flags & DRM_MODE_PAGE_FLIP_ASYNC) {
+    /* Async flips might be limited to the primary plane, fall back to
+     * mailbox so that the newest frame still gets shown without blocking */
+    GST_WARNING_OBJECT (self, "async page flip rejected, using mailbox");
+    self->has_async_page_flip = FALSE;
+    flags &= ~DRM_MODE_PAGE_FLIP_ASYNC;
+
+    gst_kms_sink_start_flip_thread (self);
+
+    ret = gst_kms_sink_atomic_commit (self, fb_id, dst, &rect, flags);
+  }
+
+  if (ret && rect.x & 1) {
+    /* The driver might require 2-aligned xpos */
+    rect.x++;
+    rect.w--;
+
+    ret = gst_kms_sink_atomic_commit (self, fb_id, dst, &rect, flags);
+  }
+
+  if (ret) {
+    GST_ERROR_OBJECT (self, "atomic commit failed: %d", ret);
+    return FALSE;
+  }
+
+  /* The old frame stays on screen until the flip event */
+  self->flip_pending = TRUE;
+  if (buffer != self->scanout_buffer) {
+    gst_buffer_replace (&self->flip_buffer, self->scanout_buffer);
+    gst_buffer_replace (&self->scanout_buffer, buffer);
+  }
+
+  return TRUE;
+}
+
+static void
+flip_handler (gint fd, guint frame, guint sec, guint usec, gpointer data)
+{
+  GstRkXImageSink *self = data;
+  GstBuffer *queued;
+
+  /* The previous frame is no longer scanned out */
+  self->flip_pending = FALSE;
+  gst_buffer_replace (&self->flip_buffer, NULL);
+
+  /* Mailbox, show the newest frame which arrived meanwhile */
+  queued = self->queued_buffer;
+  if (queued) {
+    self->queued_buffer = NULL;
+    gst_kms_sink_present (self, queued, &self->queued_dst,
+        &self->queued_src);
+    gst_buffer_unref (queued);
+  }
+}
+
+/* Handle page flip events, waiting up to timeout for the pending flip */
+static gboolean
+gst_kms_sink_wait_flip (GstRkXImageSink * self, GstClockTime timeout)
+{
+  gint ret;
+  drmEventContext evctxt = {
+    .version = DRM_EVENT_CONTEXT_VERSION,
+    .page_flip_handler = flip_handler,
+  };
+
+  while (self->flip_pending) {
+    do {
+      ret = gst_poll_wait (self->poll, timeout);
+    } while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
+    if (ret <= 0)
+      return FALSE;
+
+    ret = drmHandleEvent (self->fd, &evctxt);
+    if (ret)
+      goto event_failed;
+  }
+
+  return TRUE;
+
+  /* ERRORS */
+event_failed:
+  {
+    GST_ERROR_OBJECT (self, "drmHandleEvent failed: %s (%d)",
+        g_strerror (errno), errno);
+    return FALSE;
+  }
+}
+
+/* Handles the flip events in mailbox mode, so that queued frames get
+ * committed without waiting for the next one */
+static gpointer
+gst_kms_sink_flip_thread (GstRkXImageSink * self)
+{
+  drmEventContext evctxt = {
+    .version = DRM_EVENT_CONTEXT_VERSION,
+    .page_flip_handler = flip_handler,
+  };
+  gint ret;
+
+  while (TRUE) {
+    ret = gst_poll_wait (self->poll, GST_CLOCK_TIME_NONE);
+    if (ret == -1 && (errno == EAGAIN || errno == EINTR))
+      continue;
+
+    /* Flushing */
+    if (ret <= 0)
+      break;
+
+    g_mutex_lock (&self->flip_lock);
+    ret = drmHandleEvent (self->fd, &evctxt);
+    g_mutex_unlock (&self->flip_lock);
+
+    if (ret) {
+      GST_ERROR_OBJECT (self, "drmHandleEvent failed: %s (%d)",
+          g_strerror (errno), errno);
+      break;
+    }
+  }
+
+  /* Nobody commits the queued frames anymore, wait for vsync instead */
+  g_mutex_lock (&self->flip_lock);
+  self->flip_thread_active = FALSE;
+  gst_buffer_replace (&self->queued_buffer, NULL);
+  g_mutex_unlock (&self->flip_lock);
+
+  return NULL;
+}
+
 static void
 gst_kms_sink_drain (GstRkXImageSink * self)
 {
@@ -1260,6 +1576,36 @@ gst_x_image_sink_ximage_put (GstRkXImageSink * ximagesink, GstBuffer * buf)
     /* The AFBC's width should align to 4 */
     src.w &= ~3;
 
+  if (ximagesink->has_atomic) {
+    g_mutex_lock (&ximagesink->flip_lock);
+
+    if (ximagesink->flip_pending && ximagesink->flip_thread_active) {
+      /* Replace the queued frame, the flip thread commits it */
+      gst_buffer_replace (&ximagesink->queued_buffer, buffer);
+      ximagesink->queued_dst = result;
+      ximagesink->queued_src = src;
+
+      g_mutex_unlock (&ximagesink->flip_lock);
+      goto done;
+    }
+
+    /* Only block when the previous flip is still in flight */
+    if (ximagesink->flip_pending &&
+        !gst_kms_sink_wait_flip (ximagesink, 3 * GST_SECOND)) {
+      GST_WARNING_OBJECT (ximagesink, "previous page flip not completed");
+      ximagesink->flip_pending = FALSE;
+      gst_buffer_replace (&ximagesink->flip_buffer, NULL);
+    }
+
+    ret = !gst_kms_sink_present (ximagesink, buffer, &result, &src);
+    g_mutex_unlock (&ximagesink->flip_lock);
+
+    if (ret)
+      goto out;
+
+    goto done;
+  }
+
   GST_TRACE_OBJECT (ximagesink,
       "drmModeSetPlane at (%i,%i) %ix%i sourcing at (%i,%i) %ix%i",
       result.x, result.y, result.w, result.h, src.x, src.y, src.w, src.h);
@@ -1285,12 +1631,12 @@ gst_x_image_sink_ximage_put (GstRkXImageSink * ximagesink, GstBuffer * buf)
     goto out;
   }
 
-  /* HACK: Disable vsync might cause tearing */
-  if (!g_getenv ("KMSSINK_DISABLE_VSYNC"))
-  /* Wait for the previous frame to complete redraw */
-  if (!gst_kms_sink_sync (ximagesink))
+  /* Wait for the previous frame to complete redraw, unless asked not to */
+  if (ximagesink->present_mode == GST_RKXIMAGE_PRESENT_VSYNC &&
+      !gst_kms_sink_sync (ximagesink))
     goto out;
 
+done:
   if (buffer != ximagesink->last_buffer)
     gst_buffer_replace (&ximagesink->last_buffer, buffer);
 
@@ -2428,6 +2774,9 @@ gst_x_image_sink_set_property (GObject * object, guint prop_id,
     case PROP_FORCE_ASPECT_RATIO:
       ximagesink->keep_aspect = g_value_get_boolean (value);
       break;
+    case PROP_PRESENT_MODE:
+      ximagesink->present_mode = g_value_get_enum (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2484,6 +2833,9 @@ gst_x_image_sink_get_property (GObject * object, guint prop_id,
     case PROP_FORCE_ASPECT_RATIO:
       g_value_set_boolean (value, ximagesink->keep_aspect);
       break;
+    case PROP_PRESENT_MODE:
+      g_value_set_enum (value, ximagesink->present_mode);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2506,6 +2858,9 @@ gst_x_image_sink_reset (GstRkXImageSink * ximagesink)
   if (thread)
     g_thread_join (thread);
 
+  gst_buffer_replace (&ximagesink->queued_buffer, NULL);
+  gst_buffer_replace (&ximagesink->flip_buffer, NULL);
+  gst_buffer_replace (&ximagesink->scanout_buffer, NULL);
   gst_buffer_replace (&ximagesink->last_buffer, NULL);
 
   g_mutex_lock (&ximagesink->flow_lock);
@@ -2535,6 +2890,7 @@ gst_x_image_sink_finalize (GObject * object)
   }
   g_mutex_clear (&ximagesink->x_lock);
   g_mutex_clear (&ximagesink->flow_lock);
+  g_mutex_clear (&ximagesink->flip_lock);
 
   g_free (ximagesink->media_title);
 
@@ -2564,6 +2920,11 @@ gst_x_image_sink_init (GstRkXImageSink * ximagesink)
 
   g_mutex_init (&ximagesink->x_lock);
   g_mutex_init (&ximagesink->flow_lock);
+  g_mutex_init (&ximagesink->flip_lock);
+
+  /* Legacy way to disable vsync */
+  ximagesink->present_mode = g_getenv ("KMSSINK_DISABLE_VSYNC") ?
+      GST_RKXIMAGE_PRESENT_ASYNC : GST_RKXIMAGE_PRESENT_VSYNC;
 
   ximagesink->synchronous = FALSE;
   ximagesink->handle_events = TRUE;
@@ -2664,6 +3025,12 @@ gst_x_image_sink_start (GstBaseSink * bsink)
   GST_INFO_OBJECT (self, "connector id = %d / crtc id = %d / plane id = %d",
       self->conn_id, self->crtc_id, self->plane_id);
 
+  self->has_atomic = !drmSetClientCap (self->fd, DRM_CLIENT_CAP_ATOMIC, 1) &&
+      drm_plane_get_atomic_props (self);
+
+  GST_INFO_OBJECT (self, "atomic page flips: %s",
+      self->has_atomic ? "✓" : "✗");
+
   if (g_getenv ("GST_RKXIMAGE_USE_COLORKEY"))
     drm_prepare_planes (self, res, pres);
 
@@ -2681,6 +3048,14 @@ gst_x_image_sink_start (GstBaseSink * bsink)
   gst_poll_add_fd (self->poll, &self->pollfd);
   gst_poll_fd_ctl_read (self->poll, &self->pollfd, TRUE);
 
+  /* Without async flips, async falls back to mailbox */
+  if (self->has_atomic &&
+      (self->present_mode == GST_RKXIMAGE_PRESENT_MAILBOX ||
+          (self->present_mode == GST_RKXIMAGE_PRESENT_ASYNC &&
+              !self->has_async_page_flip))) {
+    gst_kms_sink_start_flip_thread (self);
+  }
+
   ret = TRUE;
 
 bail:
@@ -2758,6 +3133,22 @@ gst_x_image_sink_stop (GstBaseSink * bsink)
   if (!EMPTY_RECT (self->clip_rect))
     gst_x_image_sink_xwindow_fill_key (self, self->xwindow, 0);
 
+  if (self->flip_thread) {
+    gst_poll_set_flushing (self->poll, TRUE);
+    g_thread_join (self->flip_thread);
+    self->flip_thread = NULL;
+    gst_poll_set_flushing (self->poll, FALSE);
+  }
+
+  /* Don't release buffers while they are still scanned out */
+  gst_buffer_replace (&self->queued_buffer, NULL);
+  if (self->flip_pending)
+    gst_kms_sink_wait_flip (self, 3 * GST_SECOND);
+  self->flip_pending = FALSE;
+  gst_buffer_replace (&self->flip_buffer, NULL);
+  gst_buffer_replace (&self->scanout_buffer, NULL);
+  self->committed = FALSE;
+
   gst_buffer_replace (&self->last_buffer, NULL);
   gst_caps_replace (&self->allowed_caps, NULL);
   gst_object_replace ((GstObject **) & self->pool, NULL);
@@ -2882,6 +3273,19 @@ gst_x_image_sink_class_init (GstRkXImageSinkClass * klass)
       "When enabled, scaling will respect original aspect ratio", TRUE,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * rkximagesink:present-mode:
+   *
+   * How frames are flipped on screen: queued on vsync, replacing the one
+   * waiting for vsync (mailbox), or immediately at the cost of tearing
+   * (async, falling back to mailbox when the driver can't).
+   */
+  g_object_class_install_property (gobject_class, PROP_PRESENT_MODE,
+      g_param_spec_enum ("present-mode", "Present mode",
+          "How frames are presented", GST_TYPE_RKXIMAGE_PRESENT_MODE,
+          GST_RKXIMAGE_PRESENT_VSYNC, G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+
   gst_element_class_set_static_metadata (gstelement_class,
       "Video sink", "Sink/Video",
       "A standard X based videosink", "Julien Moutte <julien@moutte.net>");
@@ -60,6 +60,29 @@ typedef struct _GstXWindow GstXWindow;
 typedef struct _GstRkXImageSink GstRkXImageSink;
 typedef struct _GstRkXImageSinkClass GstRkXImageSinkClass;
 
+typedef enum
+{
+  GST_RKXIMAGE_PRESENT_VSYNC,
+  GST_RKXIMAGE_PRESENT_MAILBOX,
+  GST_RKXIMAGE_PRESENT_ASYNC,
+} GstRkXImagePresentMode;
+
+/* Plane properties used by atomic commits */
+enum
+{
+  RKXIMAGE_PLANE_PROP_FB_ID,
+  RKXIMAGE_PLANE_PROP_CRTC_ID,
+  RKXIMAGE_PLANE_PROP_SRC_X,
+  RKXIMAGE_PLANE_PROP_SRC_Y,
+  RKXIMAGE_PLANE_PROP_SRC_W,
+  RKXIMAGE_PLANE_PROP_SRC_H,
+  RKXIMAGE_PLANE_PROP_CRTC_X,
+  RKXIMAGE_PLANE_PROP_CRTC_Y,
+  RKXIMAGE_PLANE_PROP_CRTC_W,
+  RKXIMAGE_PLANE_PROP_CRTC_H,
+  RKXIMAGE_PLANE_PROP_COUNT,
+};
+
 /*
  * GstXContext:
  * @disp: the X11 Display of this context
@@ -164,6 +187,10 @@ struct _GstRkXImageSink
   gboolean has_prime_import;
   gboolean has_prime_export;
   gboolean has_async_page_flip;
+  gboolean has_atomic;
+
+  /* atomic property ids of our plane */
+  guint32 plane_props[RKXIMAGE_PLANE_PROP_COUNT];
 
   char *display_name;
 
@@ -209,6 +236,26 @@ struct _GstRkXImageSink
 
   guint32 last_fb_id;
   GstVideoRectangle render_rect;
+
+  GstRkXImagePresentMode present_mode;
+
+  /* in-flight page flip, the buffer scanned out until it completes, the
+   * committed one, and the newest frame waiting for it (mailbox) */
+  GMutex flip_lock;
+  GThread *flip_thread;
+  gboolean flip_thread_active;
+  gboolean flip_pending;
+  GstBuffer *flip_buffer;
+  GstBuffer *scanout_buffer;
+  GstBuffer *queued_buffer;
+  GstVideoRectangle queued_dst;
+  GstVideoRectangle queued_src;
+
+  /* geometry of the last commit, async flips may only change the FB */
+  gboolean committed;
+  GstVideoRectangle committed_dst;
+  GstVideoRectangle committed_src;
+
   gboolean paused;
 };
 
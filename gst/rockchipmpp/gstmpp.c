@@ -25,7 +25,10 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
+#include <poll.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <gst/allocators/gstdmabuf.h>
 
@@ -36,8 +39,21 @@
 #include "gstmppjpegenc.h"
 #include "gstmppjpegdec.h"
 #include "gstmppvideodec.h"
+#include "gstmppmultidec.h"
 #include "gstmppvpxalphadecodebin.h"
 
+#ifdef HAVE_RGA
+#include "gstrgaconvert.h"
+#endif
+
+#ifdef HAVE_RGA_JOB
+#include <rga/im2d.h>
+#endif
+
+#ifdef USE_RGACOMPOSITOR
+#include "gstrgacompositor.h"
+#endif
+
 GST_DEBUG_CATEGORY_STATIC (mpp_debug);
 #define GST_CAT_DEFAULT mpp_debug
 
@@ -229,33 +245,530 @@ gst_mpp_rga_info_from_video_info (rga_info_t * info, GstVideoInfo * vinfo)
       hstride, vstride);
 }
 
+/*
+ * Process-wide RGA scheduler
+ *
+ * Jobs from all of the elements are queued here and dispatched by one
+ * worker per RGA core, so that concurrent conversions don't contend on the
+ * librga handle unpredictably.
+ */
+
+/* Core masks of librga's scheduler (IM_SCHEDULER_*) */
+#define GST_MPP_RGA3_CORE0 (1 << 0)
+#define GST_MPP_RGA3_CORE1 (1 << 1)
+#define GST_MPP_RGA2_CORE0 (1 << 2)
+#define GST_MPP_RGA2_CORE1 (1 << 3)
+#define GST_MPP_RGA_MAX_CORES 4
+
+/* A core is disabled after failing in a row, and tried again later */
+#define GST_MPP_RGA_CORE_MAX_FAILURES 3
+#define GST_MPP_RGA_CORE_RETRY_INTERVAL G_TIME_SPAN_SECOND
+
+/* Small jobs are dispatched back-to-back in one worker wakeup */
+#define GST_MPP_RGA_SMALL_JOB (320 * 240)
+#define GST_MPP_RGA_MAX_BATCH 8
+
+typedef struct
+{
+  rga_info_t src_info;
+  rga_info_t dst_info;
+
+  /* mapped source without dma-buf */
+  GstBuffer *inbuf;
+  GstMapInfo mapinfo;
+
+  GstMemory *out_mem;
+
+  /* fill dst_info with its color instead of blitting */
+  gboolean fill;
+} GstMppRgaOp;
+
+struct _GstMppRgaBatch
+{
+  GArray *ops;
+};
+
+typedef struct
+{
+  GstMppRgaOp *ops;
+  guint n_ops;
+  gint *fence_fd;
+
+  gboolean done;
+  gboolean ret;
+} GstMppRgaJob;
+
+typedef struct
+{
+  /* core mask reported by the driver, 0 for letting the driver choose */
+  gint hw_mask;
+
+  /* core mask in use, 0 while the core is disabled */
+  gint mask;
+  guint failures;
+  gint64 retry_time;
+
+  GThread *thread;
+
+  guint64 jobs;
+  guint64 busy_time;
+} GstMppRgaCore;
+
+static struct
+{
+  GMutex mutex;
+  GCond job_cond;
+  GCond done_cond;
+
+  GQueue jobs;
+
+  GstMppRgaCore cores[GST_MPP_RGA_MAX_CORES];
+  guint n_cores;
+
+  gboolean supported;
+} gst_mpp_rga;
+
+/* The core's mask, or its original one when a disabled core is due */
+static gint
+gst_mpp_rga_core_get_mask (GstMppRgaCore * core)
+{
+  if (!core->mask && core->hw_mask &&
+      g_get_monotonic_time () >= core->retry_time)
+    return core->hw_mask;
+
+  return core->mask;
+}
+
+static void
+gst_mpp_rga_core_update (GstMppRgaCore * core, gboolean ret)
+{
+  if (ret) {
+    if (!core->mask)
+      GST_INFO ("RGA core %#x is back", core->hw_mask);
+
+    core->mask = core->hw_mask;
+    core->failures = 0;
+    return;
+  }
+
+  if (core->mask && ++core->failures >= GST_MPP_RGA_CORE_MAX_FAILURES) {
+    GST_WARNING ("RGA core %#x keeps failing, let the driver choose",
+        core->mask);
+    core->mask = 0;
+  }
+
+  core->retry_time = g_get_monotonic_time () + GST_MPP_RGA_CORE_RETRY_INTERVAL;
+}
+
 static gboolean
-gst_mpp_rga_do_convert (rga_info_t * src_info, rga_info_t * dst_info)
+gst_mpp_rga_blit_op_on_core (GstMppRgaOp * op, gint mask, gint * fence_fd)
 {
-  static gint rga_supported = 1;
-  static gint rga_inited = 0;
+  rga_info_t *src_info = &op->src_info;
+  rga_info_t *dst_info = &op->dst_info;
+
+#ifdef HAVE_RGA_CORE
+  dst_info->core = mask;
+#else
+  (void) mask;
+#endif
+
+#ifdef HAVE_RGA_FENCE
+  if (fence_fd) {
+    /* Return a release fence instead of waiting for the job */
+    src_info->sync_mode = RGA_BLIT_ASYNC;
+    dst_info->in_fence_fd = -1;
+    dst_info->out_fence_fd = -1;
+  }
+#endif
 
-  if (!rga_supported || !gst_mpp_use_rga ())
+  if ((op->fill ? c_RkRgaColorFill (dst_info) :
+          c_RkRgaBlit (src_info, dst_info, NULL)) < 0)
     return FALSE;
 
-  if (!rga_inited) {
-    if (c_RkRgaInit () < 0) {
-      rga_supported = 0;
-      GST_WARNING ("failed to init RGA");
-      return FALSE;
+#ifdef HAVE_RGA_FENCE
+  if (fence_fd) {
+    *fence_fd = dst_info->out_fence_fd;
+    GST_DEBUG ("converting with RGA (fence %d)", *fence_fd);
+    return TRUE;
+  }
+#endif
+
+  GST_DEBUG ("converted with RGA");
+  return TRUE;
+}
+
+static gboolean
+gst_mpp_rga_blit_op (GstMppRgaCore * core, GstMppRgaOp * op, gint * fence_fd)
+{
+  gint mask = gst_mpp_rga_core_get_mask (core);
+
+  if (mask) {
+    if (gst_mpp_rga_blit_op_on_core (op, mask, fence_fd)) {
+      gst_mpp_rga_core_update (core, TRUE);
+      return TRUE;
     }
-    rga_inited = 1;
+
+    /* The core might be busy, missing or unable to do this job */
+    GST_DEBUG ("failed to blit on RGA core %#x", mask);
+    gst_mpp_rga_core_update (core, FALSE);
   }
 
-  if (c_RkRgaBlit (src_info, dst_info, NULL) < 0) {
+  if (!gst_mpp_rga_blit_op_on_core (op, 0, fence_fd)) {
     GST_WARNING ("failed to blit");
     return FALSE;
   }
 
-  GST_DEBUG ("converted with RGA");
   return TRUE;
 }
 
+#ifdef HAVE_RGA_JOB
+/* im2d usage of the op, or -1 when only the legacy API handles it */
+static gint
+gst_mpp_rga_job_get_usage (GstMppRgaOp * op)
+{
+  if (op->fill)
+    return IM_COLOR_FILL;
+
+  /* Blending is left to the legacy API */
+  if (op->src_info.blend)
+    return -1;
+
+  switch (op->src_info.rotation) {
+    case 0:
+      return 0;
+    case HAL_TRANSFORM_ROT_90:
+      return IM_HAL_TRANSFORM_ROT_90;
+    case HAL_TRANSFORM_ROT_180:
+      return IM_HAL_TRANSFORM_ROT_180;
+    case HAL_TRANSFORM_ROT_270:
+      return IM_HAL_TRANSFORM_ROT_270;
+    case HAL_TRANSFORM_FLIP_H:
+      return IM_HAL_TRANSFORM_FLIP_H;
+    case HAL_TRANSFORM_FLIP_V:
+      return IM_HAL_TRANSFORM_FLIP_V;
+    default:
+      return -1;
+  }
+}
+
+static rga_buffer_t
+gst_mpp_rga_job_get_buffer (rga_info_t * info, im_rect * rect)
+{
+  rga_rect_t *r = &info->rect;
+
+  rect->x = r->xoffset;
+  rect->y = r->yoffset;
+  rect->width = r->width;
+  rect->height = r->height;
+
+  /* The rect is applied by the task, the buffer covers the whole strides */
+  if (info->fd > 0)
+    return wrapbuffer_fd (info->fd, r->wstride, r->hstride, r->format,
+        r->wstride, r->hstride);
+
+  return wrapbuffer_virtualaddr (info->virAddr, r->wstride, r->hstride,
+      r->format, r->wstride, r->hstride);
+}
+
+/* Submit all of the ops in one im2d job, a single request to the driver */
+static gboolean
+gst_mpp_rga_blit_job (GstMppRgaCore * core, GstMppRgaJob * job)
+{
+  im_job_handle_t handle;
+  rga_buffer_t src, dst, pat;
+  im_rect srect, drect, prect;
+  im_opt_t opt;
+  gint usage;
+  guint i;
+
+  for (i = 0; i < job->n_ops; i++) {
+    if (gst_mpp_rga_job_get_usage (&job->ops[i]) < 0)
+      return FALSE;
+  }
+
+  handle = imbeginJob (0);
+  if (!handle)
+    return FALSE;
+
+  for (i = 0; i < job->n_ops; i++) {
+    GstMppRgaOp *op = &job->ops[i];
+
+    memset (&src, 0, sizeof (src));
+    memset (&pat, 0, sizeof (pat));
+    memset (&srect, 0, sizeof (srect));
+    memset (&prect, 0, sizeof (prect));
+    memset (&opt, 0, sizeof (opt));
+
+    usage = gst_mpp_rga_job_get_usage (op);
+
+    dst = gst_mpp_rga_job_get_buffer (&op->dst_info, &drect);
+    if (op->fill)
+      opt.color = op->dst_info.color;
+    else
+      src = gst_mpp_rga_job_get_buffer (&op->src_info, &srect);
+
+#ifdef HAVE_RGA_CORE
+    opt.core = gst_mpp_rga_core_get_mask (core);
+#endif
+
+    if (improcessTask (handle, src, dst, pat, srect, drect, prect, &opt,
+            usage) != IM_STATUS_SUCCESS)
+      goto err;
+  }
+
+  if (job->fence_fd) {
+    /* Return a release fence instead of waiting for the job */
+    if (imendJob (handle, IM_ASYNC, -1, job->fence_fd) != IM_STATUS_SUCCESS)
+      goto err;
+
+    GST_DEBUG ("converting %d ops with RGA (fence %d)", job->n_ops,
+        *job->fence_fd);
+    return TRUE;
+  }
+
+  if (imendJob (handle, IM_SYNC, -1, NULL) != IM_STATUS_SUCCESS)
+    goto err;
+
+  GST_DEBUG ("converted %d ops with RGA", job->n_ops);
+  return TRUE;
+
+err:
+  GST_DEBUG ("failed to submit RGA job on core %#x", core->mask);
+  imcancelJob (handle);
+  return FALSE;
+}
+#endif
+
+static gboolean
+gst_mpp_rga_blit (GstMppRgaCore * core, GstMppRgaJob * job)
+{
+  gint *fence_fd;
+  guint i;
+
+#ifdef HAVE_RGA_JOB
+  /* Batches go to the driver as one job, falling back to blits one by one */
+  if (job->n_ops > 1 && gst_mpp_rga_blit_job (core, job))
+    return TRUE;
+
+  if (job->fence_fd)
+    *job->fence_fd = -1;
+#endif
+
+  for (i = 0; i < job->n_ops; i++) {
+    /* Only the last op is async, its fence completes the whole job */
+    fence_fd = i == job->n_ops - 1 ? job->fence_fd : NULL;
+
+    if (!gst_mpp_rga_blit_op (core, &job->ops[i], fence_fd))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_mpp_rga_job_is_small (GstMppRgaJob * job)
+{
+  guint i, area = 0;
+
+  for (i = 0; i < job->n_ops; i++)
+    area += job->ops[i].dst_info.rect.width * job->ops[i].dst_info.rect.height;
+
+  return area <= GST_MPP_RGA_SMALL_JOB;
+}
+
+static gpointer
+gst_mpp_rga_worker (GstMppRgaCore * core)
+{
+  GstMppRgaJob *batch[GST_MPP_RGA_MAX_BATCH];
+  GstMppRgaJob *job;
+  gint64 start;
+  guint i, n;
+
+  g_mutex_lock (&gst_mpp_rga.mutex);
+  while (1) {
+    while (!(job = g_queue_pop_head (&gst_mpp_rga.jobs)))
+      g_cond_wait (&gst_mpp_rga.job_cond, &gst_mpp_rga.mutex);
+
+    batch[0] = job;
+    for (n = 1; n < GST_MPP_RGA_MAX_BATCH && gst_mpp_rga_job_is_small (job);
+        n++) {
+      job = g_queue_peek_head (&gst_mpp_rga.jobs);
+      if (!job || !gst_mpp_rga_job_is_small (job))
+        break;
+
+      batch[n] = g_queue_pop_head (&gst_mpp_rga.jobs);
+    }
+    g_mutex_unlock (&gst_mpp_rga.mutex);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; i++)
+      batch[i]->ret = gst_mpp_rga_blit (core, batch[i]);
+
+    g_mutex_lock (&gst_mpp_rga.mutex);
+    core->busy_time += (g_get_monotonic_time () - start) * GST_USECOND;
+    core->jobs += n;
+
+    for (i = 0; i < n; i++)
+      batch[i]->done = TRUE;
+
+    g_cond_broadcast (&gst_mpp_rga.done_cond);
+  }
+
+  return NULL;
+}
+
+#ifdef HAVE_RGA_CORE
+/* Cores listed by the driver's debug node, e.g. "rga3, core 1: ..." */
+static guint64
+gst_mpp_rga_probe_cores (void)
+{
+  const gchar *paths[] = {
+    "/sys/kernel/debug/rkrga/hardware",
+    "/proc/rkrga/hardware",
+  };
+  guint64 masks = 0;
+  gchar *contents, *line;
+  guint i;
+
+  for (i = 0; !masks && i < G_N_ELEMENTS (paths); i++) {
+    if (!g_file_get_contents (paths[i], &contents, NULL, NULL))
+      continue;
+
+    for (line = contents; (line = strstr (line, "core "));) {
+      guint64 mask;
+
+      line += strlen ("core ");
+      mask = g_ascii_strtoull (line, NULL, 0);
+
+      /* Single bits of the known cores only */
+      if (mask && !(mask & (mask - 1)) &&
+          mask < (1 << GST_MPP_RGA_MAX_CORES))
+        masks |= mask;
+    }
+
+    g_free (contents);
+  }
+
+  if (!masks)
+    GST_INFO ("unable to query RGA cores, let the driver choose");
+
+  return masks;
+}
+#endif
+
+static gboolean
+gst_mpp_rga_init (void)
+{
+  static gsize inited = 0;
+
+  if (g_once_init_enter (&inited)) {
+    guint64 masks = 0;
+    const gchar *env;
+    guint i;
+
+    g_mutex_init (&gst_mpp_rga.mutex);
+    g_cond_init (&gst_mpp_rga.job_cond);
+    g_cond_init (&gst_mpp_rga.done_cond);
+    g_queue_init (&gst_mpp_rga.jobs);
+
+    gst_mpp_rga.supported = c_RkRgaInit () >= 0;
+    if (!gst_mpp_rga.supported)
+      GST_WARNING ("failed to init RGA");
+
+#ifdef HAVE_RGA_CORE
+    masks = gst_mpp_rga_probe_cores ();
+#endif
+
+    /* e.g. GST_MPP_RGA_CORES=0x4 for RGA2 only, 0 for driver scheduling */
+    env = g_getenv ("GST_MPP_RGA_CORES");
+    if (env)
+      masks = g_ascii_strtoull (env, NULL, 0);
+
+    for (i = 0; i < GST_MPP_RGA_MAX_CORES; i++) {
+      if (masks & (1 << i)) {
+        GstMppRgaCore *core = &gst_mpp_rga.cores[gst_mpp_rga.n_cores++];
+
+        core->hw_mask = core->mask = 1 << i;
+      }
+    }
+
+    /* Single worker and let the driver choose cores */
+    if (!gst_mpp_rga.n_cores)
+      gst_mpp_rga.n_cores = 1;
+
+    for (i = 0; gst_mpp_rga.supported && i < gst_mpp_rga.n_cores; i++) {
+      GstMppRgaCore *core = &gst_mpp_rga.cores[i];
+
+      GST_INFO ("RGA worker %d for core %#x", i, core->mask);
+      core->thread = g_thread_new ("mpp-rga",
+          (GThreadFunc) gst_mpp_rga_worker, core);
+    }
+
+    g_once_init_leave (&inited, 1);
+  }
+
+  return gst_mpp_rga.supported;
+}
+
+/* Submit the ops as a single job and wait for it to be dispatched */
+static gboolean
+gst_mpp_rga_do_convert (GstMppRgaOp * ops, guint n_ops, gint * fence_fd)
+{
+  GstMppRgaJob job = { 0, };
+
+  if (fence_fd)
+    *fence_fd = -1;
+
+  if (!n_ops || !gst_mpp_use_rga () || !gst_mpp_rga_init ())
+    return FALSE;
+
+  job.ops = ops;
+  job.n_ops = n_ops;
+  job.fence_fd = fence_fd;
+
+  g_mutex_lock (&gst_mpp_rga.mutex);
+  g_queue_push_tail (&gst_mpp_rga.jobs, &job);
+  g_cond_signal (&gst_mpp_rga.job_cond);
+
+  while (!job.done)
+    g_cond_wait (&gst_mpp_rga.done_cond, &gst_mpp_rga.mutex);
+  g_mutex_unlock (&gst_mpp_rga.mutex);
+
+  return job.ret;
+}
+
+GstStructure *
+gst_mpp_rga_get_stats (void)
+{
+  GstStructure *stats;
+  guint i;
+
+  stats = gst_structure_new_empty ("application/x-mpp-rga-stats");
+  if (!gst_mpp_use_rga () || !gst_mpp_rga_init ())
+    return stats;
+
+  g_mutex_lock (&gst_mpp_rga.mutex);
+  gst_structure_set (stats, "queue-depth", G_TYPE_UINT,
+      g_queue_get_length (&gst_mpp_rga.jobs), "cores", G_TYPE_UINT,
+      gst_mpp_rga.n_cores, NULL);
+
+  for (i = 0; i < gst_mpp_rga.n_cores; i++) {
+    GstMppRgaCore *core = &gst_mpp_rga.cores[i];
+    gchar *name;
+
+    name = g_strdup_printf ("core%d-jobs", i);
+    gst_structure_set (stats, name, G_TYPE_UINT64, core->jobs, NULL);
+    g_free (name);
+
+    name = g_strdup_printf ("core%d-busy-time", i);
+    gst_structure_set (stats, name, G_TYPE_UINT64, core->busy_time, NULL);
+    g_free (name);
+  }
+  g_mutex_unlock (&gst_mpp_rga.mutex);
+
+  return stats;
+}
+
 static gint
 gst_mpp_rga_get_rotation (gint rotation)
 {
@@ -273,22 +786,185 @@ gst_mpp_rga_get_rotation (gint rotation)
   }
 }
 
-gboolean
-gst_mpp_rga_convert (GstBuffer * inbuf, GstVideoInfo * src_vinfo,
-    GstMemory * out_mem, GstVideoInfo * dst_vinfo, gint rotation)
+static gboolean
+gst_mpp_rga_info_set_rect (rga_info_t * info, GstVideoRectangle * rect)
 {
-  GstMapInfo mapinfo = { 0, };
-  gboolean ret;
+  struct gst_mpp_format *format;
+  gint x, y, w, h;
+
+  /* Default to the whole image */
+  if (!rect || !rect->w || !rect->h)
+    return TRUE;
+
+  x = rect->x;
+  y = rect->y;
+  w = rect->w;
+  h = rect->h;
 
-  rga_info_t src_info = { 0, };
-  rga_info_t dst_info = { 0, };
+  format = GST_MPP_GET_FORMAT (rga, info->rect.format);
+  if (format && format->is_yuv) {
+    /* RGA requires yuv image rect align to 2 */
+    x &= ~1;
+    y &= ~1;
+    w &= ~1;
+    h &= ~1;
+  }
 
-  if (!gst_mpp_rga_info_from_video_info (&src_info, src_vinfo))
+  if (x < 0 || y < 0 || w <= 0 || h <= 0 ||
+      x + w > info->rect.width || y + h > info->rect.height) {
+    GST_WARNING ("invalid rect <%d,%d,%d,%d> within %dx%d", x, y, w, h,
+        info->rect.width, info->rect.height);
     return FALSE;
+  }
+
+  info->rect.xoffset = x;
+  info->rect.yoffset = y;
+  info->rect.width = w;
+  info->rect.height = h;
+  return TRUE;
+}
 
-  if (!gst_mpp_rga_info_from_video_info (&dst_info, dst_vinfo))
+/*
+ * RGA only takes the base of a buffer, so a source starting within it (e.g.
+ * a zero-copy crop, pointing the video meta's offsets into a bigger image)
+ * becomes a rect of the whole image.
+ */
+static gboolean
+gst_mpp_rga_uncrop_video_info (GstVideoInfo * vinfo, GstVideoRectangle * rect)
+{
+  const GstVideoFormatInfo *finfo = vinfo->finfo;
+  GstVideoInfo info = *vinfo;
+  gsize offset = GST_VIDEO_INFO_PLANE_OFFSET (vinfo, 0);
+  gint stride = GST_VIDEO_INFO_PLANE_STRIDE (vinfo, 0);
+  gint pstride = GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, 0);
+  gsize skip;
+  gint x, y;
+  guint i;
+
+  if (!offset)
+    return TRUE;
+
+  /* Packed bit formats can't be cropped horizontally */
+  if (stride <= 0 || !pstride || (offset % stride) % pstride)
     return FALSE;
 
+  y = offset / stride;
+  x = (offset % stride) / pstride;
+
+  /* The first component of each plane has the plane's subsampling */
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vinfo); i++) {
+    skip = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, i, y) *
+        GST_VIDEO_INFO_PLANE_STRIDE (vinfo, i) +
+        GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, i, x) *
+        GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, i);
+
+    if (GST_VIDEO_INFO_PLANE_OFFSET (vinfo, i) < skip)
+      return FALSE;
+
+    GST_VIDEO_INFO_PLANE_OFFSET (&info, i) -= skip;
+  }
+
+  GST_VIDEO_INFO_WIDTH (&info) += x;
+  GST_VIDEO_INFO_HEIGHT (&info) += y;
+
+  if (rect->w && rect->h) {
+    rect->x += x;
+    rect->y += y;
+  } else {
+    rect->x = x;
+    rect->y = y;
+    rect->w = GST_VIDEO_INFO_WIDTH (vinfo);
+    rect->h = GST_VIDEO_INFO_HEIGHT (vinfo);
+  }
+
+  *vinfo = info;
+  return TRUE;
+}
+
+GstMppRgaBatch *
+gst_mpp_rga_batch_new (void)
+{
+  GstMppRgaBatch *batch = g_new0 (GstMppRgaBatch, 1);
+
+  batch->ops = g_array_new (FALSE, TRUE, sizeof (GstMppRgaOp));
+  return batch;
+}
+
+void
+gst_mpp_rga_batch_free (GstMppRgaBatch * batch)
+{
+  guint i;
+
+  for (i = 0; i < batch->ops->len; i++) {
+    GstMppRgaOp *op = &g_array_index (batch->ops, GstMppRgaOp, i);
+
+    if (op->inbuf) {
+      gst_buffer_unmap (op->inbuf, &op->mapinfo);
+      gst_buffer_unref (op->inbuf);
+    }
+  }
+
+  g_array_free (batch->ops, TRUE);
+  g_free (batch);
+}
+
+guint
+gst_mpp_rga_batch_get_size (GstMppRgaBatch * batch)
+{
+  return batch->ops->len;
+}
+
+static gboolean
+gst_mpp_rga_batch_add_op (GstMppRgaBatch * batch, GstMppRgaOp * op,
+    GstVideoRectangle * src_rect, GstMemory * out_mem,
+    GstVideoInfo * dst_vinfo, GstVideoRectangle * dst_rect, gint rotation)
+{
+  op->dst_info.fd = gst_dmabuf_memory_get_fd (out_mem);
+
+  if (!gst_mpp_rga_info_from_video_info (&op->dst_info, dst_vinfo))
+    goto err;
+
+  if (!gst_mpp_rga_info_set_rect (&op->src_info, src_rect))
+    goto err;
+
+  if (!gst_mpp_rga_info_set_rect (&op->dst_info, dst_rect))
+    goto err;
+
+  op->src_info.rotation = gst_mpp_rga_get_rotation (rotation);
+  if (op->src_info.rotation < 0)
+    goto err;
+
+  op->out_mem = out_mem;
+  g_array_append_vals (batch->ops, op, 1);
+  return TRUE;
+
+err:
+  if (op->inbuf) {
+    gst_buffer_unmap (op->inbuf, &op->mapinfo);
+    gst_buffer_unref (op->inbuf);
+  }
+  return FALSE;
+}
+
+gboolean
+gst_mpp_rga_batch_add (GstMppRgaBatch * batch, GstBuffer * inbuf,
+    GstVideoInfo * src_vinfo, GstVideoRectangle * src_rect,
+    GstMemory * out_mem, GstVideoInfo * dst_vinfo,
+    GstVideoRectangle * dst_rect, gint rotation)
+{
+  GstMppRgaOp op = { 0, };
+  GstVideoInfo vinfo = *src_vinfo;
+  GstVideoRectangle rect = { 0, };
+
+  if (src_rect)
+    rect = *src_rect;
+
+  if (!gst_mpp_rga_uncrop_video_info (&vinfo, &rect)) {
+    GST_WARNING ("unsupported source offset %" G_GSIZE_FORMAT,
+        GST_VIDEO_INFO_PLANE_OFFSET (src_vinfo, 0));
+    return FALSE;
+  }
+
   /* Prefer using dma fd */
   if (gst_buffer_n_memory (inbuf) == 1) {
     GstMemory *mem = gst_buffer_peek_memory (inbuf, 0);
@@ -297,24 +973,179 @@ gst_mpp_rga_convert (GstBuffer * inbuf, GstVideoInfo * src_vinfo,
     if (gst_is_dmabuf_memory (mem)) {
       gst_memory_get_sizes (mem, &offset, NULL);
       if (!offset)
-        src_info.fd = gst_dmabuf_memory_get_fd (mem);
+        op.src_info.fd = gst_dmabuf_memory_get_fd (mem);
     }
   }
 
-  if (src_info.fd <= 0) {
-    gst_buffer_map (inbuf, &mapinfo, GST_MAP_READ);
-    src_info.virAddr = mapinfo.data;
+  if (op.src_info.fd <= 0) {
+    if (!gst_buffer_map (inbuf, &op.mapinfo, GST_MAP_READ))
+      return FALSE;
+
+    op.inbuf = gst_buffer_ref (inbuf);
+    op.src_info.virAddr = op.mapinfo.data;
+  }
+
+  if (!gst_mpp_rga_info_from_video_info (&op.src_info, &vinfo)) {
+    if (op.inbuf) {
+      gst_buffer_unmap (op.inbuf, &op.mapinfo);
+      gst_buffer_unref (op.inbuf);
+    }
+    return FALSE;
   }
 
-  dst_info.fd = gst_dmabuf_memory_get_fd (out_mem);
+  return gst_mpp_rga_batch_add_op (batch, &op, &rect, out_mem, dst_vinfo,
+      dst_rect, rotation);
+}
+
+gboolean
+gst_mpp_rga_batch_add_mpp_frame (GstMppRgaBatch * batch, MppFrame * mframe,
+    GstVideoRectangle * src_rect, GstMemory * out_mem,
+    GstVideoInfo * dst_vinfo, GstVideoRectangle * dst_rect, gint rotation)
+{
+  GstMppRgaOp op = { 0, };
 
-  src_info.rotation = gst_mpp_rga_get_rotation (rotation);
-  if (src_info.rotation < 0)
+  if (!gst_mpp_rga_info_from_mpp_frame (&op.src_info, mframe))
     return FALSE;
 
-  ret = gst_mpp_rga_do_convert (&src_info, &dst_info);
+  return gst_mpp_rga_batch_add_op (batch, &op, src_rect, out_mem, dst_vinfo,
+      dst_rect, rotation);
+}
+
+gboolean
+gst_mpp_rga_batch_add_fill (GstMppRgaBatch * batch, GstMemory * out_mem,
+    GstVideoInfo * dst_vinfo, GstVideoRectangle * dst_rect, guint32 color)
+{
+  GstMppRgaOp op = { 0, };
+
+  op.dst_info.fd = gst_dmabuf_memory_get_fd (out_mem);
 
-  gst_buffer_unmap (inbuf, &mapinfo);
+  if (!gst_mpp_rga_info_from_video_info (&op.dst_info, dst_vinfo))
+    return FALSE;
+
+  if (!gst_mpp_rga_info_set_rect (&op.dst_info, dst_rect))
+    return FALSE;
+
+  op.dst_info.color = color;
+  op.out_mem = out_mem;
+  op.fill = TRUE;
+
+  g_array_append_vals (batch->ops, &op, 1);
+  return TRUE;
+}
+
+void
+gst_mpp_rga_batch_set_alpha (GstMppRgaBatch * batch, guint8 alpha)
+{
+  GstMppRgaOp *op;
+
+  g_return_if_fail (batch->ops->len);
+
+  op = &g_array_index (batch->ops, GstMppRgaOp, batch->ops->len - 1);
+
+  /* Source over with global alpha */
+  op->src_info.blend = (alpha << 16) | 0x0105;
+}
+
+gboolean
+gst_mpp_rga_batch_set_orientation (GstMppRgaBatch * batch,
+    GstVideoOrientationMethod method)
+{
+  GstMppRgaOp *op;
+
+  g_return_val_if_fail (batch->ops->len, FALSE);
+
+  op = &g_array_index (batch->ops, GstMppRgaOp, batch->ops->len - 1);
+
+  switch (method) {
+    case GST_VIDEO_ORIENTATION_IDENTITY:
+      op->src_info.rotation = 0;
+      break;
+    case GST_VIDEO_ORIENTATION_90R:
+      op->src_info.rotation = HAL_TRANSFORM_ROT_90;
+      break;
+    case GST_VIDEO_ORIENTATION_180:
+      op->src_info.rotation = HAL_TRANSFORM_ROT_180;
+      break;
+    case GST_VIDEO_ORIENTATION_90L:
+      op->src_info.rotation = HAL_TRANSFORM_ROT_270;
+      break;
+    case GST_VIDEO_ORIENTATION_HORIZ:
+      op->src_info.rotation = HAL_TRANSFORM_FLIP_H;
+      break;
+    case GST_VIDEO_ORIENTATION_VERT:
+      op->src_info.rotation = HAL_TRANSFORM_FLIP_V;
+      break;
+    default:
+      GST_WARNING ("unsupported orientation method %d", method);
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+gboolean
+gst_mpp_rga_batch_submit (GstMppRgaBatch * batch, gboolean async)
+{
+  GstMppRgaOp *ops = (GstMppRgaOp *) batch->ops->data;
+  guint i, j, n_ops = batch->ops->len;
+  gint fence_fd;
+
+  /* The mapped sources must stay valid until the job is done */
+  for (i = 0; i < n_ops; i++) {
+    if (ops[i].inbuf)
+      async = FALSE;
+  }
+
+  if (!async)
+    return gst_mpp_rga_do_convert (ops, n_ops, NULL);
+
+  if (!gst_mpp_rga_do_convert (ops, n_ops, &fence_fd))
+    return FALSE;
+
+  if (fence_fd < 0)
+    return TRUE;
+
+  /* Every output memory carries the job's completion fence */
+  for (i = 0; i < n_ops; i++) {
+    for (j = 0; j < i; j++) {
+      if (ops[j].out_mem == ops[i].out_mem)
+        break;
+    }
+
+    if (j == i)
+      gst_mpp_memory_set_fence (ops[i].out_mem, dup (fence_fd));
+  }
+
+  close (fence_fd);
+  return TRUE;
+}
+
+gboolean
+gst_mpp_rga_convert (GstBuffer * inbuf, GstVideoInfo * src_vinfo,
+    GstMemory * out_mem, GstVideoInfo * dst_vinfo, gint rotation)
+{
+  GstMppRgaBatch *batch = gst_mpp_rga_batch_new ();
+  gboolean ret;
+
+  ret = gst_mpp_rga_batch_add (batch, inbuf, src_vinfo, NULL, out_mem,
+      dst_vinfo, NULL, rotation) && gst_mpp_rga_batch_submit (batch, FALSE);
+
+  gst_mpp_rga_batch_free (batch);
+  return ret;
+}
+
+static gboolean
+gst_mpp_rga_convert_from_mpp_frame_full (MppFrame * mframe,
+    GstMemory * out_mem, GstVideoInfo * dst_vinfo, gint rotation,
+    gboolean async)
+{
+  GstMppRgaBatch *batch = gst_mpp_rga_batch_new ();
+  gboolean ret;
+
+  ret = gst_mpp_rga_batch_add_mpp_frame (batch, mframe, NULL, out_mem,
+      dst_vinfo, NULL, rotation) && gst_mpp_rga_batch_submit (batch, async);
+
+  gst_mpp_rga_batch_free (batch);
   return ret;
 }
 
@@ -322,24 +1153,90 @@ gboolean
 gst_mpp_rga_convert_from_mpp_frame (MppFrame * mframe,
     GstMemory * out_mem, GstVideoInfo * dst_vinfo, gint rotation)
 {
-  rga_info_t src_info = { 0, };
-  rga_info_t dst_info = { 0, };
+  return gst_mpp_rga_convert_from_mpp_frame_full (mframe, out_mem, dst_vinfo,
+      rotation, FALSE);
+}
 
-  if (!gst_mpp_rga_info_from_mpp_frame (&src_info, mframe))
-    return FALSE;
+gboolean
+gst_mpp_rga_convert_from_mpp_frame_async (MppFrame * mframe,
+    GstMemory * out_mem, GstVideoInfo * dst_vinfo, gint rotation)
+{
+  return gst_mpp_rga_convert_from_mpp_frame_full (mframe, out_mem, dst_vinfo,
+      rotation, TRUE);
+}
+#endif
 
-  if (!gst_mpp_rga_info_from_video_info (&dst_info, dst_vinfo))
-    return FALSE;
+/* The fd is stored plus one, so that a NULL qdata means no fence */
+static GQuark
+gst_mpp_fence_quark (void)
+{
+  static GQuark quark = 0;
+  if (quark == 0)
+    quark = g_quark_from_string ("mpp-fence");
+
+  return quark;
+}
+
+static void
+gst_mpp_fence_close (gpointer data)
+{
+  close (GPOINTER_TO_INT (data) - 1);
+}
+
+void
+gst_mpp_memory_set_fence (GstMemory * mem, gint fence_fd)
+{
+  while (mem->parent)
+    mem = mem->parent;
 
-  dst_info.fd = gst_dmabuf_memory_get_fd (out_mem);
+  /* Never drop a pending job */
+  gst_mpp_memory_wait_fence (mem);
 
-  src_info.rotation = gst_mpp_rga_get_rotation (rotation);
-  if (src_info.rotation < 0)
+  gst_mini_object_set_qdata (GST_MINI_OBJECT (mem), gst_mpp_fence_quark (),
+      GINT_TO_POINTER (fence_fd + 1), gst_mpp_fence_close);
+}
+
+gboolean
+gst_mpp_memory_has_fence (GstMemory * mem)
+{
+  while (mem->parent)
+    mem = mem->parent;
+
+  return !!gst_mini_object_get_qdata (GST_MINI_OBJECT (mem),
+      gst_mpp_fence_quark ());
+}
+
+gboolean
+gst_mpp_memory_wait_fence (GstMemory * mem)
+{
+  struct pollfd pfd = { 0, };
+  gpointer data;
+  gint ret;
+
+  while (mem->parent)
+    mem = mem->parent;
+
+  data = gst_mini_object_steal_qdata (GST_MINI_OBJECT (mem),
+      gst_mpp_fence_quark ());
+  if (!data)
+    return TRUE;
+
+  pfd.fd = GPOINTER_TO_INT (data) - 1;
+  pfd.events = POLLIN;
+
+  do {
+    ret = poll (&pfd, 1, GST_MPP_FENCE_TIMEOUT_MS);
+  } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+  close (pfd.fd);
+
+  if (ret <= 0) {
+    GST_WARNING ("failed to wait fence %d", pfd.fd);
     return FALSE;
+  }
 
-  return gst_mpp_rga_do_convert (&src_info, &dst_info);
+  return TRUE;
 }
-#endif
 
 void
 gst_mpp_video_info_update_format (GstVideoInfo * info, GstVideoFormat format,
@@ -504,12 +1401,21 @@ plugin_init (GstPlugin * plugin)
 
   gst_mpp_video_dec_register (plugin, GST_RANK_PRIMARY + 1);
   gst_mpp_jpeg_dec_register (plugin, GST_RANK_PRIMARY + 1);
+  gst_mpp_multi_dec_register (plugin, GST_RANK_NONE);
 
 #ifdef USE_VPXALPHADEC
   gst_mpp_vpx_alpha_decode_bin_register (plugin,
       GST_RANK_PRIMARY + GST_MPP_ALPHA_DECODE_BIN_RANK_OFFSET);
 #endif
 
+#ifdef HAVE_RGA
+  gst_rga_convert_register (plugin, GST_RANK_NONE);
+#endif
+
+#ifdef USE_RGACOMPOSITOR
+  gst_rga_compositor_register (plugin, GST_RANK_NONE);
+#endif
+
   return TRUE;
 }
 
@@ -23,6 +23,7 @@
 #define  __GST_MPP_H__
 
 #include <gst/video/video.h>
+#include <gst/video/gstvideosink.h>
 #include <gst/allocators/gstdmabuf.h>
 
 #ifdef HAVE_RGA
@@ -85,8 +86,63 @@ gboolean gst_mpp_rga_convert (GstBuffer * inbuf, GstVideoInfo * src_vinfo,
 
 gboolean gst_mpp_rga_convert_from_mpp_frame (MppFrame * mframe,
     GstMemory * out_mem, GstVideoInfo * dst_vinfo, gint rotation);
+
+/* Attach the RGA release fence to out_mem instead of waiting for it */
+gboolean gst_mpp_rga_convert_from_mpp_frame_async (MppFrame * mframe,
+    GstMemory * out_mem, GstVideoInfo * dst_vinfo, gint rotation);
+
+/*
+ * Batched conversions, e.g. one frame to many outputs or many frames to
+ * regions of one output, submitted as a single RGA job.
+ *
+ * Empty rects mean the whole images.
+ */
+typedef struct _GstMppRgaBatch GstMppRgaBatch;
+
+GstMppRgaBatch *gst_mpp_rga_batch_new (void);
+
+void gst_mpp_rga_batch_free (GstMppRgaBatch * batch);
+
+guint gst_mpp_rga_batch_get_size (GstMppRgaBatch * batch);
+
+gboolean gst_mpp_rga_batch_add (GstMppRgaBatch * batch, GstBuffer * inbuf,
+    GstVideoInfo * src_vinfo, GstVideoRectangle * src_rect,
+    GstMemory * out_mem, GstVideoInfo * dst_vinfo,
+    GstVideoRectangle * dst_rect, gint rotation);
+
+gboolean gst_mpp_rga_batch_add_mpp_frame (GstMppRgaBatch * batch,
+    MppFrame * mframe, GstVideoRectangle * src_rect, GstMemory * out_mem,
+    GstVideoInfo * dst_vinfo, GstVideoRectangle * dst_rect, gint rotation);
+
+/* Fill the dst_rect of out_mem with the color (RGBA8888) */
+gboolean gst_mpp_rga_batch_add_fill (GstMppRgaBatch * batch,
+    GstMemory * out_mem, GstVideoInfo * dst_vinfo,
+    GstVideoRectangle * dst_rect, guint32 color);
+
+/* Blend the last added blit over its destination */
+void gst_mpp_rga_batch_set_alpha (GstMppRgaBatch * batch, guint8 alpha);
+
+/* Override the last added blit's rotation, flips included */
+gboolean gst_mpp_rga_batch_set_orientation (GstMppRgaBatch * batch,
+    GstVideoOrientationMethod method);
+
+/* With async, every output memory carries the job's completion fence */
+gboolean gst_mpp_rga_batch_submit (GstMppRgaBatch * batch, gboolean async);
+
+/* Queue depth and per-core jobs and busy time of the shared RGA scheduler */
+GstStructure *gst_mpp_rga_get_stats (void);
 #endif
 
+#define GST_MPP_FENCE_TIMEOUT_MS 1000
+
+/* Takes the fence fd */
+void gst_mpp_memory_set_fence (GstMemory * mem, gint fence_fd);
+
+gboolean gst_mpp_memory_has_fence (GstMemory * mem);
+
+/* Wait for and release the fence, if any */
+gboolean gst_mpp_memory_wait_fence (GstMemory * mem);
+
 /* Apply new format and size without reinit the video info */
 void
 gst_mpp_video_info_update_format (GstVideoInfo * info, GstVideoFormat format,
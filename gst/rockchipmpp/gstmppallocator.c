@@ -27,6 +27,7 @@
 
 #include <gst/allocators/gstdmabuf.h>
 
+#include "gstmpp.h"
 #include "gstmppallocator.h"
 
 #define GST_TYPE_MPP_ALLOCATOR (gst_mpp_allocator_get_type())
@@ -106,6 +107,31 @@ gst_mpp_allocator_get_mpp_group (GstAllocator * allocator)
   return self->group;
 }
 
+static GQuark
+gst_mpp_content_quark (void)
+{
+  static GQuark quark = 0;
+  if (quark == 0)
+    quark = g_quark_from_string ("mpp-content");
+
+  return quark;
+}
+
+void
+gst_mpp_memory_set_content (GstMemory * mem, gpointer data,
+    GDestroyNotify notify)
+{
+  gst_mini_object_set_qdata (GST_MINI_OBJECT (mem), gst_mpp_content_quark (),
+      data, notify);
+}
+
+gpointer
+gst_mpp_memory_get_content (GstMemory * mem)
+{
+  return gst_mini_object_get_qdata (GST_MINI_OBJECT (mem),
+      gst_mpp_content_quark ());
+}
+
 MppBuffer
 gst_mpp_mpp_buffer_from_gst_memory (GstMemory * mem)
 {
@@ -230,6 +256,31 @@ gst_mpp_allocator_alloc_mppbuf (GstAllocator * allocator, gsize size)
   return mbuf;
 }
 
+gboolean
+gst_mpp_allocator_prealloc (GstAllocator * allocator, gsize size, guint count)
+{
+  GstMppAllocator *self = GST_MPP_ALLOCATOR (allocator);
+  MppBuffer *mbufs;
+  guint i, n;
+
+  GST_DEBUG_OBJECT (self, "preallocating %d buffers (%" G_GSIZE_FORMAT ")",
+      count, size);
+
+  mbufs = g_new0 (MppBuffer, count);
+  for (n = 0; n < count; n++) {
+    mbufs[n] = gst_mpp_allocator_alloc_mppbuf (allocator, size);
+    if (!mbufs[n])
+      break;
+  }
+
+  /* Put them back to the group, so that they can be recycled later */
+  for (i = 0; i < n; i++)
+    mpp_buffer_put (mbufs[i]);
+
+  g_free (mbufs);
+  return n == count;
+}
+
 static GstMemory *
 gst_mpp_allocator_alloc (GstAllocator * allocator, gsize size,
     GstAllocationParams * params UNUSED)
@@ -253,6 +304,13 @@ gst_mpp_allocator_alloc (GstAllocator * allocator, gsize size,
 static gpointer
 gst_mpp_mem_map_full (GstMemory * mem, GstMapInfo * info, gsize size)
 {
+  /* Wait for the pending RGA job lazily */
+  gst_mpp_memory_wait_fence (mem);
+
+  /* The recorded content is stale once written by CPU */
+  if (info->flags & GST_MAP_WRITE)
+    gst_mpp_memory_set_content (mem, NULL, NULL);
+
   if (mem->parent)
     return gst_mpp_mem_map_full (mem->parent, info, size);
 
@@ -37,6 +37,12 @@ gint gst_mpp_allocator_get_index (GstAllocator * allocator);
 
 MppBufferGroup gst_mpp_allocator_get_mpp_group (GstAllocator * allocator);
 
+/* Caller's description of the content, dropped when mapped for writing */
+void gst_mpp_memory_set_content (GstMemory * mem, gpointer data,
+    GDestroyNotify notify);
+
+gpointer gst_mpp_memory_get_content (GstMemory * mem);
+
 MppBuffer gst_mpp_mpp_buffer_from_gst_memory (GstMemory * mem);
 
 GstMemory *gst_mpp_allocator_import_mppbuf (GstAllocator * allocator,
@@ -47,6 +53,9 @@ GstMemory *gst_mpp_allocator_import_gst_memory (GstAllocator * allocator,
 
 MppBuffer gst_mpp_allocator_alloc_mppbuf (GstAllocator * allocator, gsize size);
 
+gboolean gst_mpp_allocator_prealloc (GstAllocator * allocator, gsize size,
+    guint count);
+
 G_END_DECLS;
 
 #endif /* __GST_MPP_ALLOCATOR_H__ */
@@ -26,6 +26,8 @@
 #include "config.h"
 #endif
 
+#include <gst/allocators/gstdmabuf.h>
+
 #include "gstmppallocator.h"
 #include "gstmppdec.h"
 
@@ -73,6 +75,7 @@ G_DEFINE_ABSTRACT_TYPE (GstMppDec, gst_mpp_dec, GST_TYPE_VIDEO_DECODER);
 #define DEFAULT_PROP_ROTATION 0
 #define DEFAULT_PROP_WIDTH 0    /* Original */
 #define DEFAULT_PROP_HEIGHT 0   /* Original */
+#define DEFAULT_PROP_QOS_SKIP_THRESHOLD 500
 
 static gboolean DEFAULT_PROP_IGNORE_ERROR = TRUE;
 static gboolean DEFAULT_PROP_FAST_MODE = TRUE;
@@ -88,6 +91,8 @@ enum
   PROP_IGNORE_ERROR,
   PROP_FAST_MODE,
   PROP_DMA_FEATURE,
+  PROP_QOS_SKIP_THRESHOLD,
+  PROP_STATS,
   PROP_LAST,
 };
 
@@ -165,6 +170,10 @@ gst_mpp_dec_set_property (GObject * object,
       self->dma_feature = g_value_get_boolean (value);
       break;
     }
+    case PROP_QOS_SKIP_THRESHOLD:{
+      self->qos_skip_threshold = g_value_get_uint (value);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -197,12 +206,66 @@ gst_mpp_dec_get_property (GObject * object,
     case PROP_DMA_FEATURE:
       g_value_set_boolean (value, self->dma_feature);
       break;
+    case PROP_QOS_SKIP_THRESHOLD:
+      g_value_set_uint (value, self->qos_skip_threshold);
+      break;
+    case PROP_STATS:{
+      GstStructure *stats;
+#ifdef HAVE_RGA
+      GstStructure *rga_stats;
+#endif
+
+      stats = gst_structure_new ("application/x-mpp-dec-stats",
+          "dropped-trickmode", G_TYPE_UINT64, self->dropped_trickmode,
+          "dropped-qos", G_TYPE_UINT64, self->dropped_qos,
+          "dropped-qos-skip", G_TYPE_UINT64, self->dropped_qos_skip, NULL);
+
+#ifdef HAVE_RGA
+      /* The RGA scheduler is shared by all of the elements */
+      rga_stats = gst_mpp_rga_get_stats ();
+      gst_structure_set (stats, "rga", GST_TYPE_STRUCTURE, rga_stats, NULL);
+      gst_structure_free (rga_stats);
+#endif
+
+      g_value_take_boxed (value, stats);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       return;
   }
 }
 
+/* Finish (or drop) the frame deferred for overlapping its RGA job */
+static void
+gst_mpp_dec_finish_pending (GstVideoDecoder * decoder, gboolean drop)
+{
+  GstMppDecClass *klass = GST_MPP_DEC_GET_CLASS (decoder);
+  GstMppDec *self = GST_MPP_DEC (decoder);
+  GstVideoCodecFrame *frame = self->pending_frame;
+  GstMemory *mem;
+
+  if (!frame)
+    return;
+
+  self->pending_frame = NULL;
+
+  /* The RGA must be done with the buffer even when dropping it */
+  mem = gst_buffer_peek_memory (frame->output_buffer, 0);
+  if (!gst_mpp_memory_wait_fence (mem)) {
+    GST_WARNING_OBJECT (self, "failed to wait for RGA");
+    drop = TRUE;
+  }
+
+  if (drop)
+    gst_video_decoder_release_frame (decoder, frame);
+  else
+    gst_video_decoder_finish_frame (decoder, frame);
+
+  if (klass->finish_pending)
+    klass->finish_pending (decoder, drop);
+}
+
 static void
 gst_mpp_dec_stop_task (GstVideoDecoder * decoder, gboolean drain)
 {
@@ -232,6 +295,7 @@ gst_mpp_dec_stop_task (GstVideoDecoder * decoder, gboolean drain)
 static void
 gst_mpp_dec_reset (GstVideoDecoder * decoder, gboolean drain, gboolean final)
 {
+  GstMppDecClass *klass = GST_MPP_DEC_GET_CLASS (decoder);
   GstMppDec *self = GST_MPP_DEC (decoder);
 
   GST_MPP_DEC_LOCK (decoder);
@@ -242,17 +306,45 @@ gst_mpp_dec_reset (GstVideoDecoder * decoder, gboolean drain, gboolean final)
   self->draining = drain;
 
   gst_mpp_dec_stop_task (decoder, drain);
+  gst_mpp_dec_finish_pending (decoder, !drain);
 
   self->flushing = final;
   self->draining = FALSE;
+  self->qos_skipping = FALSE;
 
   self->mpi->reset (self->mpp_ctx);
+  if (klass->reset)
+    klass->reset (decoder);
+
   self->task_ret = GST_FLOW_OK;
   self->decoded_frames = 0;
 
   GST_MPP_DEC_UNLOCK (decoder);
 }
 
+static void
+gst_mpp_dec_set_buffer_group (GstVideoDecoder * decoder, MppBufferGroup group)
+{
+  GstMppDecClass *klass = GST_MPP_DEC_GET_CLASS (decoder);
+  GstMppDec *self = GST_MPP_DEC (decoder);
+
+  self->mpi->control (self->mpp_ctx, MPP_DEC_SET_EXT_BUF_GROUP, group);
+  if (klass->set_buffer_group)
+    klass->set_buffer_group (decoder, group);
+}
+
+/* The allocator must exist before negotiating, to provide the convert pool */
+static gboolean
+gst_mpp_dec_ensure_allocator (GstVideoDecoder * decoder)
+{
+  GstMppDec *self = GST_MPP_DEC (decoder);
+
+  if (!self->allocator)
+    self->allocator = gst_mpp_allocator_new ();
+
+  return self->allocator != NULL;
+}
+
 static gboolean
 gst_mpp_dec_start (GstVideoDecoder * decoder)
 {
@@ -262,8 +354,16 @@ gst_mpp_dec_start (GstVideoDecoder * decoder)
 
   gst_video_info_init (&self->info);
 
-  if (mpp_create (&self->mpp_ctx, &self->mpi))
+  if (!gst_mpp_dec_ensure_allocator (decoder)) {
+    GST_ERROR_OBJECT (self, "failed to create mpp allocator");
+    return FALSE;
+  }
+
+  if (mpp_create (&self->mpp_ctx, &self->mpi)) {
+    gst_object_unref (self->allocator);
+    self->allocator = NULL;
     return FALSE;
+  }
 
   self->interlace_mode = GST_VIDEO_INTERLACE_MODE_PROGRESSIVE;
   self->mpp_type = MPP_VIDEO_CodingUnused;
@@ -277,6 +377,11 @@ gst_mpp_dec_start (GstVideoDecoder * decoder)
   self->decoded_frames = 0;
   self->flushing = FALSE;
 
+  self->qos_skipping = FALSE;
+  self->dropped_trickmode = 0;
+  self->dropped_qos = 0;
+  self->dropped_qos_skip = 0;
+
   /* Prefer using MPP PTS */
   self->use_mpp_pts = TRUE;
   self->mpp_delta_pts = 0;
@@ -299,7 +404,7 @@ gst_mpp_dec_clear_allocator (GstVideoDecoder * decoder)
     gst_mpp_allocator_set_cacheable (self->allocator, FALSE);
     gst_object_unref (self->allocator);
     self->allocator = NULL;
-    self->mpi->control (self->mpp_ctx, MPP_DEC_SET_EXT_BUF_GROUP, NULL);
+    gst_mpp_dec_set_buffer_group (decoder, NULL);
   }
 }
 
@@ -365,16 +470,47 @@ gst_mpp_dec_finish (GstVideoDecoder * decoder)
   GST_DEBUG_OBJECT (decoder, "finishing");
   gst_mpp_dec_reset (decoder, TRUE, FALSE);
 
-  /* No need to caching buffers after finished */
+  /* No need to caching buffers after finished, a fresh allocator keeps the
+   * convert pool available for renegotiation */
   gst_mpp_dec_clear_allocator (decoder);
+  gst_mpp_dec_ensure_allocator (decoder);
 
   return GST_FLOW_OK;
 }
 
+static void
+gst_mpp_dec_update_latency (GstVideoDecoder * decoder)
+{
+  GstMppDec *self = GST_MPP_DEC (decoder);
+  GstVideoInfo *info = &self->input_state->info;
+  GstClockTime duration;
+  guint frames;
+
+  if (!info->fps_n || !info->fps_d) {
+    GST_DEBUG_OBJECT (self, "unable to report latency without framerate");
+    return;
+  }
+
+  duration = gst_util_uint64_scale (GST_SECOND, info->fps_d, info->fps_n);
+
+  /* One frame for decoding, plus MPP's display-order reordering */
+  if (self->low_latency || self->mpp_type == MPP_VIDEO_CodingMJPEG)
+    frames = 1;
+  else
+    frames = MPP_DEC_REORDER_FRAMES;
+
+  GST_DEBUG_OBJECT (self, "latency %d - %d frames", frames,
+      MAX (frames, self->max_pending));
+
+  gst_video_decoder_set_latency (decoder, duration * frames,
+      duration * MAX (frames, self->max_pending));
+}
+
 static gboolean
 gst_mpp_dec_set_format (GstVideoDecoder * decoder, GstVideoCodecState * state)
 {
   GstMppDec *self = GST_MPP_DEC (decoder);
+  gboolean fast_mode;
 
   GST_DEBUG_OBJECT (self, "setting format: %" GST_PTR_FORMAT, state->caps);
 
@@ -390,13 +526,28 @@ gst_mpp_dec_set_format (GstVideoDecoder * decoder, GstVideoCodecState * state)
 
     /* Clear cached buffers when format info changed */
     gst_mpp_dec_clear_allocator (decoder);
+    if (!gst_mpp_dec_ensure_allocator (decoder)) {
+      GST_ERROR_OBJECT (self, "failed to create mpp allocator");
+      return FALSE;
+    }
 
     gst_video_codec_state_unref (self->input_state);
     self->input_state = NULL;
   } else {
+    /* Fast mode parser buffers input frames */
+    fast_mode = self->fast_mode && !self->low_latency;
+
     /* NOTE: MPP fast mode must be applied before mpp_init() */
     self->mpi->control (self->mpp_ctx, MPP_DEC_SET_PARSER_FAST_MODE,
-        &self->fast_mode);
+        &fast_mode);
+
+    if (self->low_latency) {
+      RK_U32 immediate = 1;
+
+      /* Output frames in decoding order without waiting for reordering */
+      self->mpi->control (self->mpp_ctx, MPP_DEC_SET_IMMEDIATE_OUT,
+          &immediate);
+    }
 
     if (mpp_init (self->mpp_ctx, MPP_CTX_DEC, self->mpp_type)) {
       GST_ERROR_OBJECT (self, "failed to init mpp ctx");
@@ -408,6 +559,8 @@ gst_mpp_dec_set_format (GstVideoDecoder * decoder, GstVideoCodecState * state)
     self->mpi->control (self->mpp_ctx, MPP_DEC_SET_DISABLE_ERROR, NULL);
 
   self->input_state = gst_video_codec_state_ref (state);
+
+  gst_mpp_dec_update_latency (decoder);
   return TRUE;
 }
 
@@ -456,9 +609,6 @@ gst_mpp_dec_update_video_info (GstVideoDecoder * decoder, GstVideoFormat format,
   *info = output_state->info;
   gst_video_codec_state_unref (output_state);
 
-  if (!gst_video_decoder_negotiate (decoder))
-    return FALSE;
-
   align = align ? : 2;
 
   hstride = hstride ? : GST_MPP_VIDEO_INFO_HSTRIDE (info);
@@ -467,7 +617,83 @@ gst_mpp_dec_update_video_info (GstVideoDecoder * decoder, GstVideoFormat format,
   vstride = vstride ? : GST_MPP_VIDEO_INFO_VSTRIDE (info);
   vstride = GST_ROUND_UP_N (vstride, align);
 
-  return gst_mpp_video_info_align (info, hstride, vstride);
+  /* Align before negotiating, the convert pool needs the final size */
+  if (!gst_mpp_video_info_align (info, hstride, vstride))
+    return FALSE;
+
+  return gst_video_decoder_negotiate (decoder);
+}
+
+static gboolean
+gst_mpp_dec_config_convert_pool (GstVideoDecoder * decoder,
+    GstBufferPool * pool, GstCaps * caps, guint min, guint max)
+{
+  GstMppDec *self = GST_MPP_DEC (decoder);
+  GstStructure *config;
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      GST_VIDEO_INFO_SIZE (&self->info), min, max);
+  gst_buffer_pool_config_set_allocator (config, self->allocator, NULL);
+
+  return gst_buffer_pool_set_config (pool, config);
+}
+
+static gboolean
+gst_mpp_dec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
+{
+  GstVideoDecoderClass *pclass = GST_VIDEO_DECODER_CLASS (parent_class);
+  GstMppDec *self = GST_MPP_DEC (decoder);
+  GstBufferPool *pool = NULL;
+  GstCaps *caps;
+  guint min = 0, max = 0;
+  gboolean update;
+
+  /* The pool is only used for RGA converted frames */
+  if (!self->convert || !self->allocator)
+    return pclass->decide_allocation (decoder, query);
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (!caps)
+    return FALSE;
+
+  update = gst_query_get_n_allocation_pools (query) > 0;
+  if (update)
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, NULL, &min, &max);
+
+  /* Keep enough buffers for the pending frames, but stay bounded */
+  min = MAX (min, 2);
+  if (!max)
+    max = min + self->max_pending;
+  max = MAX (max, min);
+
+  /* RGA needs our dma-buf memory, which downstream pools (e.g. GL ones)
+   * can't provide, only their sizes are followed */
+  if (pool) {
+    GST_DEBUG_OBJECT (self, "not using downstream pool %" GST_PTR_FORMAT,
+        pool);
+    gst_object_unref (pool);
+  }
+
+  pool = gst_buffer_pool_new ();
+  if (!gst_mpp_dec_config_convert_pool (decoder, pool, caps, min, max)) {
+    GST_ERROR_OBJECT (self, "failed to config convert pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "convert pool %" GST_PTR_FORMAT " (%d-%d)",
+      pool, min, max);
+
+  if (update)
+    gst_query_set_nth_allocation_pool (query, 0, pool,
+        GST_VIDEO_INFO_SIZE (&self->info), min, max);
+  else
+    gst_query_add_allocation_pool (query, pool,
+        GST_VIDEO_INFO_SIZE (&self->info), min, max);
+
+  gst_object_unref (pool);
+  return TRUE;
 }
 
 gboolean
@@ -781,29 +1007,104 @@ out:
 }
 
 #ifdef HAVE_RGA
+static GstBuffer *
+gst_mpp_dec_acquire_convert_buffer (GstVideoDecoder * decoder)
+{
+  GstMppDec *self = GST_MPP_DEC (decoder);
+  GstBufferPoolAcquireParams params = { 0, };
+  GstBufferPool *pool;
+  GstBuffer *buffer = NULL;
+  GstMemory *mem;
+  gsize size = GST_VIDEO_INFO_SIZE (&self->info);
+
+  pool = gst_video_decoder_get_buffer_pool (decoder);
+  if (pool) {
+    /* Never block the output thread on downstream */
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    if (gst_buffer_pool_acquire_buffer (pool, &buffer, &params) != GST_FLOW_OK)
+      buffer = NULL;
+    gst_object_unref (pool);
+  }
+
+  if (buffer) {
+    GstVideoMeta *vmeta;
+
+    /* Reused pool buffers keep their video meta, the frame's is copied */
+    while ((vmeta = gst_buffer_get_video_meta (buffer))) {
+      if (!gst_buffer_remove_meta (buffer, (GstMeta *) vmeta))
+        break;
+    }
+
+    mem = gst_buffer_peek_memory (buffer, 0);
+    if (!vmeta && gst_buffer_n_memory (buffer) == 1 &&
+        gst_is_dmabuf_memory (mem) &&
+        gst_memory_get_sizes (mem, NULL, NULL) >= size)
+      return buffer;
+
+    GST_DEBUG_OBJECT (self, "unusable pool buffer");
+    gst_buffer_unref (buffer);
+  }
+
+  /* Pool exhausted or unusable */
+  mem = gst_allocator_alloc (self->allocator, size, NULL);
+  if (!mem)
+    return NULL;
+
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer, mem);
+  return buffer;
+}
+
 static gboolean
 gst_mpp_dec_rga_convert (GstVideoDecoder * decoder, MppFrame mframe,
-    GstBuffer * buffer)
+    GstBuffer ** buffer)
 {
+  GstMppDecClass *klass = GST_MPP_DEC_GET_CLASS (decoder);
   GstMppDec *self = GST_MPP_DEC (decoder);
   GstVideoInfo *info = &self->info;
+  GstMppRgaBatch *batch;
+  GstBuffer *outbuf;
   GstMemory *mem;
-  gboolean ret;
+  gboolean ret = FALSE;
 
   GST_VIDEO_DECODER_STREAM_UNLOCK (decoder);
 
-  mem = gst_allocator_alloc (self->allocator, GST_VIDEO_INFO_SIZE (info), NULL);
-  g_return_val_if_fail (mem, FALSE);
+  outbuf = gst_mpp_dec_acquire_convert_buffer (decoder);
+  if (!outbuf) {
+    GST_WARNING_OBJECT (self, "failed to alloc convert buffer");
+    goto out;
+  }
+
+  mem = gst_buffer_peek_memory (outbuf, 0);
+
+  batch = gst_mpp_rga_batch_new ();
+  if (gst_mpp_rga_batch_add_mpp_frame (batch, mframe, NULL, mem, info, NULL,
+          self->rotation)) {
+    /* Other conversions of this frame share the same RGA job */
+    if (klass->fill_rga_batch)
+      klass->fill_rga_batch (decoder, mframe, batch);
 
-  if (!gst_mpp_rga_convert_from_mpp_frame (mframe, mem, info, self->rotation)) {
+    /* Overlap the conversion with the next decoding, unless the frame
+     * should come out as soon as possible */
+    ret = gst_mpp_rga_batch_submit (batch, !self->low_latency);
+  }
+  gst_mpp_rga_batch_free (batch);
+
+  if (!ret) {
     GST_WARNING_OBJECT (self, "failed to convert");
-    gst_memory_unref (mem);
-    ret = FALSE;
+    gst_buffer_unref (outbuf);
   } else {
-    gst_buffer_replace_all_memory (buffer, mem);
-    ret = TRUE;
+    /* Carry over the video and crop metas */
+    gst_buffer_copy_into (outbuf, *buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+    gst_buffer_unref (*buffer);
+    *buffer = outbuf;
   }
 
+out:
+  /* Never leave the other conversions unconverted for a later frame */
+  if (!ret && klass->cancel_rga_batch)
+    klass->cancel_rga_batch (decoder);
+
   GST_VIDEO_DECODER_STREAM_LOCK (decoder);
   return ret;
 }
@@ -884,7 +1185,7 @@ gst_mpp_dec_get_gst_buffer (GstVideoDecoder * decoder, MppFrame mframe)
 #ifdef HAVE_RGA
   if (gst_mpp_use_rga ()) {
     if (!GST_VIDEO_INFO_IS_AFBC (info) && !offset_x && !offset_y &&
-        gst_mpp_dec_rga_convert (decoder, mframe, buffer))
+        gst_mpp_dec_rga_convert (decoder, mframe, &buffer))
       return buffer;
   }
 #endif
@@ -948,12 +1249,36 @@ gst_mpp_dec_loop (GstVideoDecoder * decoder)
   GstMppDec *self = GST_MPP_DEC (decoder);
   GstVideoCodecFrame *frame;
   GstBuffer *buffer;
+  GstMemory *mem;
+  GstClockTime pts, duration;
   MppFrame mframe;
   int timeout, mode;
+  gboolean done;
 
   timeout = self->flushing ? MPP_TIMEOUT_NON_BLOCK : MPP_OUTPUT_TIMEOUT_MS;
 
-  mframe = klass->poll_mpp_frame (decoder, timeout);
+  if (self->pending_frame) {
+    /* Fetch the next frame first if it's ready, so that MPP's output is
+     * overlapped with the pending frame's RGA job */
+    mframe = klass->poll_mpp_frame (decoder, MPP_TIMEOUT_NON_BLOCK);
+
+    /* Finish the converted frame as soon as its RGA job is done, the wait
+     * doesn't block the streaming thread */
+    mem = gst_buffer_peek_memory (self->pending_frame->output_buffer, 0);
+    done = gst_mpp_memory_wait_fence (mem);
+
+    GST_VIDEO_DECODER_STREAM_LOCK (decoder);
+    gst_mpp_dec_finish_pending (decoder, !done ||
+        (self->flushing && !self->draining));
+    GST_MPP_DEC_BROADCAST (decoder);
+    GST_VIDEO_DECODER_STREAM_UNLOCK (decoder);
+
+    if (!mframe)
+      mframe = klass->poll_mpp_frame (decoder, timeout);
+  } else {
+    mframe = klass->poll_mpp_frame (decoder, timeout);
+  }
+
   /* Likely due to timeout */
   if (!mframe)
     return;
@@ -1011,7 +1336,18 @@ gst_mpp_dec_loop (GstVideoDecoder * decoder)
   GST_DEBUG_OBJECT (self, "finish frame ts=%" GST_TIME_FORMAT,
       GST_TIME_ARGS (frame->pts));
 
-  gst_video_decoder_finish_frame (decoder, frame);
+  pts = frame->pts;
+  duration = frame->duration;
+
+  /* Defer finishing until the RGA job is done, in the next iteration */
+  mem = gst_buffer_peek_memory (frame->output_buffer, 0);
+  if (gst_mpp_memory_has_fence (mem))
+    self->pending_frame = frame;
+  else
+    gst_video_decoder_finish_frame (decoder, frame);
+
+  if (klass->output_mpp_frame)
+    klass->output_mpp_frame (decoder, mframe, pts, duration);
 
 out:
   if (mframe) {
@@ -1029,6 +1365,8 @@ out:
   }
 
   if (self->task_ret != GST_FLOW_OK) {
+    gst_mpp_dec_finish_pending (decoder, self->flushing && !self->draining);
+
     GST_DEBUG_OBJECT (self, "leaving output thread: %s",
         gst_flow_get_name (self->task_ret));
 
@@ -1055,6 +1393,74 @@ drop:
   goto out;
 }
 
+static gboolean
+gst_mpp_dec_trickmode_skip (GstVideoDecoder * decoder,
+    GstVideoCodecFrame * frame)
+{
+  GstSegmentFlags flags = decoder->input_segment.flags;
+  GstSegmentFlags skip_flags = GST_SEGMENT_FLAG_TRICKMODE;
+
+  /* Keyframes only */
+  if (flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS)
+    return !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame);
+
+#if GST_CHECK_VERSION(1,18,0)
+  skip_flags |= GST_SEGMENT_FLAG_TRICKMODE_FORWARD_PREDICTED;
+#endif
+
+  /* Skip non-reference frames, nothing depends on them */
+  if (flags & skip_flags)
+    return GST_BUFFER_FLAG_IS_SET (frame->input_buffer,
+        GST_BUFFER_FLAG_DROPPABLE);
+
+  return FALSE;
+}
+
+static gboolean
+gst_mpp_dec_qos_skip (GstVideoDecoder * decoder, GstVideoCodecFrame * frame)
+{
+  GstMppDec *self = GST_MPP_DEC (decoder);
+  GstClockTimeDiff deadline;
+
+  /* Skipping to the next keyframe */
+  if (self->qos_skipping) {
+    if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+      self->dropped_qos_skip++;
+      return TRUE;
+    }
+
+    GST_DEBUG_OBJECT (self, "resume decoding from keyframe");
+    self->qos_skipping = FALSE;
+    return FALSE;
+  }
+
+  deadline = gst_video_decoder_get_max_decode_time (decoder, frame);
+  if (deadline >= 0)
+    return FALSE;
+
+  /* Too late, later frames depending on this would be late too */
+  if (self->qos_skip_threshold && !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)
+      && -deadline > self->qos_skip_threshold * GST_MSECOND) {
+    GST_DEBUG_OBJECT (self, "late for %" GST_STIME_FORMAT
+        ", skipping to the next keyframe", GST_STIME_ARGS (-deadline));
+
+    self->qos_skipping = TRUE;
+    self->dropped_qos_skip++;
+    return TRUE;
+  }
+
+  /* Nothing depends on non-reference frames */
+  if (GST_BUFFER_FLAG_IS_SET (frame->input_buffer, GST_BUFFER_FLAG_DROPPABLE)) {
+    GST_DEBUG_OBJECT (self, "late for %" GST_STIME_FORMAT
+        ", dropping non-reference frame", GST_STIME_ARGS (-deadline));
+
+    self->dropped_qos++;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
 static GstFlowReturn
 gst_mpp_dec_handle_frame (GstVideoDecoder * decoder, GstVideoCodecFrame * frame)
 {
@@ -1074,6 +1480,14 @@ gst_mpp_dec_handle_frame (GstVideoDecoder * decoder, GstVideoCodecFrame * frame)
   if (G_UNLIKELY (self->flushing))
     goto flushing;
 
+  /* Drop frames before submission in trick modes */
+  if (gst_mpp_dec_trickmode_skip (decoder, frame))
+    goto skip;
+
+  /* Drop late frames before submission */
+  if (gst_mpp_dec_qos_skip (decoder, frame))
+    goto qos_drop;
+
   /* Avoid holding too many frames */
   while (1) {
     GList *frames;
@@ -1084,7 +1498,7 @@ gst_mpp_dec_handle_frame (GstVideoDecoder * decoder, GstVideoCodecFrame * frame)
 
     frames = gst_video_decoder_get_frames (decoder);
     if (frames) {
-      busy = g_list_length (frames) >= 10;
+      busy = g_list_length (frames) >= self->max_pending;
       if (busy)
         GST_DEBUG_OBJECT (self, "too many frames");
 
@@ -1100,18 +1514,16 @@ gst_mpp_dec_handle_frame (GstVideoDecoder * decoder, GstVideoCodecFrame * frame)
     GST_VIDEO_DECODER_STREAM_LOCK (decoder);
   }
 
-  if (!self->allocator) {
-    MppBufferGroup group;
+  if (!gst_mpp_dec_ensure_allocator (decoder))
+    goto no_allocator;
 
-    self->allocator = gst_mpp_allocator_new ();
-    if (!self->allocator)
-      goto no_allocator;
+  if (G_UNLIKELY (!GST_MPP_DEC_TASK_STARTED (decoder))) {
+    MppBufferGroup group;
 
+    /* The allocator might be renewed while the task is stopped */
     group = gst_mpp_allocator_get_mpp_group (self->allocator);
-    self->mpi->control (self->mpp_ctx, MPP_DEC_SET_EXT_BUF_GROUP, group);
-  }
+    gst_mpp_dec_set_buffer_group (decoder, group);
 
-  if (G_UNLIKELY (!GST_MPP_DEC_TASK_STARTED (decoder))) {
     if (klass->startup && !klass->startup (decoder))
       goto not_negotiated;
 
@@ -1169,6 +1581,23 @@ flushing:
   GST_WARNING_OBJECT (self, "flushing");
   ret = GST_FLOW_FLUSHING;
   goto drop;
+skip:
+  GST_DEBUG_OBJECT (self, "skipping frame %d in trick mode",
+      frame->system_frame_number);
+  self->dropped_trickmode++;
+  gst_video_decoder_release_frame (decoder, frame);
+
+  GST_MPP_DEC_UNLOCK (decoder);
+
+  return self->task_ret;
+qos_drop:
+  GST_DEBUG_OBJECT (self, "dropping late frame %d",
+      frame->system_frame_number);
+  gst_video_decoder_drop_frame (decoder, frame);
+
+  GST_MPP_DEC_UNLOCK (decoder);
+
+  return self->task_ret;
 no_allocator:
   GST_ERROR_OBJECT (self, "failed to create mpp allocator");
   ret = GST_FLOW_ERROR;
@@ -1221,6 +1650,8 @@ gst_mpp_dec_init (GstMppDec * self)
   self->ignore_error = DEFAULT_PROP_IGNORE_ERROR;
   self->fast_mode = DEFAULT_PROP_FAST_MODE;
   self->dma_feature = DEFAULT_PROP_DMA_FEATURE;
+  self->max_pending = MPP_DEC_MAX_PENDING;
+  self->qos_skip_threshold = DEFAULT_PROP_QOS_SKIP_THRESHOLD;
 
   gst_video_decoder_set_packetized (decoder, TRUE);
 }
@@ -1262,6 +1693,8 @@ gst_mpp_dec_class_init (GstMppDecClass * klass)
   decoder_class->drain = GST_DEBUG_FUNCPTR (gst_mpp_dec_drain);
   decoder_class->finish = GST_DEBUG_FUNCPTR (gst_mpp_dec_finish);
   decoder_class->set_format = GST_DEBUG_FUNCPTR (gst_mpp_dec_set_format);
+  decoder_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_mpp_dec_decide_allocation);
   decoder_class->handle_frame = GST_DEBUG_FUNCPTR (gst_mpp_dec_handle_frame);
 
   gobject_class->set_property = GST_DEBUG_FUNCPTR (gst_mpp_dec_set_property);
@@ -1327,5 +1760,16 @@ no_rga:
           "Enable GST DMA feature", DEFAULT_PROP_DMA_FEATURE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_QOS_SKIP_THRESHOLD,
+      g_param_spec_uint ("qos-skip-threshold", "QoS skip threshold",
+          "Skip to the next keyframe when later than this (ms, 0 = disabled)",
+          0, G_MAXUINT, DEFAULT_PROP_QOS_SKIP_THRESHOLD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Counters of frames dropped before decoding", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   element_class->change_state = GST_DEBUG_FUNCPTR (gst_mpp_dec_change_state);
 }
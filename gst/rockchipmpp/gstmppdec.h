@@ -68,6 +68,21 @@ struct _GstMppDec
 
   gboolean fast_mode;
 
+  /* output frames as soon as decoded */
+  gboolean low_latency;
+
+  /* max number of frames pending in the decoder */
+  guint max_pending;
+
+  /* skip to the next keyframe when later than this (ms) */
+  guint qos_skip_threshold;
+  gboolean qos_skipping;
+
+  /* frames dropped before decoding */
+  guint64 dropped_trickmode;
+  guint64 dropped_qos;
+  guint64 dropped_qos_skip;
+
   /* stop handling new frame when flushing */
   gboolean flushing;
 
@@ -90,6 +105,9 @@ struct _GstMppDec
 
   GstVideoCodecFrame *last_frame;
 
+  /* converted frame waiting for its RGA fence */
+  GstVideoCodecFrame *pending_frame;
+
   GMutex event_mutex;
   GCond event_cond;
 
@@ -109,6 +127,22 @@ struct _GstMppDecClass
       MppPacket mpkt, gint timeout_ms);
     MppFrame (*poll_mpp_frame) (GstVideoDecoder * decoder, gint timeout_ms);
     gboolean (*shutdown) (GstVideoDecoder * decoder, gboolean drain);
+  /* optional, apply to the subclass's extra MPP contexts as well */
+    void (*reset) (GstVideoDecoder * decoder);
+    void (*set_buffer_group) (GstVideoDecoder * decoder,
+      MppBufferGroup group);
+  /* optional, called after finishing each decoded frame */
+    void (*output_mpp_frame) (GstVideoDecoder * decoder, MppFrame mframe,
+      GstClockTime pts, GstClockTime duration);
+  /* optional, called after finishing the frame pending on its RGA job */
+    void (*finish_pending) (GstVideoDecoder * decoder, gboolean drop);
+#ifdef HAVE_RGA
+  /* optional, add more conversions of the frame into the converting job */
+    void (*fill_rga_batch) (GstVideoDecoder * decoder, MppFrame mframe,
+      GstMppRgaBatch * batch);
+  /* optional, drop the conversions added when the job failed */
+    void (*cancel_rga_batch) (GstVideoDecoder * decoder);
+#endif
 };
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (GstMppDec, gst_object_unref);
@@ -116,6 +150,9 @@ GType gst_mpp_dec_get_type (void);
 
 #define GST_FLOW_TIMEOUT GST_FLOW_CUSTOM_ERROR_1
 
+#define MPP_DEC_MAX_PENDING 10  /* Max number of pending frames by default */
+#define MPP_DEC_REORDER_FRAMES 4        /* Typical display-order reordering */
+
 #define MPP_DEC_OUT_FORMATS "NV12, NV16, NV12_10LE40, NV16_10LE40"
 
 #ifdef HAVE_RGA
@@ -26,6 +26,12 @@
 #include "config.h"
 #endif
 
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+#include <jpeglib.h>
+#endif
+
 #include "gstmppallocator.h"
 #include "gstmppjpegdec.h"
 
@@ -35,6 +41,59 @@
 #define GST_CAT_DEFAULT mpp_jpeg_dec_debug
 GST_DEBUG_CATEGORY (GST_CAT_DEFAULT);
 
+#define MPP_JPEG_DEC_MAX_CONTEXTS 4
+
+/* A JPEG frame split into strips at restart-marker boundaries, or decoded
+ * by software */
+typedef struct
+{
+  gint ref_count;
+
+  /* send index of the first strip (or the frame for software decoding) */
+  guint start_index;
+
+  guint n_strips;
+  guint n_sent;
+  guint n_done;
+
+  /* in the output thread's queue, once its sending started */
+  gboolean queued;
+  /* its sending failed, only the sent strips are collected and dropped */
+  gboolean abandoned;
+
+  guint width;
+  guint height;
+
+  /* height of strips, except the last one */
+  guint tile_height;
+
+  MppPacket *packets;
+  MppPacket placeholder;
+
+  /* the frame's PTS, the placeholder is released once sent */
+  gint64 pts;
+
+  /* the full-size output frame */
+  MppFrame mframe;
+  gboolean error;
+
+#ifdef HAVE_RGA
+  /* the output frame's buffer for RGA blitting the strips */
+  GstMemory *out_mem;
+#endif
+
+#ifdef HAVE_LIBJPEG
+  /* software decoding, the data is a copy of the input frame, tiled jobs
+   * keep it as well to retry failed frames by software */
+  gboolean software;
+  guint8 *data;
+  gsize size;
+  GstVideoInfo info;
+  J_COLOR_SPACE color_space;
+  gboolean done;
+#endif
+} GstMppJpegDecJob;
+
 struct _GstMppJpegDec
 {
   GstMppDec parent;
@@ -42,6 +101,51 @@ struct _GstMppJpegDec
   /* size of output buffer */
   guint buf_size;
 
+  /* max number of in-flight decode tasks */
+  guint queue_depth;
+
+  /* preallocated output buffers (allocator index and buffer size) */
+  gint pool_index;
+  guint pool_size;
+
+  /* frame-parallel decoding contexts, the first one is the parent's */
+  guint parallel;
+  guint n_contexts;
+  MppCtx contexts[MPP_JPEG_DEC_MAX_CONTEXTS];
+  MppApi *mpis[MPP_JPEG_DEC_MAX_CONTEXTS];
+
+  /* frames are sent and polled round-robin over the contexts */
+  guint send_index;
+  guint poll_index;
+
+  /* split oversized frames into strips */
+  gboolean tiled;
+  guint tile_height;
+
+  /* frames beyond the hardware size limit, which must be split */
+  gboolean oversized;
+
+  /* tiled and software frames in sending order, protected by job_mutex */
+  GMutex job_mutex;
+  GCond job_cond;
+  GQueue jobs;
+
+  /* tiled (or software) frame being sent */
+  GstMppJpegDecJob *pending_job;
+
+#ifdef HAVE_LIBJPEG
+  /* software decoding fallback, the pool is only created at start */
+  guint sw_threads;
+  GThreadPool *sw_pool;
+
+  /* original output info and libjpeg color space for it */
+  GstVideoInfo sw_info;
+  J_COLOR_SPACE sw_color_space;
+
+  /* no hardware support for the stream */
+  gboolean sw_only;
+#endif
+
   /* group for input packet buffer allocations */
   MppBufferGroup input_group;
 
@@ -51,13 +155,32 @@ struct _GstMppJpegDec
 #define parent_class gst_mpp_jpeg_dec_parent_class
 G_DEFINE_TYPE (GstMppJpegDec, gst_mpp_jpeg_dec, GST_TYPE_MPP_DEC);
 
+#define MPP_JPEG_DEC_EXTRA_BUFFERS 2 /* Output buffers held by downstream */
+
+/* Max frame size of the JPEG hardware */
+#define MPP_JPEG_DEC_MAX_WIDTH 8176
+#define MPP_JPEG_DEC_MAX_HEIGHT 8176
+
 /* Default output format is auto */
 static GstVideoFormat DEFAULT_PROP_FORMAT = GST_VIDEO_FORMAT_UNKNOWN;
 
+#define DEFAULT_PROP_QUEUE_DEPTH 4
+#define DEFAULT_PROP_PARALLEL 1
+#define DEFAULT_PROP_TILED FALSE
+#define DEFAULT_PROP_TILE_HEIGHT 2048
+#define DEFAULT_PROP_SW_THREADS 2
+
 enum
 {
   PROP_0,
   PROP_FORMAT,
+  PROP_QUEUE_DEPTH,
+  PROP_PARALLEL,
+  PROP_TILED,
+  PROP_TILE_HEIGHT,
+#ifdef HAVE_LIBJPEG
+  PROP_SW_THREADS,
+#endif
   PROP_LAST,
 };
 
@@ -99,8 +222,10 @@ static GstVideoFormat
 gst_mpp_jpeg_dec_try_pp_convert (GstVideoDecoder * decoder,
     GstVideoFormat format, gboolean force)
 {
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
   GstMppDec *mppdec = GST_MPP_DEC (decoder);
   MppFrameFormat mpp_format = force ? MPP_FMT_YUV420SP : MPP_FMT_BUTT;
+  MppFrameFormat tmp_format;
   guint i;
 
   for (i = 0; i < ARRAY_SIZE (gst_mpp_jpeg_dec_pp_formats); i++) {
@@ -113,8 +238,16 @@ gst_mpp_jpeg_dec_try_pp_convert (GstVideoDecoder * decoder,
   /* Using MPP internal format conversion (PP) */
   if (mpp_format != MPP_FMT_BUTT) {
     if (mppdec->mpi->control (mppdec->mpp_ctx, MPP_DEC_SET_OUTPUT_FORMAT,
-            &mpp_format) >= 0)
+            &mpp_format) >= 0) {
+      /* Frame-parallel contexts should provide the same format */
+      for (i = 1; i < self->n_contexts; i++) {
+        tmp_format = mpp_format;
+        self->mpis[i]->control (self->contexts[i], MPP_DEC_SET_OUTPUT_FORMAT,
+            &tmp_format);
+      }
+
       return gst_mpp_mpp_format_to_gst_format (mpp_format);
+    }
   }
 
   return GST_VIDEO_FORMAT_UNKNOWN;
@@ -146,6 +279,43 @@ gst_mpp_jpeg_dec_set_property (GObject * object,
         mppdec->format = g_value_get_enum (value);
       break;
     }
+    case PROP_QUEUE_DEPTH:{
+      GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+
+      if (mppdec->input_state) {
+        GST_WARNING_OBJECT (decoder, "unable to change queue depth");
+      } else {
+        self->queue_depth = g_value_get_uint (value);
+        /* The frame being handled counts as pending too */
+        mppdec->max_pending = self->queue_depth + 1;
+      }
+      break;
+    }
+    case PROP_PARALLEL:{
+      GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+
+      if (mppdec->input_state)
+        GST_WARNING_OBJECT (decoder, "unable to change parallel contexts");
+      else
+        self->parallel = g_value_get_uint (value);
+      break;
+    }
+    case PROP_TILED:
+      GST_MPP_JPEG_DEC (decoder)->tiled = g_value_get_boolean (value);
+      break;
+    case PROP_TILE_HEIGHT:
+      GST_MPP_JPEG_DEC (decoder)->tile_height = g_value_get_uint (value);
+      break;
+#ifdef HAVE_LIBJPEG
+    case PROP_SW_THREADS:{
+      GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+
+      self->sw_threads = g_value_get_uint (value);
+      if (self->sw_pool && self->sw_threads)
+        g_thread_pool_set_max_threads (self->sw_pool, self->sw_threads, NULL);
+      break;
+    }
+#endif
 
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -164,12 +334,486 @@ gst_mpp_jpeg_dec_get_property (GObject * object,
     case PROP_FORMAT:
       g_value_set_enum (value, mppdec->format);
       break;
+    case PROP_QUEUE_DEPTH:
+      g_value_set_uint (value, GST_MPP_JPEG_DEC (decoder)->queue_depth);
+      break;
+    case PROP_PARALLEL:
+      g_value_set_uint (value, GST_MPP_JPEG_DEC (decoder)->parallel);
+      break;
+    case PROP_TILED:
+      g_value_set_boolean (value, GST_MPP_JPEG_DEC (decoder)->tiled);
+      break;
+    case PROP_TILE_HEIGHT:
+      g_value_set_uint (value, GST_MPP_JPEG_DEC (decoder)->tile_height);
+      break;
+#ifdef HAVE_LIBJPEG
+    case PROP_SW_THREADS:
+      g_value_set_uint (value, GST_MPP_JPEG_DEC (decoder)->sw_threads);
+      break;
+#endif
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+static void
+gst_mpp_jpeg_dec_job_unref (GstMppJpegDecJob * job)
+{
+  guint i;
+
+  if (!g_atomic_int_dec_and_test (&job->ref_count))
+    return;
+
+  /* The sent packets are owned by the MPP */
+  for (i = job->n_sent; i < job->n_strips; i++)
+    mpp_packet_deinit (&job->packets[i]);
+
+  if (job->mframe)
+    mpp_frame_deinit (&job->mframe);
+
+#ifdef HAVE_RGA
+  if (job->out_mem)
+    gst_memory_unref (job->out_mem);
+#endif
+
+#ifdef HAVE_LIBJPEG
+  g_free (job->data);
+#endif
+
+  g_free (job->packets);
+  g_free (job);
+}
+
+#ifdef HAVE_LIBJPEG
+struct gst_mpp_jpeg_error_mgr
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+
+static void
+gst_mpp_jpeg_dec_sw_error_exit (j_common_ptr cinfo)
+{
+  struct gst_mpp_jpeg_error_mgr *err =
+      (struct gst_mpp_jpeg_error_mgr *) cinfo->err;
+  gchar msg[JMSG_LENGTH_MAX];
+
+  cinfo->err->format_message (cinfo, msg);
+  GST_WARNING ("libjpeg error: %s", msg);
+
+  longjmp (err->setjmp_buffer, 1);
+}
+
+static void
+gst_mpp_jpeg_dec_sw_output_message (j_common_ptr cinfo)
+{
+  gchar msg[JMSG_LENGTH_MAX];
+
+  cinfo->err->format_message (cinfo, msg);
+  GST_DEBUG ("libjpeg: %s", msg);
+}
+
+static J_COLOR_SPACE
+gst_mpp_jpeg_dec_sw_color_space (GstVideoFormat format)
+{
+  switch (format) {
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV16:
+      /* Converted from YCbCr scanlines */
+      return JCS_YCbCr;
+#ifdef JCS_EXTENSIONS
+    case GST_VIDEO_FORMAT_RGBx:
+      return JCS_EXT_RGBX;
+    case GST_VIDEO_FORMAT_BGRx:
+      return JCS_EXT_BGRX;
+    case GST_VIDEO_FORMAT_xRGB:
+      return JCS_EXT_XRGB;
+    case GST_VIDEO_FORMAT_xBGR:
+      return JCS_EXT_XBGR;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+    case GST_VIDEO_FORMAT_RGB16:
+      return JCS_RGB565;
+#endif
+#endif
+#ifdef JCS_ALPHA_EXTENSIONS
+    case GST_VIDEO_FORMAT_RGBA:
+      return JCS_EXT_RGBA;
+    case GST_VIDEO_FORMAT_BGRA:
+      return JCS_EXT_BGRA;
+    case GST_VIDEO_FORMAT_ARGB:
+      return JCS_EXT_ARGB;
+    case GST_VIDEO_FORMAT_ABGR:
+      return JCS_EXT_ABGR;
+#endif
+    default:
+      return JCS_UNKNOWN;
+  }
+}
+
+/* Write a YCbCr (or grayscale) scanline into semi-planar YUV */
+static void
+gst_mpp_jpeg_dec_sw_write_yuv (GstVideoInfo * info, guint8 * dst,
+    const guint8 * row, guint components, guint y)
+{
+  guint8 *dst_y, *dst_uv;
+  guint width = GST_VIDEO_INFO_WIDTH (info);
+  guint x;
+
+  dst_y = dst + GST_VIDEO_INFO_PLANE_OFFSET (info, 0) +
+      y * GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+
+  for (x = 0; x < width; x++)
+    dst_y[x] = row[x * components];
+
+  /* Subsample chroma from even rows for 4:2:0 */
+  if (GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_NV12) {
+    if (y % 2)
+      return;
+
+    y /= 2;
+  }
+
+  dst_uv = dst + GST_VIDEO_INFO_PLANE_OFFSET (info, 1) +
+      y * GST_VIDEO_INFO_PLANE_STRIDE (info, 1);
+
+  if (components == 1) {
+    memset (dst_uv, 0x80, GST_ROUND_UP_2 (width));
+    return;
+  }
+
+  for (x = 0; x + 1 < width; x += 2) {
+    dst_uv[x] = (row[x * 3 + 1] + row[x * 3 + 4] + 1) / 2;
+    dst_uv[x + 1] = (row[x * 3 + 2] + row[x * 3 + 5] + 1) / 2;
+  }
+
+  if (x < width) {
+    dst_uv[x] = row[x * 3 + 1];
+    dst_uv[x + 1] = row[x * 3 + 2];
+  }
+}
+
+static gboolean
+gst_mpp_jpeg_dec_sw_decode_frame (GstMppJpegDecJob * job)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct gst_mpp_jpeg_error_mgr jerr;
+  GstVideoInfo *info = &job->info;
+  gboolean yuv = job->color_space == JCS_YCbCr;
+  guint8 *dst = mpp_buffer_get_ptr (mpp_frame_get_buffer (job->mframe));
+  guint8 *volatile row = NULL;
+  JSAMPROW line;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit = gst_mpp_jpeg_dec_sw_error_exit;
+  jerr.pub.output_message = gst_mpp_jpeg_dec_sw_output_message;
+
+  if (setjmp (jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress (&cinfo);
+    g_free (row);
+    return FALSE;
+  }
+
+  jpeg_create_decompress (&cinfo);
+  jpeg_mem_src (&cinfo, job->data, job->size);
+  jpeg_read_header (&cinfo, TRUE);
+
+  if ((gint) cinfo.image_width != GST_VIDEO_INFO_WIDTH (info) ||
+      (gint) cinfo.image_height != GST_VIDEO_INFO_HEIGHT (info)) {
+    GST_WARNING ("unexpected size %dx%d", cinfo.image_width,
+        cinfo.image_height);
+    jpeg_destroy_decompress (&cinfo);
+    return FALSE;
+  }
+
+  cinfo.out_color_space = job->color_space;
+  if (yuv && cinfo.jpeg_color_space == JCS_GRAYSCALE)
+    cinfo.out_color_space = JCS_GRAYSCALE;
+
+  cinfo.dct_method = JDCT_IFAST;
+
+  jpeg_start_decompress (&cinfo);
+
+  if (yuv)
+    row = g_malloc (cinfo.output_width * cinfo.output_components);
+
+  while (cinfo.output_scanline < cinfo.output_height) {
+    guint y = cinfo.output_scanline;
+
+    if (yuv) {
+      line = row;
+      jpeg_read_scanlines (&cinfo, &line, 1);
+
+      gst_mpp_jpeg_dec_sw_write_yuv (info, dst, row,
+          cinfo.output_components, y);
+    } else {
+      line = dst + y * GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+      jpeg_read_scanlines (&cinfo, &line, 1);
+    }
+  }
+
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+
+  g_free (row);
+  return TRUE;
+}
+
+static void
+gst_mpp_jpeg_dec_sw_decode (GstMppJpegDecJob * job, GstMppJpegDec * self)
+{
+  gboolean ret;
+
+  ret = gst_mpp_jpeg_dec_sw_decode_frame (job);
+
+  g_mutex_lock (&self->job_mutex);
+  job->error = !ret;
+  job->done = TRUE;
+  g_cond_broadcast (&self->job_cond);
+  g_mutex_unlock (&self->job_mutex);
+
+  gst_mpp_jpeg_dec_job_unref (job);
+}
+
+/* Find the SOF marker for the coding process */
+static guint8
+gst_mpp_jpeg_dec_get_sof_marker (const guint8 * data, gsize size)
+{
+  gsize pos;
+
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return 0;
+
+  for (pos = 2; pos + 4 <= size;) {
+    guint8 marker;
+
+    if (data[pos] != 0xFF)
+      return 0;
+
+    marker = data[pos + 1];
+    if (marker == 0xFF) {
+      pos++;
+      continue;
+    }
+
+    switch (marker) {
+      case 0xC0 ... 0xC3:
+      case 0xC5 ... 0xC7:
+      case 0xC9 ... 0xCB:
+      case 0xCD ... 0xCF:
+        return marker;
+      case 0xDA:
+        return 0;
+      default:
+        break;
+    }
+
+    pos += 2 + GST_READ_UINT16_BE (data + pos + 2);
+  }
+
+  return 0;
+}
+
+static GstMppJpegDecJob *
+gst_mpp_jpeg_dec_new_sw_job (GstVideoDecoder * decoder,
+    const guint8 * data, gsize size)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  GstMppJpegDecJob *job;
+  guint8 marker;
+
+  if (!self->sw_pool || self->sw_color_space == JCS_UNKNOWN)
+    return NULL;
+
+  if (!self->sw_only) {
+    /* The hardware supports baseline and extended Huffman only */
+    marker = gst_mpp_jpeg_dec_get_sof_marker (data, size);
+    if (!marker || marker == 0xC0 || marker == 0xC1)
+      return NULL;
+
+    GST_DEBUG_OBJECT (self, "software decoding for SOF%d", marker - 0xC0);
+  }
+
+  job = g_new0 (GstMppJpegDecJob, 1);
+  job->ref_count = 1;
+  job->software = TRUE;
+  job->info = self->sw_info;
+  job->color_space = self->sw_color_space;
+  job->width = GST_VIDEO_INFO_WIDTH (&job->info);
+  job->height = GST_VIDEO_INFO_HEIGHT (&job->info);
+
+  job->data = g_malloc (size);
+  job->size = size;
+  memcpy (job->data, data, size);
+
+  return job;
+}
+
+static gboolean
+gst_mpp_jpeg_dec_sw_alloc_frame (GstVideoDecoder * decoder,
+    GstMppJpegDecJob * job)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  GstMppDec *mppdec = GST_MPP_DEC (decoder);
+  GstVideoInfo *info = &job->info;
+  GstVideoFormat format = GST_VIDEO_INFO_FORMAT (info);
+  MppBuffer mbuf;
+
+  mbuf = gst_mpp_allocator_alloc_mppbuf (mppdec->allocator, self->buf_size);
+  if (G_UNLIKELY (!mbuf))
+    return FALSE;
+
+  /* Provide the same layout as the hardware output */
+  mpp_frame_init (&job->mframe);
+  mpp_frame_set_fmt (job->mframe, gst_mpp_gst_format_to_mpp_format (format));
+  mpp_frame_set_width (job->mframe, job->width);
+  mpp_frame_set_height (job->mframe, job->height);
+  mpp_frame_set_hor_stride (job->mframe, GST_MPP_VIDEO_INFO_HSTRIDE (info));
+  mpp_frame_set_hor_stride_pixel (job->mframe,
+      gst_mpp_get_pixel_stride (info));
+  mpp_frame_set_ver_stride (job->mframe, GST_MPP_VIDEO_INFO_VSTRIDE (info));
+  mpp_frame_set_pts (job->mframe, job->pts);
+  mpp_frame_set_buffer (job->mframe, mbuf);
+  mpp_buffer_put (mbuf);
+
+  return TRUE;
+}
+
+static gboolean
+gst_mpp_jpeg_dec_send_sw_job (GstVideoDecoder * decoder,
+    GstMppJpegDecJob * job)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+
+  job->pts = mpp_packet_get_pts (job->placeholder);
+
+  if (!gst_mpp_jpeg_dec_sw_alloc_frame (decoder, job))
+    return FALSE;
+
+  job->start_index = self->send_index;
+
+  g_atomic_int_inc (&job->ref_count);
+
+  g_mutex_lock (&self->job_mutex);
+  g_queue_push_tail (&self->jobs, job);
+  g_mutex_unlock (&self->job_mutex);
+
+  g_atomic_int_inc (&job->ref_count);
+  g_thread_pool_push (self->sw_pool, job, NULL);
+
+  return TRUE;
+}
+
+static MppFrame
+gst_mpp_jpeg_dec_poll_sw_job (GstVideoDecoder * decoder,
+    GstMppJpegDecJob * job, gint timeout_ms)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  MppFrame mframe;
+  gint64 end_time;
+
+  end_time = g_get_monotonic_time () + timeout_ms * G_TIME_SPAN_MILLISECOND;
+
+  g_mutex_lock (&self->job_mutex);
+  while (!job->done) {
+    if (timeout_ms < 0) {
+      g_cond_wait (&self->job_cond, &self->job_mutex);
+    } else if (!timeout_ms ||
+        !g_cond_wait_until (&self->job_cond, &self->job_mutex, end_time)) {
+      g_mutex_unlock (&self->job_mutex);
+      return NULL;
+    }
+  }
+
+  g_queue_pop_head (&self->jobs);
+  g_mutex_unlock (&self->job_mutex);
+
+  mframe = job->mframe;
+  job->mframe = NULL;
+
+  if (job->error)
+    mpp_frame_set_errinfo (mframe, 1);
+
+  gst_mpp_jpeg_dec_job_unref (job);
+  return mframe;
+}
+
+/* Decode the frame of a failed tiled job by software instead */
+static gboolean
+gst_mpp_jpeg_dec_retry_sw_job (GstVideoDecoder * decoder,
+    GstMppJpegDecJob * job)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+
+  if (!job->data)
+    return FALSE;
+
+  if (job->mframe)
+    mpp_frame_deinit (&job->mframe);
+
+#ifdef HAVE_RGA
+  if (job->out_mem) {
+    gst_memory_unref (job->out_mem);
+    job->out_mem = NULL;
+  }
+#endif
+
+  if (!gst_mpp_jpeg_dec_sw_alloc_frame (decoder, job))
+    return FALSE;
+
+  GST_WARNING_OBJECT (self, "hardware failed, decoding frame by software");
+
+  g_mutex_lock (&self->job_mutex);
+  job->software = TRUE;
+  job->error = FALSE;
+  job->done = FALSE;
+  g_mutex_unlock (&self->job_mutex);
+
+  g_atomic_int_inc (&job->ref_count);
+  g_thread_pool_push (self->sw_pool, job, NULL);
+
+  return TRUE;
+}
+#endif
+
+/* Drop the leftover of a failed sending */
+static void
+gst_mpp_jpeg_dec_drop_pending_job (GstVideoDecoder * decoder)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  GstMppJpegDecJob *job = self->pending_job;
+
+  if (!job)
+    return;
+
+  self->pending_job = NULL;
+
+  /* Otherwise the next frames' tasks would be taken for its strips */
+  g_mutex_lock (&self->job_mutex);
+  job->abandoned = TRUE;
+  g_cond_broadcast (&self->job_cond);
+  g_mutex_unlock (&self->job_mutex);
+
+  gst_mpp_jpeg_dec_job_unref (job);
+}
+
+static void
+gst_mpp_jpeg_dec_clear_jobs (GstVideoDecoder * decoder)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  GstMppJpegDecJob *job;
+
+  if (self->pending_job) {
+    gst_mpp_jpeg_dec_job_unref (self->pending_job);
+    self->pending_job = NULL;
+  }
+
+  g_mutex_lock (&self->job_mutex);
+  while ((job = g_queue_pop_head (&self->jobs)))
+    gst_mpp_jpeg_dec_job_unref (job);
+  g_mutex_unlock (&self->job_mutex);
+}
+
 static gboolean
 gst_mpp_jpeg_dec_start (GstVideoDecoder * decoder)
 {
@@ -199,6 +843,22 @@ gst_mpp_jpeg_dec_start (GstVideoDecoder * decoder)
 
   mppdec->mpp_type = MPP_VIDEO_CodingMJPEG;
 
+  self->pool_index = -1;
+  self->pool_size = 0;
+
+  self->n_contexts = 1;
+  self->contexts[0] = mppdec->mpp_ctx;
+  self->mpis[0] = mppdec->mpi;
+
+  self->send_index = 0;
+  self->poll_index = 0;
+
+#ifdef HAVE_LIBJPEG
+  if (self->sw_threads)
+    self->sw_pool = g_thread_pool_new ((GFunc) gst_mpp_jpeg_dec_sw_decode,
+        self, self->sw_threads, FALSE, NULL);
+#endif
+
   GST_DEBUG_OBJECT (self, "started");
 
   return TRUE;
@@ -209,11 +869,28 @@ gst_mpp_jpeg_dec_stop (GstVideoDecoder * decoder)
 {
   GstVideoDecoderClass *pclass = GST_VIDEO_DECODER_CLASS (parent_class);
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  guint i;
 
   GST_DEBUG_OBJECT (self, "stopping");
 
   pclass->stop (decoder);
 
+#ifdef HAVE_LIBJPEG
+  if (self->sw_pool) {
+    /* Wait for the queued software decoding */
+    g_thread_pool_free (self->sw_pool, FALSE, TRUE);
+    self->sw_pool = NULL;
+  }
+#endif
+
+  gst_mpp_jpeg_dec_clear_jobs (decoder);
+
+  for (i = 1; i < self->n_contexts; i++) {
+    mpp_destroy (self->contexts[i]);
+    self->contexts[i] = NULL;
+  }
+  self->n_contexts = 1;
+
   mpp_packet_deinit (&self->eos_packet);
   mpp_buffer_group_put (self->input_group);
 
@@ -222,6 +899,41 @@ gst_mpp_jpeg_dec_stop (GstVideoDecoder * decoder)
   return TRUE;
 }
 
+static void
+gst_mpp_jpeg_dec_init_contexts (GstVideoDecoder * decoder)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  GstMppDec *mppdec = GST_MPP_DEC (decoder);
+  MppCtx ctx;
+  MppApi *mpi;
+
+  while (self->n_contexts < self->parallel) {
+    if (mpp_create (&ctx, &mpi))
+      break;
+
+    /* NOTE: MPP fast mode must be applied before mpp_init() */
+    mpi->control (ctx, MPP_DEC_SET_PARSER_FAST_MODE, &mppdec->fast_mode);
+
+    if (mpp_init (ctx, MPP_CTX_DEC, mppdec->mpp_type)) {
+      mpp_destroy (ctx);
+      break;
+    }
+
+    if (mppdec->ignore_error)
+      mpi->control (ctx, MPP_DEC_SET_DISABLE_ERROR, NULL);
+
+    self->contexts[self->n_contexts] = ctx;
+    self->mpis[self->n_contexts] = mpi;
+    self->n_contexts++;
+  }
+
+  if (self->n_contexts < self->parallel)
+    GST_WARNING_OBJECT (self, "only %d of %d contexts available",
+        self->n_contexts, self->parallel);
+
+  GST_DEBUG_OBJECT (self, "decoding with %d contexts", self->n_contexts);
+}
+
 static gboolean
 gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
     GstVideoCodecState * state)
@@ -236,6 +948,7 @@ gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
   gint height = GST_VIDEO_INFO_HEIGHT (&state->info);
   gint dst_width, dst_height;
   guint align = GST_MPP_ALIGNMENT;
+  gboolean first = !mppdec->input_state;
 
   if (!width || !height) {
     if (self->buf_size) {
@@ -247,9 +960,40 @@ gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
     }
   }
 
-  if (!pclass->set_format (decoder, state))
-    return FALSE;
-
+  if (!pclass->set_format (decoder, state))
+    return FALSE;
+
+  if (first)
+    gst_mpp_jpeg_dec_init_contexts (decoder);
+
+#ifdef HAVE_LIBJPEG
+  self->sw_only = FALSE;
+#endif
+
+  /* Frames beyond the hardware limit are split into strips, which only
+   * works for the height */
+  self->oversized = width > MPP_JPEG_DEC_MAX_WIDTH ||
+      height > MPP_JPEG_DEC_MAX_HEIGHT;
+  if (self->oversized) {
+    if (width <= MPP_JPEG_DEC_MAX_WIDTH) {
+      GST_INFO_OBJECT (self, "splitting oversized %dx%d frames", width,
+          height);
+    } else {
+#ifdef HAVE_LIBJPEG
+      if (self->sw_pool) {
+        GST_INFO_OBJECT (self, "software decoding for oversized %dx%d",
+            width, height);
+        self->sw_only = TRUE;
+      } else
+#endif
+      {
+        GST_ERROR_OBJECT (self, "%dx%d exceeds the hardware limit (%dx%d)",
+            width, height, MPP_JPEG_DEC_MAX_WIDTH, MPP_JPEG_DEC_MAX_HEIGHT);
+        return FALSE;
+      }
+    }
+  }
+
   /* Figure out original output format */
   structure = gst_caps_get_structure (state->caps, 0);
   src_format = gst_mpp_jpeg_dec_get_format (structure);
@@ -282,6 +1026,13 @@ gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
     if (src_format == GST_VIDEO_FORMAT_UNKNOWN) {
       /* PP conversion is required for unknown formats */
       pp_format = gst_mpp_jpeg_dec_try_pp_convert (decoder, dst_format, TRUE);
+#ifdef HAVE_LIBJPEG
+      if (pp_format == GST_VIDEO_FORMAT_UNKNOWN && self->sw_pool) {
+        GST_INFO_OBJECT (self, "fallback to software decoding");
+        pp_format = GST_VIDEO_FORMAT_NV12;
+        self->sw_only = TRUE;
+      }
+#endif
       if (pp_format == GST_VIDEO_FORMAT_UNKNOWN) {
         GST_ERROR_OBJECT (self, "unsupported video format");
         return FALSE;
@@ -318,15 +1069,254 @@ gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
 
   self->buf_size = GST_VIDEO_INFO_SIZE (info);
 
-  /* FIXME: Workaround MPP's JPEG parser size requirement issue (w * h * 2) */
-  self->buf_size =
-      MAX (self->buf_size, GST_VIDEO_INFO_PLANE_OFFSET (info, 1) * 2);
+#ifdef HAVE_LIBJPEG
+  self->sw_info = *info;
+  self->sw_color_space = gst_mpp_jpeg_dec_sw_color_space (src_format);
+#endif
+
+  /* FIXME: Workaround MPP's JPEG parser size requirement issue (w * h * 2),
+   * oversized frames only reach the parser as strips */
+  if (!self->oversized)
+    self->buf_size =
+        MAX (self->buf_size, GST_VIDEO_INFO_PLANE_OFFSET (info, 1) * 2);
 
   /* Update final output info */
   return gst_mpp_dec_update_simple_video_info (decoder, dst_format,
       dst_width, dst_height, align);
 }
 
+static MppPacket
+gst_mpp_jpeg_dec_new_strip_packet (GstVideoDecoder * decoder,
+    const guint8 * data, gsize header_size, gsize sof_offset, guint height,
+    GArray * intervals, guint first, guint count)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  MppBuffer mbuf = NULL;
+  MppPacket mpkt = NULL;
+  guint8 *ptr;
+  gsize size, offset;
+  guint i;
+
+  size = header_size;
+  for (i = first; i < first + count; i++)
+    size += g_array_index (intervals, gsize, i * 2 + 1) -
+        g_array_index (intervals, gsize, i * 2) + 2;
+
+  mpp_buffer_get (self->input_group, &mbuf, size);
+  if (G_UNLIKELY (!mbuf))
+    return NULL;
+
+  ptr = mpp_buffer_get_ptr (mbuf);
+
+  /* Headers with the strip's height in SOF */
+  memcpy (ptr, data, header_size);
+  GST_WRITE_UINT16_BE (ptr + sof_offset + 5, height);
+  offset = header_size;
+
+  /* Restart intervals with renumbered RST markers and the final EOI */
+  for (i = 0; i < count; i++) {
+    gsize start = g_array_index (intervals, gsize, (first + i) * 2);
+    gsize end = g_array_index (intervals, gsize, (first + i) * 2 + 1);
+
+    memcpy (ptr + offset, data + start, end - start);
+    offset += end - start;
+
+    ptr[offset++] = 0xFF;
+    ptr[offset++] = i + 1 < count ? 0xD0 + i % 8 : 0xD9;
+  }
+
+  mpp_packet_init_with_buffer (&mpkt, mbuf);
+  mpp_buffer_put (mbuf);
+  if (G_UNLIKELY (!mpkt))
+    return NULL;
+
+  mpp_packet_set_size (mpkt, size);
+  mpp_packet_set_length (mpkt, size);
+
+  return mpkt;
+}
+
+static GstMppJpegDecJob *
+gst_mpp_jpeg_dec_new_tile_job (GstVideoDecoder * decoder,
+    const guint8 * data, gsize size)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  GstMppJpegDecJob *job = NULL;
+  GArray *intervals = NULL;
+  gsize pos, start, header_size = 0, sof_offset = 0;
+  guint width, height, ri = 0, max_h = 1, max_v = 1;
+  guint mcu_w, mcu_h, mcus_per_row, mcu_rows, rows, total, n_intervals;
+  guint i, nf, tile_height = self->tile_height;
+
+  /* Strips of oversized frames must fit the hardware */
+  if (self->oversized)
+    tile_height = MIN (tile_height, MPP_JPEG_DEC_MAX_HEIGHT);
+
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return NULL;
+
+  /* Parse headers until the SOS */
+  for (pos = 2; !header_size && pos + 4 <= size;) {
+    guint8 marker;
+    guint len;
+
+    if (data[pos] != 0xFF)
+      return NULL;
+
+    marker = data[pos + 1];
+    if (marker == 0xFF) {
+      /* Fill bytes */
+      pos++;
+      continue;
+    }
+
+    len = GST_READ_UINT16_BE (data + pos + 2);
+    if (len < 2 || pos + 2 + len > size)
+      return NULL;
+
+    switch (marker) {
+      case 0xC0:
+      case 0xC1:
+        sof_offset = pos;
+        break;
+      case 0xC2:
+      case 0xC3:
+      case 0xC5 ... 0xC7:
+      case 0xC9 ... 0xCB:
+      case 0xCD ... 0xCF:
+        /* Only baseline and extended sequential are splittable */
+        return NULL;
+      case 0xDD:
+        if (len >= 4)
+          ri = GST_READ_UINT16_BE (data + pos + 4);
+        break;
+      case 0xDA:
+        header_size = pos + 2 + len;
+        break;
+      default:
+        break;
+    }
+
+    pos += 2 + len;
+  }
+
+  if (!sof_offset || !header_size)
+    return NULL;
+
+  height = GST_READ_UINT16_BE (data + sof_offset + 5);
+  width = GST_READ_UINT16_BE (data + sof_offset + 7);
+  nf = data[sof_offset + 9];
+
+  if (!width || height <= tile_height)
+    return NULL;
+
+  if (!ri) {
+    GST_WARNING_OBJECT (self, "unable to split frame without restart markers");
+    return NULL;
+  }
+
+  if (sof_offset + 10 + nf * 3 > header_size)
+    return NULL;
+
+  /* Non-interleaved scans use 8x8 MCUs */
+  for (i = 0; nf > 1 && i < nf; i++) {
+    guint8 sampling = data[sof_offset + 10 + i * 3 + 1];
+
+    max_h = MAX (max_h, sampling >> 4);
+    max_v = MAX (max_v, sampling & 0xF);
+  }
+
+  mcu_w = 8 * max_h;
+  mcu_h = 8 * max_v;
+  mcus_per_row = (width + mcu_w - 1) / mcu_w;
+  mcu_rows = (height + mcu_h - 1) / mcu_h;
+
+  /* Strips must end at restart interval boundaries */
+  for (rows = tile_height / mcu_h; rows; rows--) {
+    if (!(rows * mcus_per_row % ri))
+      break;
+  }
+
+  if (!rows) {
+    GST_WARNING_OBJECT (self, "unable to split %d MCUs per row with "
+        "restart interval %d", mcus_per_row, ri);
+    return NULL;
+  }
+
+  total = (mcus_per_row * mcu_rows + ri - 1) / ri;
+
+  /* Find the [start, end) of restart intervals */
+  intervals = g_array_sized_new (FALSE, FALSE, sizeof (gsize), total * 2);
+  for (start = pos = header_size; pos + 1 < size; pos++) {
+    guint8 marker;
+
+    if (data[pos] != 0xFF)
+      continue;
+
+    marker = data[pos + 1];
+    if (marker >= 0xD0 && marker <= 0xD7) {
+      g_array_append_val (intervals, start);
+      g_array_append_val (intervals, pos);
+      start = ++pos + 1;
+    } else if (marker == 0xD9) {
+      g_array_append_val (intervals, start);
+      g_array_append_val (intervals, pos);
+      break;
+    }
+  }
+
+  n_intervals = intervals->len / 2;
+  if (n_intervals != total) {
+    GST_WARNING_OBJECT (self, "got %d restart intervals, expected %d",
+        n_intervals, total);
+    goto out;
+  }
+
+  job = g_new0 (GstMppJpegDecJob, 1);
+  job->ref_count = 1;
+  job->width = width;
+  job->height = height;
+  job->tile_height = rows * mcu_h;
+  job->n_strips = (mcu_rows + rows - 1) / rows;
+  job->packets = g_new0 (MppPacket, job->n_strips);
+
+  for (i = 0; i < job->n_strips; i++) {
+    guint first = i * rows * mcus_per_row / ri;
+    guint count = MIN (rows * mcus_per_row / ri, n_intervals - first);
+    guint strip_height = MIN (job->tile_height, height - i * job->tile_height);
+
+    job->packets[i] = gst_mpp_jpeg_dec_new_strip_packet (decoder, data,
+        header_size, sof_offset, strip_height, intervals, first, count);
+    if (!job->packets[i]) {
+      GST_WARNING_OBJECT (self, "failed to prepare strip %d", i);
+
+      /* Unref would release all of the packets */
+      job->n_strips = i;
+      gst_mpp_jpeg_dec_job_unref (job);
+      job = NULL;
+      goto out;
+    }
+  }
+
+  GST_DEBUG_OBJECT (self, "splitting %dx%d into %d strips of %d rows",
+      width, height, job->n_strips, job->tile_height);
+
+#ifdef HAVE_LIBJPEG
+  if (self->sw_pool && self->sw_color_space != JCS_UNKNOWN) {
+    job->info = self->sw_info;
+    job->color_space = self->sw_color_space;
+
+    job->data = g_malloc (size);
+    job->size = size;
+    memcpy (job->data, data, size);
+  }
+#endif
+
+out:
+  g_array_unref (intervals);
+  return job;
+}
+
 static MppPacket
 gst_mpp_jpeg_dec_get_mpp_packet (GstVideoDecoder * decoder,
     GstMapInfo * mapinfo)
@@ -335,6 +1325,47 @@ gst_mpp_jpeg_dec_get_mpp_packet (GstVideoDecoder * decoder,
   MppBuffer mbuf = NULL;
   MppPacket mpkt = NULL;
 
+  gst_mpp_jpeg_dec_drop_pending_job (decoder);
+
+#ifdef HAVE_LIBJPEG
+  self->pending_job = gst_mpp_jpeg_dec_new_sw_job (decoder, mapinfo->data,
+      mapinfo->size);
+  if (self->pending_job) {
+    GstMppJpegDecJob *job = self->pending_job;
+
+    /* An empty packet to carry the PTS for the software decoding */
+    mpp_packet_init (&job->placeholder, NULL, 0);
+    if (G_UNLIKELY (!job->placeholder)) {
+      gst_mpp_jpeg_dec_job_unref (job);
+      self->pending_job = NULL;
+      return NULL;
+    }
+
+    return job->placeholder;
+  }
+#endif
+
+  if (self->tiled || self->oversized) {
+    GstMppJpegDecJob *job;
+
+    job = gst_mpp_jpeg_dec_new_tile_job (decoder, mapinfo->data,
+        mapinfo->size);
+    if (!job && self->oversized)
+      GST_WARNING_OBJECT (self, "unable to split oversized frame");
+
+    if (job) {
+      /* An empty packet to carry the PTS for the strips */
+      mpp_packet_init (&job->placeholder, NULL, 0);
+      if (G_UNLIKELY (!job->placeholder)) {
+        gst_mpp_jpeg_dec_job_unref (job);
+        return NULL;
+      }
+
+      self->pending_job = job;
+      return job->placeholder;
+    }
+  }
+
   mpp_buffer_get (self->input_group, &mbuf, mapinfo->size);
   if (G_UNLIKELY (!mbuf))
     return NULL;
@@ -354,8 +1385,8 @@ gst_mpp_jpeg_dec_get_mpp_packet (GstVideoDecoder * decoder,
 }
 
 static gboolean
-gst_mpp_jpeg_dec_send_mpp_packet (GstVideoDecoder * decoder,
-    MppPacket mpkt, gint timeout_ms)
+gst_mpp_jpeg_dec_send_task (GstVideoDecoder * decoder, MppPacket mpkt,
+    gsize buf_size, gint timeout_ms)
 {
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
   GstMppDec *mppdec = GST_MPP_DEC (decoder);
@@ -363,15 +1394,17 @@ gst_mpp_jpeg_dec_send_mpp_packet (GstVideoDecoder * decoder,
   MppFrame mframe = NULL;
   MppTask mtask = NULL;
   MppMeta meta;
+  MppCtx ctx = self->contexts[self->send_index % self->n_contexts];
+  MppApi *mpi = self->mpis[self->send_index % self->n_contexts];
 
-  mppdec->mpi->poll (mppdec->mpp_ctx, MPP_PORT_INPUT, timeout_ms);
-  mppdec->mpi->dequeue (mppdec->mpp_ctx, MPP_PORT_INPUT, &mtask);
+  mpi->poll (ctx, MPP_PORT_INPUT, timeout_ms);
+  mpi->dequeue (ctx, MPP_PORT_INPUT, &mtask);
   if (G_UNLIKELY (!mtask))
     goto error;
 
   mpp_task_meta_set_packet (mtask, KEY_INPUT_PACKET, mpkt);
 
-  mbuf = gst_mpp_allocator_alloc_mppbuf (mppdec->allocator, self->buf_size);
+  mbuf = gst_mpp_allocator_alloc_mppbuf (mppdec->allocator, buf_size);
   if (G_UNLIKELY (!mbuf))
     goto error;
 
@@ -384,16 +1417,17 @@ gst_mpp_jpeg_dec_send_mpp_packet (GstVideoDecoder * decoder,
 
   mpp_task_meta_set_frame (mtask, KEY_OUTPUT_FRAME, mframe);
 
-  if (mppdec->mpi->enqueue (mppdec->mpp_ctx, MPP_PORT_INPUT, mtask))
+  if (mpi->enqueue (ctx, MPP_PORT_INPUT, mtask))
     goto error;
 
+  self->send_index++;
   return TRUE;
 
 error:
   if (mtask) {
     mpp_task_meta_set_packet (mtask, KEY_INPUT_PACKET, NULL);
     mpp_task_meta_set_frame (mtask, KEY_OUTPUT_FRAME, NULL);
-    mppdec->mpi->enqueue (mppdec->mpp_ctx, MPP_PORT_INPUT, mtask);
+    mpi->enqueue (ctx, MPP_PORT_INPUT, mtask);
   }
 
   if (mframe)
@@ -402,25 +1436,115 @@ error:
   return FALSE;
 }
 
-static MppFrame
-gst_mpp_jpeg_dec_poll_mpp_frame (GstVideoDecoder * decoder, gint timeout_ms)
+static gboolean
+gst_mpp_jpeg_dec_send_tile_job (GstVideoDecoder * decoder,
+    GstMppJpegDecJob * job, gint timeout_ms)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  gint64 pts = mpp_packet_get_pts (job->placeholder);
+  gsize buf_size;
+
+  /* Queue the job once, before sending any strip for the output thread,
+   * sending might time out and get retried */
+  if (!job->queued) {
+    job->queued = TRUE;
+    job->start_index = self->send_index;
+    job->pts = pts;
+
+    g_atomic_int_inc (&job->ref_count);
+
+    g_mutex_lock (&self->job_mutex);
+    g_queue_push_tail (&self->jobs, job);
+    g_mutex_unlock (&self->job_mutex);
+  }
+
+  /* Large enough for RGB and MPP's JPEG parser requirement (w * h * 2) */
+  buf_size = GST_MPP_ALIGN (job->width) * GST_MPP_ALIGN (job->tile_height) * 4;
+
+  while (job->n_sent < job->n_strips) {
+    MppPacket mpkt = job->packets[job->n_sent];
+
+    mpp_packet_set_pts (mpkt, pts);
+
+    if (!gst_mpp_jpeg_dec_send_task (decoder, mpkt, buf_size, timeout_ms))
+      return FALSE;
+
+    g_mutex_lock (&self->job_mutex);
+    job->n_sent++;
+    g_cond_broadcast (&self->job_cond);
+    g_mutex_unlock (&self->job_mutex);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_mpp_jpeg_dec_send_mpp_packet (GstVideoDecoder * decoder,
+    MppPacket mpkt, gint timeout_ms)
 {
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
   GstMppDec *mppdec = GST_MPP_DEC (decoder);
+  GstMppJpegDecJob *job = self->pending_job;
+  gint index;
+
+  /* Prepare output buffers for all in-flight tasks, they would be recycled
+   * through the allocator's MPP group after that */
+  index = gst_mpp_allocator_get_index (mppdec->allocator);
+  if (self->pool_index != index || self->pool_size != self->buf_size) {
+    if (!gst_mpp_allocator_prealloc (mppdec->allocator, self->buf_size,
+            self->queue_depth + MPP_JPEG_DEC_EXTRA_BUFFERS))
+      GST_WARNING_OBJECT (self, "failed to preallocate output buffers");
+
+    self->pool_index = index;
+    self->pool_size = self->buf_size;
+  }
+
+  if (!job || job->placeholder != mpkt)
+    return gst_mpp_jpeg_dec_send_task (decoder, mpkt, self->buf_size,
+        timeout_ms);
+
+#ifdef HAVE_LIBJPEG
+  if (job->software) {
+    if (!gst_mpp_jpeg_dec_send_sw_job (decoder, job))
+      return FALSE;
+  } else
+#endif
+  if (!gst_mpp_jpeg_dec_send_tile_job (decoder, job, timeout_ms))
+    return FALSE;
+
+  /* Taking over the placeholder packet */
+  mpp_packet_deinit (&job->placeholder);
+
+  self->pending_job = NULL;
+  gst_mpp_jpeg_dec_job_unref (job);
+  return TRUE;
+}
+
+static MppFrame
+gst_mpp_jpeg_dec_poll_task (GstVideoDecoder * decoder, gint timeout_ms)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
   MppPacket mpkt = NULL;
   MppTask mtask = NULL;
   MppFrame mframe = NULL;
   MppMeta meta;
+  MppCtx ctx;
+  MppApi *mpi;
+
+  /* Poll in the sending order to keep the frames ordered */
+  ctx = self->contexts[self->poll_index % self->n_contexts];
+  mpi = self->mpis[self->poll_index % self->n_contexts];
 
-  if (mppdec->mpi->poll (mppdec->mpp_ctx, MPP_PORT_OUTPUT, timeout_ms))
+  if (mpi->poll (ctx, MPP_PORT_OUTPUT, timeout_ms))
     return NULL;
 
-  mppdec->mpi->dequeue (mppdec->mpp_ctx, MPP_PORT_OUTPUT, &mtask);
+  mpi->dequeue (ctx, MPP_PORT_OUTPUT, &mtask);
   if (!mtask)
     return NULL;
 
   mpp_task_meta_get_frame (mtask, KEY_OUTPUT_FRAME, &mframe);
   if (!mframe) {
-    mppdec->mpi->enqueue (mppdec->mpp_ctx, MPP_PORT_OUTPUT, mtask);
+    mpi->enqueue (ctx, MPP_PORT_OUTPUT, mtask);
     return NULL;
   }
 
@@ -429,23 +1553,256 @@ gst_mpp_jpeg_dec_poll_mpp_frame (GstVideoDecoder * decoder, gint timeout_ms)
   if (mpkt)
     mpp_packet_deinit (&mpkt);
 
-  mppdec->mpi->enqueue (mppdec->mpp_ctx, MPP_PORT_OUTPUT, mtask);
+  mpi->enqueue (ctx, MPP_PORT_OUTPUT, mtask);
+
+  self->poll_index++;
+  return mframe;
+}
+
+static gboolean
+gst_mpp_jpeg_dec_copy_strip (GstVideoDecoder * decoder,
+    GstMppJpegDecJob * job, MppFrame mframe)
+{
+  GstMppDec *mppdec = GST_MPP_DEC (decoder);
+  GstVideoInfo sinfo, dinfo;
+  GstVideoFormat format;
+  MppFrameFormat mpp_format = mpp_frame_get_fmt (mframe);
+  MppBuffer mbuf = mpp_frame_get_buffer (mframe);
+  gint hstride = mpp_frame_get_hor_stride (mframe);
+  gint vstride = mpp_frame_get_ver_stride (mframe);
+  guint y = job->n_done * job->tile_height;
+  guint8 *src, *dst;
+  guint i;
+
+  if (!mbuf || mpp_frame_get_discard (mframe) || mpp_frame_get_errinfo (mframe))
+    return FALSE;
+
+  format = gst_mpp_mpp_format_to_gst_format (mpp_format);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    return FALSE;
+
+  gst_video_info_set_format (&sinfo, format, job->width,
+      mpp_frame_get_height (mframe));
+  if (!gst_mpp_video_info_align (&sinfo, hstride, vstride))
+    return FALSE;
+
+  gst_video_info_set_format (&dinfo, format, job->width, job->height);
+  if (!gst_mpp_video_info_align (&dinfo, hstride, 0))
+    return FALSE;
+
+  if (!job->mframe) {
+    MppBuffer out_mbuf;
+
+    out_mbuf = gst_mpp_allocator_alloc_mppbuf (mppdec->allocator,
+        GST_VIDEO_INFO_SIZE (&dinfo));
+    if (!out_mbuf)
+      return FALSE;
+
+    mpp_frame_init (&job->mframe);
+    mpp_frame_set_fmt (job->mframe, mpp_format);
+    mpp_frame_set_width (job->mframe, job->width);
+    mpp_frame_set_height (job->mframe, job->height);
+    mpp_frame_set_hor_stride (job->mframe, hstride);
+    mpp_frame_set_hor_stride_pixel (job->mframe,
+        mpp_frame_get_hor_stride_pixel (mframe));
+    mpp_frame_set_ver_stride (job->mframe, GST_MPP_VIDEO_INFO_VSTRIDE (&dinfo));
+    mpp_frame_set_pts (job->mframe, mpp_frame_get_pts (mframe));
+    mpp_frame_set_buffer (job->mframe, out_mbuf);
+    mpp_buffer_put (out_mbuf);
+  } else if (mpp_frame_get_fmt (job->mframe) != mpp_format ||
+      mpp_frame_get_hor_stride (job->mframe) != hstride) {
+    return FALSE;
+  }
+
+#ifdef HAVE_RGA
+  /* Blit the strip to its rows by RGA, RGA rects need even sizes */
+  if (gst_mpp_use_rga () && !(GST_VIDEO_INFO_HEIGHT (&sinfo) % 2)) {
+    GstVideoRectangle rect = { 0, y, job->width,
+      GST_VIDEO_INFO_HEIGHT (&sinfo)
+    };
+    GstMppRgaBatch *batch;
+    gboolean ret;
+
+    if (!job->out_mem)
+      job->out_mem = gst_mpp_allocator_import_mppbuf (mppdec->allocator,
+          mpp_frame_get_buffer (job->mframe));
+
+    if (job->out_mem) {
+      batch = gst_mpp_rga_batch_new ();
+      ret = gst_mpp_rga_batch_add_mpp_frame (batch, mframe, NULL,
+          job->out_mem, &dinfo, &rect, 0) &&
+          gst_mpp_rga_batch_submit (batch, FALSE);
+      gst_mpp_rga_batch_free (batch);
+
+      if (ret)
+        return TRUE;
+    }
+
+    GST_DEBUG_OBJECT (mppdec, "fallback to copying strip by CPU");
+  }
+#endif
+
+  src = mpp_buffer_get_ptr (mbuf);
+  dst = mpp_buffer_get_ptr (mpp_frame_get_buffer (job->mframe));
+
+  /* Copy planes of the strip to its rows in the full-size frame */
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&sinfo); i++) {
+    guint comp = i ? 1 : 0;
+    guint rows = GST_VIDEO_INFO_COMP_HEIGHT (&sinfo, comp);
+    guint offset = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (sinfo.finfo, comp, y);
+
+    memcpy (dst + GST_VIDEO_INFO_PLANE_OFFSET (&dinfo, i) +
+        offset * GST_VIDEO_INFO_PLANE_STRIDE (&dinfo, i),
+        src + GST_VIDEO_INFO_PLANE_OFFSET (&sinfo, i),
+        rows * GST_VIDEO_INFO_PLANE_STRIDE (&sinfo, i));
+  }
+
+  return TRUE;
+}
+
+static MppFrame
+gst_mpp_jpeg_dec_poll_mpp_frame (GstVideoDecoder * decoder, gint timeout_ms)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  GstMppJpegDecJob *job;
+  MppFrame mframe;
+  gint64 end_time;
+  gboolean done;
+
+  end_time = g_get_monotonic_time () + timeout_ms * G_TIME_SPAN_MILLISECOND;
+
+again:
+  g_mutex_lock (&self->job_mutex);
+  job = g_queue_peek_head (&self->jobs);
+  g_mutex_unlock (&self->job_mutex);
+
+  /* Not reaching the strips of the next tiled frame */
+  if (!job || (gint) (self->poll_index - job->start_index) < 0)
+    return gst_mpp_jpeg_dec_poll_task (decoder, timeout_ms);
+
+#ifdef HAVE_LIBJPEG
+  if (job->software)
+    return gst_mpp_jpeg_dec_poll_sw_job (decoder, job, timeout_ms);
+#endif
+
+  /* Collect strips, the progress is kept across timeouts */
+  while (1) {
+    g_mutex_lock (&self->job_mutex);
+
+    /* Only poll for the sent strips, the rest might never be sent */
+    while (job->n_done == job->n_sent && job->n_done < job->n_strips &&
+        !job->abandoned) {
+      if (timeout_ms < 0) {
+        g_cond_wait (&self->job_cond, &self->job_mutex);
+      } else if (!timeout_ms ||
+          !g_cond_wait_until (&self->job_cond, &self->job_mutex, end_time)) {
+        g_mutex_unlock (&self->job_mutex);
+        return NULL;
+      }
+    }
+
+    done = job->n_done == (job->abandoned ? job->n_sent : job->n_strips);
+    g_mutex_unlock (&self->job_mutex);
 
+    if (done)
+      break;
+
+    mframe = gst_mpp_jpeg_dec_poll_task (decoder, timeout_ms);
+    if (!mframe)
+      return NULL;
+
+    if (!job->error && !gst_mpp_jpeg_dec_copy_strip (decoder, job, mframe)) {
+      GST_WARNING_OBJECT (self, "failed to decode strip %d", job->n_done);
+      job->error = TRUE;
+    }
+
+    mpp_frame_deinit (&mframe);
+    job->n_done++;
+  }
+
+#ifdef HAVE_LIBJPEG
+  /* Still at the head of the queue, keeping the output order */
+  if (job->error && !job->abandoned &&
+      gst_mpp_jpeg_dec_retry_sw_job (decoder, job))
+    return gst_mpp_jpeg_dec_poll_sw_job (decoder, job, timeout_ms);
+#endif
+
+  g_mutex_lock (&self->job_mutex);
+  g_queue_pop_head (&self->jobs);
+  g_mutex_unlock (&self->job_mutex);
+
+  /* Its codec frame is gone already */
+  if (job->abandoned) {
+    GST_DEBUG_OBJECT (self, "dropped %d strips of a failed frame",
+        job->n_done);
+    gst_mpp_jpeg_dec_job_unref (job);
+    goto again;
+  }
+
+  mframe = job->mframe;
+  job->mframe = NULL;
+
+  if (!mframe) {
+    /* Return an empty frame to drop the codec frame */
+    mpp_frame_init (&mframe);
+  } else if (job->error) {
+    mpp_frame_set_errinfo (mframe, 1);
+  }
+
+  gst_mpp_jpeg_dec_job_unref (job);
   return mframe;
 }
 
+static gboolean
+gst_mpp_jpeg_dec_startup (GstVideoDecoder * decoder)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+
+  gst_mpp_jpeg_dec_clear_jobs (decoder);
+
+  self->send_index = 0;
+  self->poll_index = 0;
+
+  return TRUE;
+}
+
+/* The parent only handles its own context */
+static void
+gst_mpp_jpeg_dec_reset (GstVideoDecoder * decoder)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  guint i;
+
+  for (i = 1; i < self->n_contexts; i++)
+    self->mpis[i]->reset (self->contexts[i]);
+}
+
+static void
+gst_mpp_jpeg_dec_set_buffer_group (GstVideoDecoder * decoder,
+    MppBufferGroup group)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  guint i;
+
+  for (i = 1; i < self->n_contexts; i++)
+    self->mpis[i]->control (self->contexts[i], MPP_DEC_SET_EXT_BUF_GROUP,
+        group);
+}
+
 static gboolean
 gst_mpp_jpeg_dec_shutdown (GstVideoDecoder * decoder, gboolean drain UNUSED)
 {
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
-  GstMppDec *mppdec = GST_MPP_DEC (decoder);
   MppFrame mframe = NULL;
   MppTask mtask = NULL;
+  MppCtx ctx = self->contexts[self->send_index % self->n_contexts];
+  MppApi *mpi = self->mpis[self->send_index % self->n_contexts];
 
   GST_DEBUG_OBJECT (self, "sending EOS");
 
-  mppdec->mpi->poll (mppdec->mpp_ctx, MPP_PORT_INPUT, MPP_POLL_BLOCK);
-  mppdec->mpi->dequeue (mppdec->mpp_ctx, MPP_PORT_INPUT, &mtask);
+  /* Send EOS to the next context, so that it comes after all frames */
+  mpi->poll (ctx, MPP_PORT_INPUT, MPP_POLL_BLOCK);
+  mpi->dequeue (ctx, MPP_PORT_INPUT, &mtask);
   if (!mtask)
     goto error;
 
@@ -457,9 +1814,10 @@ gst_mpp_jpeg_dec_shutdown (GstVideoDecoder * decoder, gboolean drain UNUSED)
 
   mpp_task_meta_set_frame (mtask, KEY_OUTPUT_FRAME, mframe);
 
-  if (mppdec->mpi->enqueue (mppdec->mpp_ctx, MPP_PORT_INPUT, mtask))
+  if (mpi->enqueue (ctx, MPP_PORT_INPUT, mtask))
     goto error;
 
+  self->send_index++;
   return TRUE;
 
 error:
@@ -468,7 +1826,7 @@ error:
   if (mtask) {
     mpp_task_meta_set_packet (mtask, KEY_INPUT_PACKET, NULL);
     mpp_task_meta_set_frame (mtask, KEY_OUTPUT_FRAME, NULL);
-    mppdec->mpi->enqueue (mppdec->mpp_ctx, MPP_PORT_INPUT, mtask);
+    mpi->enqueue (ctx, MPP_PORT_INPUT, mtask);
   }
 
   if (mframe)
@@ -518,6 +1876,34 @@ gst_mpp_jpeg_dec_init (GstMppJpegDec * self)
 {
   GstMppDec *mppdec = GST_MPP_DEC (self);
   mppdec->format = DEFAULT_PROP_FORMAT;
+
+  self->queue_depth = DEFAULT_PROP_QUEUE_DEPTH;
+  mppdec->max_pending = self->queue_depth + 1;
+
+  self->parallel = DEFAULT_PROP_PARALLEL;
+
+  self->tiled = DEFAULT_PROP_TILED;
+  self->tile_height = DEFAULT_PROP_TILE_HEIGHT;
+
+  g_mutex_init (&self->job_mutex);
+  g_cond_init (&self->job_cond);
+  g_queue_init (&self->jobs);
+
+#ifdef HAVE_LIBJPEG
+  self->sw_threads = DEFAULT_PROP_SW_THREADS;
+  self->sw_color_space = JCS_UNKNOWN;
+#endif
+}
+
+static void
+gst_mpp_jpeg_dec_finalize (GObject * object)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (object);
+
+  g_mutex_clear (&self->job_mutex);
+  g_cond_clear (&self->job_cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 static void
@@ -555,13 +1941,17 @@ gst_mpp_jpeg_dec_class_init (GstMppJpegDecClass * klass)
   decoder_class->stop = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_stop);
   decoder_class->set_format = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_set_format);
 
-  pclass->startup = NULL;
+  pclass->startup = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_startup);
   pclass->get_mpp_packet = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_get_mpp_packet);
   pclass->send_mpp_packet =
       GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_send_mpp_packet);
   pclass->poll_mpp_frame = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_poll_mpp_frame);
   pclass->shutdown = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_shutdown);
+  pclass->reset = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_reset);
+  pclass->set_buffer_group =
+      GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_set_buffer_group);
 
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_finalize);
   gobject_class->set_property =
       GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_set_property);
   gobject_class->get_property =
@@ -575,6 +1965,39 @@ gst_mpp_jpeg_dec_class_init (GstMppJpegDecClass * klass)
           GST_TYPE_MPP_JPEG_DEC_FORMAT, DEFAULT_PROP_FORMAT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_QUEUE_DEPTH,
+      g_param_spec_uint ("queue-depth", "Queue depth",
+          "Max number of in-flight decode tasks",
+          1, 16, DEFAULT_PROP_QUEUE_DEPTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PARALLEL,
+      g_param_spec_uint ("parallel-contexts", "Parallel contexts",
+          "Number of MPP contexts decoding frames in parallel",
+          1, MPP_JPEG_DEC_MAX_CONTEXTS, DEFAULT_PROP_PARALLEL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TILED,
+      g_param_spec_boolean ("tiled", "Tiled",
+          "Split frames taller than tile-height into strips "
+          "at restart marker boundaries", DEFAULT_PROP_TILED,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TILE_HEIGHT,
+      g_param_spec_uint ("tile-height", "Tile height",
+          "Max height of strips in tiled mode",
+          16, G_MAXUINT16, DEFAULT_PROP_TILE_HEIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+#ifdef HAVE_LIBJPEG
+  g_object_class_install_property (gobject_class, PROP_SW_THREADS,
+      g_param_spec_uint ("sw-threads", "Software threads",
+          "Number of threads for software decoding fallback "
+          "(0 = disabled, enabling or disabling applies on restart)",
+          0, 64, DEFAULT_PROP_SW_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_mpp_jpeg_dec_src_template));
 
@@ -0,0 +1,997 @@
+/*
+ * Copyright 2021 Rockchip Electronics Co., Ltd
+ *     Author: Jeffy Chen <jeffy.chen@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Decoding many streams in one element, each request sink_%u pad has a
+ * src_%u pad paired with it.
+ *
+ * Every stream keeps its own MPP context, but the output buffers are
+ * allocated from a single shared MPP group, and the decoded frames are
+ * polled by a small fixed set of output threads instead of one task per
+ * stream.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstmppallocator.h"
+#include "gstmppvideodec.h"
+#include "gstmppmultidec.h"
+
+#define GST_CAT_DEFAULT mpp_multi_dec_debug
+GST_DEBUG_CATEGORY (GST_CAT_DEFAULT);
+
+#define MPP_MULTI_DEC_IDLE_US 2000      /* Wait for decoding in progress */
+#define MPP_MULTI_DEC_STALL_US 200000   /* Frames held without new packets */
+#define MPP_MULTI_DEC_INPUT_TIMEOUT_MS 2000     /* Timeout for input queue */
+
+typedef struct
+{
+  GstMppMultiDec *self;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  MppCodingType mpp_type;
+  MppCtx mpp_ctx;
+  MppApi *mpi;
+
+  GstCaps *input_caps;
+  gint fps_n, fps_d;
+
+  /* output video info */
+  GstVideoInfo info;
+  gboolean caps_sent;
+
+  /* segment waiting for the output caps */
+  GstEvent *pending_segment;
+
+  /* decoded MPP frame info */
+  MppFrame mpp_frame;
+
+  /* polled by an output thread */
+  gboolean busy;
+
+  /* packets sent without frames polled yet, and the last activity */
+  guint pending;
+  gint64 last_active;
+
+  /* EOS sent, waiting for the last frame */
+  gboolean draining;
+
+  gboolean flushing;
+  GstFlowReturn flow_ret;
+} GstMppMultiDecStream;
+
+struct _GstMppMultiDec
+{
+  GstElement parent;
+
+  /* protects the streams and their busy states */
+  GMutex mutex;
+
+  /* new packets or EOS sent, or output threads stopping */
+  GCond cond;
+
+  /* a stream is no longer busy */
+  GCond busy_cond;
+
+  GPtrArray *streams;
+  guint next_stream;
+  guint next_pad;
+
+  /* shared by all of the streams */
+  GstAllocator *allocator;
+
+  guint n_threads;
+  GThread **threads;
+  gboolean running;
+};
+
+#define parent_class gst_mpp_multi_dec_parent_class
+G_DEFINE_TYPE (GstMppMultiDec, gst_mpp_multi_dec, GST_TYPE_ELEMENT);
+
+#define DEFAULT_PROP_OUTPUT_THREADS 2
+
+enum
+{
+  PROP_0,
+  PROP_OUTPUT_THREADS,
+  PROP_LAST,
+};
+
+static GstStaticPadTemplate gst_mpp_multi_dec_sink_template =
+    GST_STATIC_PAD_TEMPLATE ("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS ("video/x-h263, parsed = (boolean) true;"
+        "video/x-h264, parsed = (boolean) true, alignment = (string) au;"
+        "video/x-h265, parsed = (boolean) true, alignment = (string) au;"
+        "video/x-av1, parsed = (boolean) true;"
+        "video/x-vp8; video/x-vp9;"
+        "video/mpeg, parsed = (boolean) true,"
+        "mpegversion = (int) { 1, 2, 4 }, systemstream = (boolean) false;"));
+
+static GstStaticPadTemplate gst_mpp_multi_dec_src_template =
+    GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS (MPP_DEC_CAPS_MAKE ("{" MPP_DEC_OUT_FORMATS "}") ";")
+    );
+
+static void
+gst_mpp_multi_dec_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstMppMultiDec *self = GST_MPP_MULTI_DEC (object);
+
+  switch (prop_id) {
+    case PROP_OUTPUT_THREADS:{
+      if (self->threads)
+        GST_WARNING_OBJECT (self, "unable to change output threads");
+      else
+        self->n_threads = g_value_get_uint (value);
+      break;
+    }
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      return;
+  }
+}
+
+static void
+gst_mpp_multi_dec_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstMppMultiDec *self = GST_MPP_MULTI_DEC (object);
+
+  switch (prop_id) {
+    case PROP_OUTPUT_THREADS:
+      g_value_set_uint (value, self->n_threads);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Wait for the output threads to leave the stream, with the mutex held */
+static void
+gst_mpp_multi_dec_stream_wait_idle (GstMppMultiDecStream * stream)
+{
+  GstMppMultiDec *self = stream->self;
+
+  while (stream->busy)
+    g_cond_wait (&self->busy_cond, &self->mutex);
+}
+
+static void
+gst_mpp_multi_dec_stream_deinit (GstMppMultiDecStream * stream)
+{
+  GstMppMultiDec *self = stream->self;
+  MppCtx mpp_ctx;
+
+  g_mutex_lock (&self->mutex);
+  gst_mpp_multi_dec_stream_wait_idle (stream);
+
+  /* Stop polling it */
+  mpp_ctx = stream->mpp_ctx;
+  stream->mpp_ctx = NULL;
+  g_mutex_unlock (&self->mutex);
+
+  if (mpp_ctx)
+    mpp_destroy (mpp_ctx);
+
+  if (stream->mpp_frame) {
+    mpp_frame_deinit (&stream->mpp_frame);
+    stream->mpp_frame = NULL;
+  }
+
+  gst_caps_replace (&stream->input_caps, NULL);
+  gst_event_replace (&stream->pending_segment, NULL);
+
+  stream->caps_sent = FALSE;
+  stream->flow_ret = GST_FLOW_OK;
+
+  stream->pending = 0;
+  stream->draining = FALSE;
+}
+
+static gboolean
+gst_mpp_multi_dec_stream_init (GstMppMultiDecStream * stream, GstCaps * caps)
+{
+  GstMppMultiDec *self = stream->self;
+  GstStructure *structure = gst_caps_get_structure (caps, 0);
+  const GValue *codec_data;
+  MppBufferGroup group;
+  MppCtx mpp_ctx;
+  MppApi *mpi;
+  gint timeout = MPP_POLL_NON_BLOCK;
+  guint32 fast_mode = 1;
+
+  if (stream->input_caps && gst_caps_is_strictly_equal (stream->input_caps,
+          caps))
+    return TRUE;
+
+  gst_mpp_multi_dec_stream_deinit (stream);
+
+  stream->mpp_type = gst_mpp_video_dec_get_mpp_type (structure);
+  if (stream->mpp_type == MPP_VIDEO_CodingUnused)
+    return FALSE;
+
+  stream->fps_n = 0;
+  stream->fps_d = 1;
+  gst_structure_get_fraction (structure, "framerate",
+      &stream->fps_n, &stream->fps_d);
+
+  if (mpp_create (&mpp_ctx, &mpi))
+    return FALSE;
+
+  /* NOTE: MPP fast mode must be applied before mpp_init() */
+  mpi->control (mpp_ctx, MPP_DEC_SET_PARSER_FAST_MODE, &fast_mode);
+
+  if (mpp_init (mpp_ctx, MPP_CTX_DEC, stream->mpp_type)) {
+    GST_ERROR_OBJECT (stream->sinkpad, "failed to init mpp ctx");
+    mpp_destroy (mpp_ctx);
+    return FALSE;
+  }
+
+  mpi->control (mpp_ctx, MPP_DEC_SET_DISABLE_ERROR, NULL);
+  mpi->control (mpp_ctx, MPP_SET_OUTPUT_TIMEOUT, &timeout);
+
+  group = gst_mpp_allocator_get_mpp_group (self->allocator);
+  mpi->control (mpp_ctx, MPP_DEC_SET_EXT_BUF_GROUP, group);
+
+  /* Send extra codec data */
+  codec_data = gst_structure_get_value (structure, "codec_data");
+  if (codec_data && G_VALUE_TYPE (codec_data) == GST_TYPE_BUFFER) {
+    GstBuffer *buf = gst_value_get_buffer (codec_data);
+    GstMapInfo mapinfo = { 0, };
+    MppPacket mpkt;
+
+    gst_buffer_map (buf, &mapinfo, GST_MAP_READ);
+    mpp_packet_init (&mpkt, mapinfo.data, mapinfo.size);
+    mpp_packet_set_extra_data (mpkt);
+
+    mpi->decode_put_packet (mpp_ctx, mpkt);
+
+    mpp_packet_deinit (&mpkt);
+    gst_buffer_unmap (buf, &mapinfo);
+  }
+
+  stream->mpi = mpi;
+  stream->input_caps = gst_caps_ref (caps);
+
+  g_mutex_lock (&self->mutex);
+  stream->mpp_ctx = mpp_ctx;
+  g_mutex_unlock (&self->mutex);
+
+  GST_DEBUG_OBJECT (stream->sinkpad, "initialized for %" GST_PTR_FORMAT, caps);
+  return TRUE;
+}
+
+static gboolean
+gst_mpp_multi_dec_stream_negotiate (GstMppMultiDecStream * stream,
+    MppFrame mframe)
+{
+  GstVideoInfo *info = &stream->info;
+  GstVideoFormat format;
+  MppFrameFormat mpp_format = mpp_frame_get_fmt (mframe);
+  gint width = mpp_frame_get_width (mframe);
+  gint height = mpp_frame_get_height (mframe);
+  gint hstride = mpp_frame_get_hor_stride (mframe);
+  gint vstride = mpp_frame_get_ver_stride (mframe);
+  GstCaps *caps;
+  gboolean ret;
+
+  format = gst_mpp_mpp_format_to_gst_format (mpp_format);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN || MPP_FRAME_FMT_IS_FBC (mpp_format)) {
+    GST_ERROR_OBJECT (stream->srcpad, "unsupported format %d", mpp_format);
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (stream->srcpad, "applying %s %dx%d (%dx%d)",
+      gst_mpp_video_format_to_string (format), width, height,
+      hstride, vstride);
+
+  gst_video_info_init (info);
+  gst_video_info_set_format (info, format, width, height);
+  GST_VIDEO_INFO_FPS_N (info) = stream->fps_n;
+  GST_VIDEO_INFO_FPS_D (info) = stream->fps_d;
+
+  if (!gst_mpp_video_info_align (info, hstride, vstride))
+    return FALSE;
+
+  caps = gst_video_info_to_caps (info);
+  ret = gst_pad_push_event (stream->srcpad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  if (!ret)
+    return FALSE;
+
+  stream->caps_sent = TRUE;
+
+  /* The segment should come after the caps */
+  if (stream->pending_segment) {
+    gst_pad_push_event (stream->srcpad, stream->pending_segment);
+    stream->pending_segment = NULL;
+  }
+
+  return TRUE;
+}
+
+static GstBuffer *
+gst_mpp_multi_dec_stream_get_buffer (GstMppMultiDecStream * stream,
+    MppFrame mframe)
+{
+  GstMppMultiDec *self = stream->self;
+  GstVideoInfo *info = &stream->info;
+  GstBuffer *buffer;
+  GstMemory *mem;
+  MppBuffer mbuf;
+  gint64 pts;
+
+  mbuf = mpp_frame_get_buffer (mframe);
+  if (!mbuf)
+    return NULL;
+
+  /* Allocated from the shared MPP group in MPP */
+  mpp_buffer_set_index (mbuf, gst_mpp_allocator_get_index (self->allocator));
+
+  mem = gst_mpp_allocator_import_mppbuf (self->allocator, mbuf);
+  if (!mem)
+    return NULL;
+
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer, mem);
+
+  gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info),
+      GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info),
+      GST_VIDEO_INFO_N_PLANES (info), info->offset, info->stride);
+
+  /* Truncate MPP's extra data */
+  gst_buffer_resize (buffer, 0, GST_VIDEO_INFO_SIZE (info));
+
+  pts = mpp_frame_get_pts (mframe);
+  GST_BUFFER_PTS (buffer) = pts < 0 ? GST_CLOCK_TIME_NONE : (GstClockTime) pts;
+
+  return buffer;
+}
+
+/* Poll a decoded frame of the stream and push it, return TRUE if polled */
+static gboolean
+gst_mpp_multi_dec_stream_poll (GstMppMultiDecStream * stream)
+{
+  GstBuffer *buffer;
+  MppFrame mframe = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  stream->mpi->decode_get_frame (stream->mpp_ctx, &mframe);
+  if (!mframe)
+    return FALSE;
+
+  /* Info change frames don't consume packets */
+  g_mutex_lock (&stream->self->mutex);
+  if (!mpp_frame_get_info_change (mframe) && stream->pending)
+    stream->pending--;
+  if (mpp_frame_get_eos (mframe)) {
+    stream->pending = 0;
+    stream->draining = FALSE;
+  }
+  stream->last_active = g_get_monotonic_time ();
+  g_mutex_unlock (&stream->self->mutex);
+
+  if (mpp_frame_get_info_change (mframe)) {
+    stream->mpi->control (stream->mpp_ctx, MPP_DEC_SET_INFO_CHANGE_READY,
+        NULL);
+    if (!gst_mpp_multi_dec_stream_negotiate (stream, mframe))
+      ret = GST_FLOW_NOT_NEGOTIATED;
+    goto out;
+  }
+
+  if (!mpp_frame_get_buffer (mframe))
+    goto out;
+
+  if (mpp_frame_get_discard (mframe) || mpp_frame_get_errinfo (mframe)) {
+    GST_DEBUG_OBJECT (stream->srcpad, "drop frame with errors");
+    goto out;
+  }
+
+  if (!stream->caps_sent || gst_mpp_frame_info_changed (stream->mpp_frame,
+          mframe)) {
+    if (!gst_mpp_multi_dec_stream_negotiate (stream, mframe)) {
+      ret = GST_FLOW_NOT_NEGOTIATED;
+      goto out;
+    }
+  }
+
+  buffer = gst_mpp_multi_dec_stream_get_buffer (stream, mframe);
+  if (!buffer) {
+    GST_WARNING_OBJECT (stream->srcpad, "can't process this frame");
+    goto out;
+  }
+
+  ret = gst_pad_push (stream->srcpad, buffer);
+
+out:
+  if (mpp_frame_get_eos (mframe)) {
+    GST_INFO_OBJECT (stream->srcpad, "got eos");
+    gst_pad_push_event (stream->srcpad, gst_event_new_eos ());
+
+    if (ret == GST_FLOW_OK)
+      ret = GST_FLOW_EOS;
+  }
+
+  if (ret != GST_FLOW_OK)
+    GST_DEBUG_OBJECT (stream->srcpad, "flow return %s",
+        gst_flow_get_name (ret));
+
+  stream->flow_ret = ret;
+
+  if (stream->mpp_frame)
+    mpp_frame_deinit (&stream->mpp_frame);
+
+  /* Save the last MPP frame for info change detection */
+  mpp_frame_set_buffer (mframe, NULL);
+  stream->mpp_frame = mframe;
+
+  return TRUE;
+}
+
+/* Whether frames are expected from the stream, with the mutex held */
+static gboolean
+gst_mpp_multi_dec_stream_has_work (GstMppMultiDecStream * stream, gint64 now)
+{
+  if (!stream->mpp_ctx || stream->flushing || stream->flow_ret != GST_FLOW_OK)
+    return FALSE;
+
+  if (stream->draining)
+    return TRUE;
+
+  /* Frames held for reordering only come with more packets */
+  return stream->pending && now < stream->last_active + MPP_MULTI_DEC_STALL_US;
+}
+
+/* Find the next stream to poll, with the mutex held */
+static GstMppMultiDecStream *
+gst_mpp_multi_dec_next_stream (GstMppMultiDec * self, gboolean * has_work)
+{
+  GstMppMultiDecStream *stream;
+  gint64 now = g_get_monotonic_time ();
+  guint i, n = self->streams->len;
+
+  *has_work = FALSE;
+
+  for (i = 0; i < n; i++) {
+    stream = g_ptr_array_index (self->streams, (self->next_stream + i) % n);
+
+    if (!gst_mpp_multi_dec_stream_has_work (stream, now))
+      continue;
+
+    *has_work = TRUE;
+
+    if (stream->busy)
+      continue;
+
+    self->next_stream = (self->next_stream + i + 1) % n;
+    return stream;
+  }
+
+  return NULL;
+}
+
+static gpointer
+gst_mpp_multi_dec_output_loop (GstMppMultiDec * self)
+{
+  GstMppMultiDecStream *stream;
+  guint idle = 0;
+  gint64 end_time;
+  gboolean polled, has_work;
+
+  GST_DEBUG_OBJECT (self, "output thread started");
+
+  g_mutex_lock (&self->mutex);
+  while (self->running) {
+    stream = gst_mpp_multi_dec_next_stream (self, &has_work);
+
+    /* Only wait after trying all of the streams */
+    if (!stream || idle >= self->streams->len) {
+      if (has_work) {
+        /* Decoding in progress, MPP doesn't notify its completion */
+        end_time = g_get_monotonic_time () + MPP_MULTI_DEC_IDLE_US;
+        g_cond_wait_until (&self->cond, &self->mutex, end_time);
+      } else {
+        /* Nothing in flight, wait for new packets */
+        g_cond_wait (&self->cond, &self->mutex);
+      }
+      idle = 0;
+      continue;
+    }
+
+    stream->busy = TRUE;
+    g_mutex_unlock (&self->mutex);
+
+    polled = gst_mpp_multi_dec_stream_poll (stream);
+
+    g_mutex_lock (&self->mutex);
+    stream->busy = FALSE;
+    g_cond_broadcast (&self->busy_cond);
+
+    idle = polled ? 0 : idle + 1;
+  }
+  g_mutex_unlock (&self->mutex);
+
+  GST_DEBUG_OBJECT (self, "output thread stopped");
+
+  return NULL;
+}
+
+static void
+gst_mpp_multi_dec_start_threads (GstMppMultiDec * self)
+{
+  guint i;
+
+  self->running = TRUE;
+  self->threads = g_new0 (GThread *, self->n_threads);
+
+  for (i = 0; i < self->n_threads; i++)
+    self->threads[i] = g_thread_new ("mppmultidec",
+        (GThreadFunc) gst_mpp_multi_dec_output_loop, self);
+}
+
+static void
+gst_mpp_multi_dec_stop_threads (GstMppMultiDec * self)
+{
+  guint i;
+
+  if (!self->threads)
+    return;
+
+  g_mutex_lock (&self->mutex);
+  self->running = FALSE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->mutex);
+
+  for (i = 0; i < self->n_threads; i++)
+    g_thread_join (self->threads[i]);
+
+  g_free (self->threads);
+  self->threads = NULL;
+}
+
+/* Send the packet and wake up an output thread for it */
+static GstFlowReturn
+gst_mpp_multi_dec_stream_send_packet (GstMppMultiDecStream * stream,
+    MppPacket mpkt)
+{
+  GstMppMultiDec *self = stream->self;
+  gint64 deadline;
+  gint interval_ms = 2;
+
+  deadline = g_get_monotonic_time () +
+      MPP_MULTI_DEC_INPUT_TIMEOUT_MS * G_TIME_SPAN_MILLISECOND;
+
+  /* NOTE: MPP copies the packet data */
+  while (stream->mpi->decode_put_packet (stream->mpp_ctx, mpkt)) {
+    if (stream->flushing)
+      return GST_FLOW_FLUSHING;
+
+    if (g_get_monotonic_time () > deadline) {
+      GST_ERROR_OBJECT (stream->sinkpad, "failed to send packet");
+      return GST_FLOW_ERROR;
+    }
+
+    g_usleep (interval_ms * 1000);
+  }
+
+  g_mutex_lock (&self->mutex);
+  if (mpp_packet_get_eos (mpkt))
+    stream->draining = TRUE;
+  else
+    stream->pending++;
+  stream->last_active = g_get_monotonic_time ();
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->mutex);
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_mpp_multi_dec_chain (GstPad * pad, GstObject * parent UNUSED,
+    GstBuffer * buffer)
+{
+  GstMppMultiDecStream *stream = gst_pad_get_element_private (pad);
+  GstMapInfo mapinfo = { 0, };
+  GstFlowReturn ret;
+  MppPacket mpkt = NULL;
+
+  if (!stream->mpp_ctx)
+    goto not_negotiated;
+
+  ret = stream->flow_ret;
+  if (ret != GST_FLOW_OK)
+    goto out;
+
+  gst_buffer_map (buffer, &mapinfo, GST_MAP_READ);
+  mpp_packet_init (&mpkt, mapinfo.data, mapinfo.size);
+  mpp_packet_set_pts (mpkt, GST_BUFFER_PTS_IS_VALID (buffer) ?
+      (gint64) GST_BUFFER_PTS (buffer) : -1);
+
+  ret = gst_mpp_multi_dec_stream_send_packet (stream, mpkt);
+
+  mpp_packet_deinit (&mpkt);
+  gst_buffer_unmap (buffer, &mapinfo);
+
+out:
+  gst_buffer_unref (buffer);
+  return ret;
+not_negotiated:
+  GST_ERROR_OBJECT (pad, "not negotiated");
+  gst_buffer_unref (buffer);
+  return GST_FLOW_NOT_NEGOTIATED;
+}
+
+static gboolean
+gst_mpp_multi_dec_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstMppMultiDec *self = GST_MPP_MULTI_DEC (parent);
+  GstMppMultiDecStream *stream = gst_pad_get_element_private (pad);
+
+  GST_DEBUG_OBJECT (pad, "received event %" GST_PTR_FORMAT, event);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps;
+      gboolean ret;
+
+      gst_event_parse_caps (event, &caps);
+      ret = gst_mpp_multi_dec_stream_init (stream, caps);
+      gst_event_unref (event);
+
+      /* The output caps are sent with decoded frames */
+      return ret;
+    }
+    case GST_EVENT_SEGMENT:
+      if (!stream->caps_sent) {
+        gst_event_replace (&stream->pending_segment, event);
+        gst_event_unref (event);
+        return TRUE;
+      }
+      break;
+    case GST_EVENT_EOS:{
+      MppPacket mpkt;
+      GstFlowReturn ret;
+
+      if (!stream->mpp_ctx)
+        break;
+
+      /* Drain MPP, the EOS would be sent with the last frame */
+      mpp_packet_init (&mpkt, NULL, 0);
+      mpp_packet_set_eos (mpkt);
+
+      ret = gst_mpp_multi_dec_stream_send_packet (stream, mpkt);
+      mpp_packet_deinit (&mpkt);
+
+      if (ret == GST_FLOW_FLUSHING) {
+        gst_event_unref (event);
+        return FALSE;
+      }
+
+      /* Forward the EOS directly when unable to drain */
+      if (ret != GST_FLOW_OK)
+        break;
+
+      gst_event_unref (event);
+      return TRUE;
+    }
+    case GST_EVENT_FLUSH_START:
+      stream->flushing = TRUE;
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (&self->mutex);
+      gst_mpp_multi_dec_stream_wait_idle (stream);
+      g_mutex_unlock (&self->mutex);
+
+      if (stream->mpp_ctx)
+        stream->mpi->reset (stream->mpp_ctx);
+
+      g_mutex_lock (&self->mutex);
+      stream->pending = 0;
+      stream->draining = FALSE;
+      g_mutex_unlock (&self->mutex);
+
+      stream->flow_ret = GST_FLOW_OK;
+      stream->flushing = FALSE;
+      break;
+    default:
+      break;
+  }
+
+  return gst_pad_push_event (stream->srcpad, event);
+}
+
+static gboolean
+gst_mpp_multi_dec_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstMppMultiDecStream *stream = gst_pad_get_element_private (pad);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:{
+      GstCaps *filter, *caps;
+
+      gst_query_parse_caps (query, &filter);
+      caps = gst_pad_get_pad_template_caps (pad);
+      if (filter) {
+        GstCaps *tmp = caps;
+        caps = gst_caps_intersect_full (filter, tmp, GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref (tmp);
+      }
+
+      gst_query_set_caps_result (query, caps);
+      gst_caps_unref (caps);
+      return TRUE;
+    }
+    case GST_QUERY_ACCEPT_CAPS:
+    case GST_QUERY_ALLOCATION:
+      return gst_pad_query_default (pad, parent, query);
+    default:
+      /* Don't proxy to the other streams */
+      return gst_pad_peer_query (stream->srcpad, query);
+  }
+}
+
+static gboolean
+gst_mpp_multi_dec_src_event (GstPad * pad, GstObject * parent UNUSED,
+    GstEvent * event)
+{
+  GstMppMultiDecStream *stream = gst_pad_get_element_private (pad);
+
+  return gst_pad_push_event (stream->sinkpad, event);
+}
+
+static gboolean
+gst_mpp_multi_dec_src_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstMppMultiDecStream *stream = gst_pad_get_element_private (pad);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+    case GST_QUERY_ACCEPT_CAPS:
+      return gst_pad_query_default (pad, parent, query);
+    default:
+      return gst_pad_peer_query (stream->sinkpad, query);
+  }
+}
+
+static GstPad *
+gst_mpp_multi_dec_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps UNUSED)
+{
+  GstMppMultiDec *self = GST_MPP_MULTI_DEC (element);
+  GstElementClass *klass = GST_ELEMENT_GET_CLASS (element);
+  GstMppMultiDecStream *stream;
+  gchar *pad_name;
+  guint index;
+
+  GST_OBJECT_LOCK (self);
+  if (name && sscanf (name, "sink_%u", &index) == 1) {
+    if (index >= self->next_pad)
+      self->next_pad = index + 1;
+  } else {
+    index = self->next_pad++;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  stream = g_new0 (GstMppMultiDecStream, 1);
+  stream->self = self;
+  stream->flow_ret = GST_FLOW_OK;
+
+  pad_name = g_strdup_printf ("sink_%u", index);
+  stream->sinkpad = gst_pad_new_from_template (templ, pad_name);
+  g_free (pad_name);
+
+  pad_name = g_strdup_printf ("src_%u", index);
+  stream->srcpad = gst_pad_new_from_template (gst_element_class_get_pad_template
+      (klass, "src_%u"), pad_name);
+  g_free (pad_name);
+
+  gst_pad_set_element_private (stream->sinkpad, stream);
+  gst_pad_set_element_private (stream->srcpad, stream);
+
+  gst_pad_set_chain_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_chain));
+  gst_pad_set_event_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_sink_event));
+  gst_pad_set_query_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_sink_query));
+
+  gst_pad_set_event_function (stream->srcpad,
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_src_event));
+  gst_pad_set_query_function (stream->srcpad,
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_src_query));
+  gst_pad_use_fixed_caps (stream->srcpad);
+
+  g_mutex_lock (&self->mutex);
+  g_ptr_array_add (self->streams, stream);
+  g_mutex_unlock (&self->mutex);
+
+  if (GST_STATE (self) >= GST_STATE_PAUSED) {
+    gst_pad_set_active (stream->srcpad, TRUE);
+    gst_pad_set_active (stream->sinkpad, TRUE);
+  }
+
+  gst_element_add_pad (element, stream->srcpad);
+  gst_element_add_pad (element, stream->sinkpad);
+
+  GST_DEBUG_OBJECT (self, "added stream %d", index);
+
+  return stream->sinkpad;
+}
+
+static void
+gst_mpp_multi_dec_release_pad (GstElement * element, GstPad * pad)
+{
+  GstMppMultiDec *self = GST_MPP_MULTI_DEC (element);
+  GstMppMultiDecStream *stream = gst_pad_get_element_private (pad);
+
+  GST_DEBUG_OBJECT (self, "releasing %" GST_PTR_FORMAT, pad);
+
+  /* Stop the streaming thread, it would give up waiting for MPP */
+  stream->flushing = TRUE;
+  gst_pad_set_active (stream->sinkpad, FALSE);
+
+  /* No new polling of the stream */
+  g_mutex_lock (&self->mutex);
+  g_ptr_array_remove (self->streams, stream);
+  self->next_stream = 0;
+  g_mutex_unlock (&self->mutex);
+
+  /* Unblock the pushing output thread, and wait for it to leave */
+  gst_pad_set_active (stream->srcpad, FALSE);
+
+  gst_mpp_multi_dec_stream_deinit (stream);
+
+  gst_element_remove_pad (element, stream->srcpad);
+  gst_element_remove_pad (element, stream->sinkpad);
+
+  g_free (stream);
+}
+
+static GstStateChangeReturn
+gst_mpp_multi_dec_change_state (GstElement * element, GstStateChange transition)
+{
+  GstMppMultiDec *self = GST_MPP_MULTI_DEC (element);
+  GstStateChangeReturn ret;
+  guint i;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      self->allocator = gst_mpp_allocator_new ();
+      if (!self->allocator) {
+        GST_ERROR_OBJECT (self, "failed to create mpp allocator");
+        return GST_STATE_CHANGE_FAILURE;
+      }
+
+      gst_mpp_multi_dec_start_threads (self);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_mpp_multi_dec_stop_threads (self);
+
+      for (i = 0; i < self->streams->len; i++)
+        gst_mpp_multi_dec_stream_deinit (g_ptr_array_index (self->streams,
+                i));
+
+      if (self->allocator) {
+        gst_mpp_allocator_set_cacheable (self->allocator, FALSE);
+        gst_object_unref (self->allocator);
+        self->allocator = NULL;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static void
+gst_mpp_multi_dec_init (GstMppMultiDec * self)
+{
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  g_cond_init (&self->busy_cond);
+
+  self->streams = g_ptr_array_new ();
+  self->n_threads = DEFAULT_PROP_OUTPUT_THREADS;
+}
+
+static void
+gst_mpp_multi_dec_finalize (GObject * object)
+{
+  GstMppMultiDec *self = GST_MPP_MULTI_DEC (object);
+
+  g_ptr_array_unref (self->streams);
+
+  g_cond_clear (&self->busy_cond);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->mutex);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_mpp_multi_dec_class_init (GstMppMultiDecClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, "mppmultidec", 0,
+      "MPP multi-stream decoder");
+
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_finalize);
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_set_property);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_get_property);
+
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_THREADS,
+      g_param_spec_uint ("output-threads", "Output threads",
+          "Number of threads polling decoded frames of all streams",
+          1, 16, DEFAULT_PROP_OUTPUT_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  element_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_request_new_pad);
+  element_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_release_pad);
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_mpp_multi_dec_change_state);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_mpp_multi_dec_src_template));
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_mpp_multi_dec_sink_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "Rockchip's MPP multi-stream video decoder", "Decoder/Video",
+      "Multi-stream hardware decoder with shared output threads",
+      "Jeffy Chen <jeffy.chen@rock-chips.com>");
+}
+
+gboolean
+gst_mpp_multi_dec_register (GstPlugin * plugin, guint rank)
+{
+  return gst_element_register (plugin, "mppmultidec", rank,
+      gst_mpp_multi_dec_get_type ());
+}
@@ -39,6 +39,29 @@ struct _GstMppVideoDec
   GstMppDec parent;
 
   gint poll_timeout;
+
+#ifdef HAVE_RGA
+  /* hardware scaled preview output */
+  GstPad *preview_pad;
+  GstVideoFormat preview_format;
+  guint preview_width;
+  guint preview_height;
+
+  GstVideoInfo preview_info;
+  GstSegment preview_segment;
+  gboolean preview_need_stream_start;
+  gboolean preview_need_caps;
+  gboolean preview_need_segment;
+
+  /* preview buffers, recycled for the negotiated preview info */
+  GstBufferPool *preview_pool;
+
+  /* converted in the same RGA job with the main output */
+  GstBuffer *preview_buf;
+
+  /* waiting for its RGA job, pushed along with the main pending frame */
+  GstBuffer *preview_pending;
+#endif
 };
 
 #define parent_class gst_mpp_video_dec_parent_class
@@ -48,12 +71,22 @@ G_DEFINE_TYPE (GstMppVideoDec, gst_mpp_video_dec, GST_TYPE_MPP_DEC);
 static GstVideoFormat DEFAULT_PROP_FORMAT = GST_VIDEO_FORMAT_UNKNOWN;
 /* Disable ARM AFBC by default */
 static GstVideoFormat DEFAULT_PROP_ARM_AFBC = FALSE;
+/* Disable low latency by default */
+static gboolean DEFAULT_PROP_LOW_LATENCY = FALSE;
+
+#define DEFAULT_PROP_PREVIEW_FORMAT GST_VIDEO_FORMAT_NV12
+#define DEFAULT_PROP_PREVIEW_WIDTH 640
+#define DEFAULT_PROP_PREVIEW_HEIGHT 360
 
 enum
 {
   PROP_0,
   PROP_FORMAT,
   PROP_ARM_AFBC,
+  PROP_LOW_LATENCY,
+  PROP_PREVIEW_FORMAT,
+  PROP_PREVIEW_WIDTH,
+  PROP_PREVIEW_HEIGHT,
   PROP_LAST,
 };
 
@@ -78,7 +111,16 @@ static GstStaticPadTemplate gst_mpp_video_dec_src_template =
         MPP_DEC_CAPS_MAKE_AFBC ("{" MPP_DEC_FORMATS "}") ";")
     );
 
-static MppCodingType
+#ifdef HAVE_RGA
+static GstStaticPadTemplate gst_mpp_video_dec_preview_template =
+    GST_STATIC_PAD_TEMPLATE ("src_preview",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (MPP_DEC_CAPS_MAKE ("{" GST_RGA_FORMATS "}") ";")
+    );
+#endif
+
+MppCodingType
 gst_mpp_video_dec_get_mpp_type (GstStructure * s)
 {
   if (gst_structure_has_name (s, "video/x-h263"))
@@ -123,6 +165,9 @@ gst_mpp_video_dec_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec)
 {
   GstVideoDecoder *decoder = GST_VIDEO_DECODER (object);
+#ifdef HAVE_RGA
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+#endif
   GstMppDec *mppdec = GST_MPP_DEC (decoder);
 
   switch (prop_id) {
@@ -140,6 +185,36 @@ gst_mpp_video_dec_set_property (GObject * object,
         mppdec->arm_afbc = g_value_get_boolean (value);
       break;
     }
+    case PROP_LOW_LATENCY:{
+      if (mppdec->input_state)
+        GST_WARNING_OBJECT (decoder, "unable to change low latency mode");
+      else
+        mppdec->low_latency = g_value_get_boolean (value);
+      break;
+    }
+#ifdef HAVE_RGA
+    case PROP_PREVIEW_FORMAT:{
+      if (mppdec->input_state)
+        GST_WARNING_OBJECT (decoder, "unable to change preview format");
+      else
+        self->preview_format = g_value_get_enum (value);
+      break;
+    }
+    case PROP_PREVIEW_WIDTH:{
+      if (mppdec->input_state)
+        GST_WARNING_OBJECT (decoder, "unable to change preview width");
+      else
+        self->preview_width = g_value_get_uint (value);
+      break;
+    }
+    case PROP_PREVIEW_HEIGHT:{
+      if (mppdec->input_state)
+        GST_WARNING_OBJECT (decoder, "unable to change preview height");
+      else
+        self->preview_height = g_value_get_uint (value);
+      break;
+    }
+#endif
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       return;
@@ -151,6 +226,9 @@ gst_mpp_video_dec_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec)
 {
   GstVideoDecoder *decoder = GST_VIDEO_DECODER (object);
+#ifdef HAVE_RGA
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+#endif
   GstMppDec *mppdec = GST_MPP_DEC (decoder);
 
   switch (prop_id) {
@@ -160,6 +238,20 @@ gst_mpp_video_dec_get_property (GObject * object,
     case PROP_ARM_AFBC:
       g_value_set_boolean (value, mppdec->arm_afbc);
       break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, mppdec->low_latency);
+      break;
+#ifdef HAVE_RGA
+    case PROP_PREVIEW_FORMAT:
+      g_value_set_enum (value, self->preview_format);
+      break;
+    case PROP_PREVIEW_WIDTH:
+      g_value_set_uint (value, self->preview_width);
+      break;
+    case PROP_PREVIEW_HEIGHT:
+      g_value_set_uint (value, self->preview_height);
+      break;
+#endif
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -301,6 +393,415 @@ gst_mpp_video_dec_shutdown (GstVideoDecoder * decoder, gboolean drain)
   return TRUE;
 }
 
+#ifdef HAVE_RGA
+/* Sticky events are sent lazily, the pad might be (re)activated anytime */
+static void
+gst_mpp_video_dec_preview_reset (GstMppVideoDec * self)
+{
+  self->preview_need_stream_start = TRUE;
+  self->preview_need_caps = TRUE;
+  self->preview_need_segment = TRUE;
+  gst_segment_init (&self->preview_segment, GST_FORMAT_UNDEFINED);
+}
+
+static void
+gst_mpp_video_dec_preview_start_stream (GstMppVideoDec * self, GstPad * pad)
+{
+  gchar *stream_id;
+
+  if (!self->preview_need_stream_start)
+    return;
+
+  stream_id = gst_pad_create_stream_id (pad, GST_ELEMENT (self), "preview");
+  gst_pad_push_event (pad, gst_event_new_stream_start (stream_id));
+  g_free (stream_id);
+
+  self->preview_need_stream_start = FALSE;
+}
+
+static void
+gst_mpp_video_dec_preview_drop (GstBuffer ** buffer)
+{
+  if (!*buffer)
+    return;
+
+  /* The RGA must be done with it before recycling */
+  gst_mpp_memory_wait_fence (gst_buffer_peek_memory (*buffer, 0));
+  gst_buffer_replace (buffer, NULL);
+}
+
+static void
+gst_mpp_video_dec_preview_clear (GstMppVideoDec * self)
+{
+  gst_mpp_video_dec_preview_drop (&self->preview_buf);
+  gst_mpp_video_dec_preview_drop (&self->preview_pending);
+}
+
+static void
+gst_mpp_video_dec_preview_clear_pool (GstMppVideoDec * self)
+{
+  gst_mpp_video_dec_preview_clear (self);
+
+  if (self->preview_pool) {
+    gst_buffer_pool_set_active (self->preview_pool, FALSE);
+    gst_object_unref (self->preview_pool);
+    self->preview_pool = NULL;
+  }
+}
+
+static GstBuffer *
+gst_mpp_video_dec_preview_acquire (GstVideoDecoder * decoder)
+{
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+  GstMppDec *mppdec = GST_MPP_DEC (decoder);
+  GstBufferPoolAcquireParams params = { 0, };
+  GstVideoInfo *info = &self->preview_info;
+  GstBuffer *buffer = NULL;
+  GstStructure *config;
+  GstMemory *mem;
+  GstCaps *caps;
+
+  if (!self->preview_pool) {
+    caps = gst_video_info_to_caps (info);
+
+    self->preview_pool = gst_buffer_pool_new ();
+    config = gst_buffer_pool_get_config (self->preview_pool);
+    gst_buffer_pool_config_set_params (config, caps,
+        GST_VIDEO_INFO_SIZE (info), 2, 0);
+    gst_buffer_pool_config_set_allocator (config, mppdec->allocator, NULL);
+    gst_caps_unref (caps);
+
+    if (!gst_buffer_pool_set_config (self->preview_pool, config) ||
+        !gst_buffer_pool_set_active (self->preview_pool, TRUE)) {
+      GST_WARNING_OBJECT (self, "failed to setup preview pool");
+      gst_object_unref (self->preview_pool);
+      self->preview_pool = NULL;
+    }
+  }
+
+  if (self->preview_pool) {
+    /* Never block the output thread on the preview's downstream */
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    if (gst_buffer_pool_acquire_buffer (self->preview_pool, &buffer,
+            &params) == GST_FLOW_OK)
+      return buffer;
+  }
+
+  /* Pool exhausted or unusable */
+  mem = gst_allocator_alloc (mppdec->allocator, GST_VIDEO_INFO_SIZE (info),
+      NULL);
+  if (!mem)
+    return NULL;
+
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer, mem);
+  return buffer;
+}
+
+static gboolean
+gst_mpp_video_dec_preview_negotiate (GstVideoDecoder * decoder)
+{
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+  GstMppDec *mppdec = GST_MPP_DEC (decoder);
+  GstVideoInfo *info = &self->preview_info;
+  GstVideoFormat format = self->preview_format;
+  GstCaps *caps;
+  gboolean ret;
+
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    format = DEFAULT_PROP_PREVIEW_FORMAT;
+
+  gst_video_info_set_format (info, format,
+      self->preview_width, self->preview_height);
+  GST_VIDEO_INFO_FPS_N (info) = GST_VIDEO_INFO_FPS_N (&mppdec->info);
+  GST_VIDEO_INFO_FPS_D (info) = GST_VIDEO_INFO_FPS_D (&mppdec->info);
+
+  if (!gst_mpp_video_info_align (info, 0, 0))
+    return FALSE;
+
+  GST_INFO_OBJECT (self, "preview %s %dx%d",
+      gst_mpp_video_format_to_string (format),
+      GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info));
+
+  /* The pool is created for the new info on demand */
+  gst_mpp_video_dec_preview_clear_pool (self);
+
+  caps = gst_video_info_to_caps (info);
+  ret = gst_pad_push_event (self->preview_pad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  return ret;
+}
+
+static void
+gst_mpp_video_dec_preview_push (GstMppVideoDec * self, GstBuffer * buffer)
+{
+  GstFlowReturn ret;
+
+  if (!gst_mpp_memory_wait_fence (gst_buffer_peek_memory (buffer, 0))) {
+    GST_WARNING_OBJECT (self, "failed to convert preview");
+    gst_buffer_unref (buffer);
+    return;
+  }
+
+  ret = gst_pad_push (self->preview_pad, buffer);
+  if (ret != GST_FLOW_OK && ret != GST_FLOW_NOT_LINKED &&
+      ret != GST_FLOW_FLUSHING)
+    GST_WARNING_OBJECT (self, "failed to push preview: %s",
+        gst_flow_get_name (ret));
+}
+
+static void
+gst_mpp_video_dec_output_mpp_frame (GstVideoDecoder * decoder,
+    MppFrame mframe, GstClockTime pts, GstClockTime duration)
+{
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+  GstMppDec *mppdec = GST_MPP_DEC (decoder);
+  GstVideoInfo *info = &self->preview_info;
+  GstSegment *segment;
+  GstBuffer *buffer;
+  GstMemory *mem;
+  MppFrameFormat mpp_format = mpp_frame_get_fmt (mframe);
+
+  if (!self->preview_pad || !mppdec->allocator)
+    return;
+
+  /* RGA can't handle compressed or cropped frames */
+  if (MPP_FRAME_FMT_IS_FBC (mpp_format) ||
+      gst_mpp_mpp_format_to_gst_format (mpp_format) ==
+      GST_VIDEO_FORMAT_UNKNOWN || mpp_frame_get_offset_x (mframe) ||
+      mpp_frame_get_offset_y (mframe))
+    return;
+
+  gst_mpp_video_dec_preview_start_stream (self, self->preview_pad);
+
+  if (self->preview_need_caps) {
+    if (!gst_mpp_video_dec_preview_negotiate (decoder)) {
+      GST_WARNING_OBJECT (self, "failed to negotiate preview");
+      return;
+    }
+
+    self->preview_need_caps = FALSE;
+  }
+
+  /* Follow the segment of the main output */
+  segment = &decoder->output_segment;
+  if (self->preview_need_segment ||
+      !gst_segment_is_equal (&self->preview_segment, segment)) {
+    gst_segment_copy_into (segment, &self->preview_segment);
+    gst_pad_push_event (self->preview_pad,
+        gst_event_new_segment (&self->preview_segment));
+    self->preview_need_segment = FALSE;
+  }
+
+  buffer = self->preview_buf;
+  self->preview_buf = NULL;
+
+  if (!buffer) {
+    buffer = gst_mpp_video_dec_preview_acquire (decoder);
+    if (!buffer)
+      return;
+
+    mem = gst_buffer_peek_memory (buffer, 0);
+    if (!gst_mpp_rga_convert_from_mpp_frame (mframe, mem, info, 0)) {
+      GST_WARNING_OBJECT (self, "failed to convert preview");
+      gst_buffer_unref (buffer);
+      return;
+    }
+  }
+
+  gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info),
+      GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info),
+      GST_VIDEO_INFO_N_PLANES (info), info->offset, info->stride);
+
+  GST_BUFFER_PTS (buffer) = pts;
+  GST_BUFFER_DURATION (buffer) = duration;
+
+  /* Don't wait for the RGA job here, but along with the main output */
+  if (mppdec->pending_frame &&
+      gst_mpp_memory_has_fence (gst_buffer_peek_memory (buffer, 0))) {
+    gst_mpp_video_dec_preview_drop (&self->preview_pending);
+    self->preview_pending = buffer;
+    return;
+  }
+
+  gst_mpp_video_dec_preview_push (self, buffer);
+}
+
+static void
+gst_mpp_video_dec_finish_pending (GstVideoDecoder * decoder, gboolean drop)
+{
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+  GstBuffer *buffer = self->preview_pending;
+
+  if (!buffer)
+    return;
+
+  self->preview_pending = NULL;
+
+  if (drop || !self->preview_pad) {
+    gst_mpp_video_dec_preview_drop (&buffer);
+    return;
+  }
+
+  gst_mpp_video_dec_preview_push (self, buffer);
+}
+
+/* Add the preview conversion into the main output's RGA job */
+static void
+gst_mpp_video_dec_fill_rga_batch (GstVideoDecoder * decoder,
+    MppFrame mframe, GstMppRgaBatch * batch)
+{
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+  GstVideoInfo *info = &self->preview_info;
+  GstBuffer *buffer;
+
+  gst_mpp_video_dec_preview_clear (self);
+
+  if (!self->preview_pad || self->preview_need_caps)
+    return;
+
+  buffer = gst_mpp_video_dec_preview_acquire (decoder);
+  if (!buffer)
+    return;
+
+  if (!gst_mpp_rga_batch_add_mpp_frame (batch, mframe, NULL,
+          gst_buffer_peek_memory (buffer, 0), info, NULL, 0)) {
+    gst_buffer_unref (buffer);
+    return;
+  }
+
+  self->preview_buf = buffer;
+}
+
+/* The main output's RGA job failed, the preview is left unconverted */
+static void
+gst_mpp_video_dec_cancel_rga_batch (GstVideoDecoder * decoder)
+{
+  gst_mpp_video_dec_preview_clear (GST_MPP_VIDEO_DEC (decoder));
+}
+
+static gboolean
+gst_mpp_video_dec_sink_event (GstVideoDecoder * decoder, GstEvent * event)
+{
+  GstVideoDecoderClass *pclass = GST_VIDEO_DECODER_CLASS (parent_class);
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+  GstPad *preview_pad;
+  GstEventType type = GST_EVENT_TYPE (event);
+  gboolean ret;
+
+  GST_OBJECT_LOCK (self);
+  preview_pad = self->preview_pad ? gst_object_ref (self->preview_pad) : NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!preview_pad)
+    return pclass->sink_event (decoder, event);
+
+  if (type == GST_EVENT_FLUSH_START)
+    gst_pad_push_event (preview_pad, gst_event_ref (event));
+
+  if (type == GST_EVENT_FLUSH_STOP)
+    gst_event_ref (event);
+
+  /* The parent class drains the decoder on EOS */
+  ret = pclass->sink_event (decoder, event);
+
+  switch (type) {
+    case GST_EVENT_FLUSH_STOP:
+      gst_pad_push_event (preview_pad, event);
+      self->preview_need_segment = TRUE;
+      break;
+    case GST_EVENT_EOS:
+      gst_mpp_video_dec_preview_start_stream (self, preview_pad);
+      gst_pad_push_event (preview_pad, gst_event_new_eos ());
+      break;
+    default:
+      break;
+  }
+
+  gst_object_unref (preview_pad);
+  return ret;
+}
+
+static GstPad *
+gst_mpp_video_dec_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name UNUSED,
+    const GstCaps * caps UNUSED)
+{
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (element);
+  GstPad *pad;
+
+  GST_OBJECT_LOCK (self);
+  if (self->preview_pad) {
+    GST_OBJECT_UNLOCK (self);
+    GST_WARNING_OBJECT (self, "preview pad already requested");
+    return NULL;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  pad = gst_pad_new_from_template (templ, "src_preview");
+  gst_pad_use_fixed_caps (pad);
+
+  if (GST_STATE (self) >= GST_STATE_PAUSED)
+    gst_pad_set_active (pad, TRUE);
+
+  gst_element_add_pad (element, pad);
+
+  /* The sticky events come with the first preview frame */
+  GST_VIDEO_DECODER_STREAM_LOCK (element);
+  gst_mpp_video_dec_preview_reset (self);
+  GST_VIDEO_DECODER_STREAM_UNLOCK (element);
+
+  GST_OBJECT_LOCK (self);
+  self->preview_pad = pad;
+  GST_OBJECT_UNLOCK (self);
+
+  return pad;
+}
+
+static void
+gst_mpp_video_dec_release_pad (GstElement * element, GstPad * pad)
+{
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (element);
+
+  GST_VIDEO_DECODER_STREAM_LOCK (element);
+  GST_OBJECT_LOCK (self);
+  if (self->preview_pad == pad)
+    self->preview_pad = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_mpp_video_dec_preview_clear_pool (self);
+  GST_VIDEO_DECODER_STREAM_UNLOCK (element);
+
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
+}
+
+static gboolean
+gst_mpp_video_dec_start (GstVideoDecoder * decoder)
+{
+  GstVideoDecoderClass *pclass = GST_VIDEO_DECODER_CLASS (parent_class);
+
+  gst_mpp_video_dec_preview_reset (GST_MPP_VIDEO_DEC (decoder));
+
+  return pclass->start (decoder);
+}
+
+static gboolean
+gst_mpp_video_dec_stop (GstVideoDecoder * decoder)
+{
+  GstVideoDecoderClass *pclass = GST_VIDEO_DECODER_CLASS (parent_class);
+  GstMppVideoDec *self = GST_MPP_VIDEO_DEC (decoder);
+
+  /* The pad's sticky events are cleared by the deactivation */
+  gst_mpp_video_dec_preview_reset (self);
+  gst_mpp_video_dec_preview_clear_pool (self);
+
+  return pclass->stop (decoder);
+}
+#endif
+
 #define GST_TYPE_MPP_VIDEO_DEC_FORMAT (gst_mpp_video_dec_format_get_type ())
 static GType
 gst_mpp_video_dec_format_get_type (void)
@@ -336,6 +837,14 @@ gst_mpp_video_dec_init (GstMppVideoDec * self)
   GstMppDec *mppdec = GST_MPP_DEC (self);
   mppdec->format = DEFAULT_PROP_FORMAT;
   mppdec->arm_afbc = DEFAULT_PROP_ARM_AFBC;
+  mppdec->low_latency = DEFAULT_PROP_LOW_LATENCY;
+
+#ifdef HAVE_RGA
+  self->preview_format = DEFAULT_PROP_PREVIEW_FORMAT;
+  self->preview_width = DEFAULT_PROP_PREVIEW_WIDTH;
+  self->preview_height = DEFAULT_PROP_PREVIEW_HEIGHT;
+  gst_mpp_video_dec_preview_reset (self);
+#endif
 }
 
 static void
@@ -378,6 +887,25 @@ gst_mpp_video_dec_class_init (GstMppVideoDecClass * klass)
   pclass->poll_mpp_frame = GST_DEBUG_FUNCPTR (gst_mpp_video_dec_poll_mpp_frame);
   pclass->shutdown = GST_DEBUG_FUNCPTR (gst_mpp_video_dec_shutdown);
 
+#ifdef HAVE_RGA
+  pclass->output_mpp_frame =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_dec_output_mpp_frame);
+  pclass->finish_pending =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_dec_finish_pending);
+  pclass->fill_rga_batch = GST_DEBUG_FUNCPTR (gst_mpp_video_dec_fill_rga_batch);
+  pclass->cancel_rga_batch =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_dec_cancel_rga_batch);
+
+  decoder_class->start = GST_DEBUG_FUNCPTR (gst_mpp_video_dec_start);
+  decoder_class->stop = GST_DEBUG_FUNCPTR (gst_mpp_video_dec_stop);
+  decoder_class->sink_event = GST_DEBUG_FUNCPTR (gst_mpp_video_dec_sink_event);
+
+  element_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_dec_request_new_pad);
+  element_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_dec_release_pad);
+#endif
+
   gobject_class->set_property =
       GST_DEBUG_FUNCPTR (gst_mpp_video_dec_set_property);
   gobject_class->get_property =
@@ -391,6 +919,27 @@ gst_mpp_video_dec_class_init (GstMppVideoDecClass * klass)
           "Prefered output format",
           GST_TYPE_MPP_VIDEO_DEC_FORMAT, DEFAULT_PROP_FORMAT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PREVIEW_FORMAT,
+      g_param_spec_enum ("preview-format", "Preview format",
+          "Output format of the src_preview pad (auto for NV12)",
+          GST_TYPE_MPP_VIDEO_DEC_FORMAT, DEFAULT_PROP_PREVIEW_FORMAT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PREVIEW_WIDTH,
+      g_param_spec_uint ("preview-width", "Preview width",
+          "Width of the src_preview pad", 16, G_MAXINT,
+          DEFAULT_PROP_PREVIEW_WIDTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PREVIEW_HEIGHT,
+      g_param_spec_uint ("preview-height", "Preview height",
+          "Height of the src_preview pad", 16, G_MAXINT,
+          DEFAULT_PROP_PREVIEW_HEIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_mpp_video_dec_preview_template));
 #endif
 
   if (g_getenv ("GST_MPP_VIDEODEC_DEFAULT_ARM_AFBC"))
@@ -401,6 +950,15 @@ gst_mpp_video_dec_class_init (GstMppVideoDecClass * klass)
           "Prefer ARM AFBC compressed format", DEFAULT_PROP_ARM_AFBC,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  if (g_getenv ("GST_MPP_VIDEODEC_DEFAULT_LOW_LATENCY"))
+    DEFAULT_PROP_LOW_LATENCY = TRUE;
+
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Output frames immediately without reordering and fast mode "
+          "parser buffering", DEFAULT_PROP_LOW_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_mpp_video_dec_src_template));
 
@@ -33,6 +33,8 @@ G_BEGIN_DECLS;
 G_DECLARE_FINAL_TYPE (GstMppVideoDec, gst_mpp_video_dec, GST,
     MPP_VIDEO_DEC, GstMppDec);
 
+MppCodingType gst_mpp_video_dec_get_mpp_type (GstStructure * s);
+
 gboolean gst_mpp_video_dec_register (GstPlugin * plugin, guint rank);
 
 G_END_DECLS;
@@ -0,0 +1,736 @@
+/*
+ * Copyright 2021 Rockchip Electronics Co., Ltd
+ *     Author: Jeffy Chen <jeffy.chen@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Compositing the sink pads' frames into dma-buf output buffers with RGA.
+ *
+ * The dma-buf inputs are imported without mapping, and every output
+ * memory remembers the layers it holds, so that only the regions whose
+ * layers changed since then are recomposed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/allocators/gstdmabuf.h>
+
+#include "gstmppallocator.h"
+#include "gstrgacompositor.h"
+
+#define GST_CAT_DEFAULT rga_compositor_debug
+GST_DEBUG_CATEGORY (GST_CAT_DEFAULT);
+
+/* Opaque black in RGBA8888 */
+#define RGA_COMPOSITOR_BACKGROUND 0xff000000
+
+struct _GstRgaCompositorPad
+{
+  GstVideoAggregatorPad parent;
+
+  gint xpos;
+  gint ypos;
+  gint width;
+  gint height;
+  gdouble alpha;
+
+  /* Held, so that a recycled buffer can't be taken for the last one */
+  GstBuffer *last_buffer;
+  /* Renumbered whenever the current buffer changes */
+  guint64 serial;
+};
+
+struct _GstRgaCompositor
+{
+  GstVideoAggregator parent;
+
+  GstAllocator *allocator;
+
+  /* aligned output video info */
+  GstVideoInfo info;
+
+  /* Source of the pads' frame serials, unique across pads */
+  guint64 serial;
+};
+
+/* A composited pad's frame, recorded on the output memory holding it */
+typedef struct
+{
+  /* only valid while compositing, cleared once recorded */
+  GstRgaCompositorPad *pad;
+  GstBuffer *buffer;
+
+  /* unique across pads, so that it identifies the pad as well */
+  guint64 serial;
+
+  GstVideoRectangle rect;
+  guint8 alpha;
+} GstRgaCompositorLayer;
+
+#define DEFAULT_PAD_XPOS 0
+#define DEFAULT_PAD_YPOS 0
+#define DEFAULT_PAD_WIDTH 0
+#define DEFAULT_PAD_HEIGHT 0
+#define DEFAULT_PAD_ALPHA 1.0
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_XPOS,
+  PROP_PAD_YPOS,
+  PROP_PAD_WIDTH,
+  PROP_PAD_HEIGHT,
+  PROP_PAD_ALPHA,
+  PROP_PAD_LAST,
+};
+
+#define GST_RGA_COMPOSITOR_CAPS \
+    GST_VIDEO_CAPS_MAKE ("{" GST_RGA_FORMATS "}") ";"
+
+static GstStaticPadTemplate gst_rga_compositor_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (GST_RGA_COMPOSITOR_CAPS));
+
+static GstStaticPadTemplate gst_rga_compositor_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_RGA_COMPOSITOR_CAPS));
+
+G_DEFINE_TYPE (GstRgaCompositorPad, gst_rga_compositor_pad,
+    GST_TYPE_VIDEO_AGGREGATOR_PAD);
+
+static void
+gst_rga_compositor_pad_get_output_size (GstRgaCompositorPad * pad,
+    gint * width, gint * height)
+{
+  GstVideoInfo *info = &GST_VIDEO_AGGREGATOR_PAD (pad)->info;
+
+  /* Default to the input size */
+  *width = pad->width ? pad->width : GST_VIDEO_INFO_WIDTH (info);
+  *height = pad->height ? pad->height : GST_VIDEO_INFO_HEIGHT (info);
+}
+
+static gboolean
+gst_rga_compositor_pad_prepare_frame (GstVideoAggregatorPad * pad UNUSED,
+    GstVideoAggregator * vagg UNUSED, GstBuffer * buffer UNUSED,
+    GstVideoFrame * prepared_frame UNUSED)
+{
+  /* The buffers are passed to RGA as they are, no mapping */
+  return TRUE;
+}
+
+static void
+gst_rga_compositor_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstRgaCompositorPad *pad = GST_RGA_COMPOSITOR_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+
+  switch (prop_id) {
+    case PROP_PAD_XPOS:
+      pad->xpos = g_value_get_int (value);
+      break;
+    case PROP_PAD_YPOS:
+      pad->ypos = g_value_get_int (value);
+      break;
+    case PROP_PAD_WIDTH:
+      pad->width = g_value_get_int (value);
+      break;
+    case PROP_PAD_HEIGHT:
+      pad->height = g_value_get_int (value);
+      break;
+    case PROP_PAD_ALPHA:
+      pad->alpha = g_value_get_double (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_rga_compositor_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstRgaCompositorPad *pad = GST_RGA_COMPOSITOR_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+
+  switch (prop_id) {
+    case PROP_PAD_XPOS:
+      g_value_set_int (value, pad->xpos);
+      break;
+    case PROP_PAD_YPOS:
+      g_value_set_int (value, pad->ypos);
+      break;
+    case PROP_PAD_WIDTH:
+      g_value_set_int (value, pad->width);
+      break;
+    case PROP_PAD_HEIGHT:
+      g_value_set_int (value, pad->height);
+      break;
+    case PROP_PAD_ALPHA:
+      g_value_set_double (value, pad->alpha);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_rga_compositor_pad_finalize (GObject * object)
+{
+  GstRgaCompositorPad *pad = GST_RGA_COMPOSITOR_PAD (object);
+
+  gst_buffer_replace (&pad->last_buffer, NULL);
+
+  G_OBJECT_CLASS (gst_rga_compositor_pad_parent_class)->finalize (object);
+}
+
+static void
+gst_rga_compositor_pad_init (GstRgaCompositorPad * pad)
+{
+  pad->xpos = DEFAULT_PAD_XPOS;
+  pad->ypos = DEFAULT_PAD_YPOS;
+  pad->width = DEFAULT_PAD_WIDTH;
+  pad->height = DEFAULT_PAD_HEIGHT;
+  pad->alpha = DEFAULT_PAD_ALPHA;
+}
+
+static void
+gst_rga_compositor_pad_class_init (GstRgaCompositorPadClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstVideoAggregatorPadClass *vaggpad_class =
+      GST_VIDEO_AGGREGATOR_PAD_CLASS (klass);
+
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_rga_compositor_pad_set_property);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_rga_compositor_pad_get_property);
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_rga_compositor_pad_finalize);
+
+  g_object_class_install_property (gobject_class, PROP_PAD_XPOS,
+      g_param_spec_int ("xpos", "X Position", "X position of the picture",
+          0, G_MAXINT, DEFAULT_PAD_XPOS,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_YPOS,
+      g_param_spec_int ("ypos", "Y Position", "Y position of the picture",
+          0, G_MAXINT, DEFAULT_PAD_YPOS,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_WIDTH,
+      g_param_spec_int ("width", "Width",
+          "Width of the picture (0 = input width)",
+          0, G_MAXINT, DEFAULT_PAD_WIDTH,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_HEIGHT,
+      g_param_spec_int ("height", "Height",
+          "Height of the picture (0 = input height)",
+          0, G_MAXINT, DEFAULT_PAD_HEIGHT,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_ALPHA,
+      g_param_spec_double ("alpha", "Alpha", "Alpha of the picture",
+          0.0, 1.0, DEFAULT_PAD_ALPHA,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+
+  vaggpad_class->prepare_frame =
+      GST_DEBUG_FUNCPTR (gst_rga_compositor_pad_prepare_frame);
+}
+
+#define parent_class gst_rga_compositor_parent_class
+G_DEFINE_TYPE (GstRgaCompositor, gst_rga_compositor,
+    GST_TYPE_VIDEO_AGGREGATOR);
+
+static gboolean
+gst_rga_compositor_rect_intersect (GstVideoRectangle * a,
+    GstVideoRectangle * b, GstVideoRectangle * rect)
+{
+  gint x1 = MAX (a->x, b->x);
+  gint y1 = MAX (a->y, b->y);
+  gint x2 = MIN (a->x + a->w, b->x + b->w);
+  gint y2 = MIN (a->y + a->h, b->y + b->h);
+
+  if (x2 <= x1 || y2 <= y1)
+    return FALSE;
+
+  rect->x = x1;
+  rect->y = y1;
+  rect->w = x2 - x1;
+  rect->h = y2 - y1;
+  return TRUE;
+}
+
+static void
+gst_rga_compositor_rect_union (GstVideoRectangle * rect,
+    GstVideoRectangle * other)
+{
+  gint x1, y1, x2, y2;
+
+  if (!other->w || !other->h)
+    return;
+
+  if (!rect->w || !rect->h) {
+    *rect = *other;
+    return;
+  }
+
+  x1 = MIN (rect->x, other->x);
+  y1 = MIN (rect->y, other->y);
+  x2 = MAX (rect->x + rect->w, other->x + other->w);
+  y2 = MAX (rect->y + rect->h, other->y + other->h);
+
+  rect->x = x1;
+  rect->y = y1;
+  rect->w = x2 - x1;
+  rect->h = y2 - y1;
+}
+
+static GstCaps *
+gst_rga_compositor_fixate_src_caps (GstAggregator * agg, GstCaps * caps)
+{
+  GstVideoAggregator *vagg = GST_VIDEO_AGGREGATOR (agg);
+  GstStructure *s;
+  GList *l;
+  gint best_width = 0, best_height = 0;
+  gint best_fps_n = -1, best_fps_d = -1;
+  gdouble best_fps = 0.0;
+
+  caps = gst_caps_make_writable (caps);
+
+  GST_OBJECT_LOCK (vagg);
+  for (l = GST_ELEMENT (vagg)->sinkpads; l; l = l->next) {
+    GstVideoAggregatorPad *vpad = l->data;
+    GstRgaCompositorPad *pad = GST_RGA_COMPOSITOR_PAD (vpad);
+    gint fps_n, fps_d, width, height;
+    gdouble fps;
+
+    if (!GST_VIDEO_INFO_WIDTH (&vpad->info))
+      continue;
+
+    GST_OBJECT_LOCK (pad);
+    gst_rga_compositor_pad_get_output_size (pad, &width, &height);
+    best_width = MAX (best_width, pad->xpos + width);
+    best_height = MAX (best_height, pad->ypos + height);
+    GST_OBJECT_UNLOCK (pad);
+
+    fps_n = GST_VIDEO_INFO_FPS_N (&vpad->info);
+    fps_d = GST_VIDEO_INFO_FPS_D (&vpad->info);
+    if (!fps_d)
+      continue;
+
+    gst_util_fraction_to_double (fps_n, fps_d, &fps);
+    if (fps > best_fps) {
+      best_fps = fps;
+      best_fps_n = fps_n;
+      best_fps_d = fps_d;
+    }
+  }
+  GST_OBJECT_UNLOCK (vagg);
+
+  if (best_fps_n <= 0 || best_fps_d <= 0) {
+    best_fps_n = 25;
+    best_fps_d = 1;
+  }
+
+  s = gst_caps_get_structure (caps, 0);
+  gst_structure_fixate_field_nearest_int (s, "width", MAX (best_width, 1));
+  gst_structure_fixate_field_nearest_int (s, "height", MAX (best_height, 1));
+  gst_structure_fixate_field_nearest_fraction (s, "framerate", best_fps_n,
+      best_fps_d);
+
+  return gst_caps_fixate (caps);
+}
+
+static gboolean
+gst_rga_compositor_decide_allocation (GstAggregator * agg, GstQuery * query)
+{
+  GstRgaCompositor *self = GST_RGA_COMPOSITOR (agg);
+  GstVideoAggregator *vagg = GST_VIDEO_AGGREGATOR (agg);
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstCaps *caps;
+  guint min = 0, max = 0;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (!caps || !self->allocator)
+    return FALSE;
+
+  self->info = vagg->info;
+  if (!gst_mpp_video_info_align (&self->info, 0, 0))
+    return FALSE;
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, NULL, NULL, &min, &max);
+
+  /* Keep one for compositing while downstream holds the last one */
+  min = MAX (min, 2);
+  if (max)
+    max = MAX (max, min);
+
+  /* RGA needs dma-buf outputs, use our own pool */
+  pool = gst_buffer_pool_new ();
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      GST_VIDEO_INFO_SIZE (&self->info), min, max);
+  gst_buffer_pool_config_set_allocator (config, self->allocator, NULL);
+
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    GST_ERROR_OBJECT (self, "failed to config pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "output pool %" GST_PTR_FORMAT " (%d-%d)",
+      pool, min, max);
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_set_nth_allocation_pool (query, 0, pool,
+        GST_VIDEO_INFO_SIZE (&self->info), min, max);
+  else
+    gst_query_add_allocation_pool (query, pool,
+        GST_VIDEO_INFO_SIZE (&self->info), min, max);
+
+  gst_object_unref (pool);
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_rga_compositor_create_output_buffer (GstVideoAggregator * vagg,
+    GstBuffer ** outbuf)
+{
+  GstVideoAggregatorClass *pclass = GST_VIDEO_AGGREGATOR_CLASS (parent_class);
+  GstRgaCompositor *self = GST_RGA_COMPOSITOR (vagg);
+  GstVideoInfo *info = &self->info;
+  GstMemory *mem;
+  GstFlowReturn ret;
+
+  ret = pclass->create_output_buffer (vagg, outbuf);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  mem = gst_buffer_peek_memory (*outbuf, 0);
+  if (gst_buffer_n_memory (*outbuf) != 1 || !gst_is_dmabuf_memory (mem)) {
+    GST_ERROR_OBJECT (self, "output buffer is not dma-buf");
+    gst_buffer_replace (outbuf, NULL);
+    return GST_FLOW_ERROR;
+  }
+
+  gst_buffer_add_video_meta_full (*outbuf, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info), GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info), GST_VIDEO_INFO_N_PLANES (info),
+      info->offset, info->stride);
+
+  return GST_FLOW_OK;
+}
+
+/* Called with the object lock */
+static GArray *
+gst_rga_compositor_get_layers (GstRgaCompositor * self)
+{
+  GArray *layers;
+  GList *l;
+
+  layers = g_array_new (FALSE, TRUE, sizeof (GstRgaCompositorLayer));
+
+  /* The sinkpads are sorted by zorder */
+  for (l = GST_ELEMENT (self)->sinkpads; l; l = l->next) {
+    GstVideoAggregatorPad *vpad = l->data;
+    GstRgaCompositorPad *pad = GST_RGA_COMPOSITOR_PAD (vpad);
+    GstRgaCompositorLayer layer = { 0, };
+    GstVideoRectangle bounds = { 0, };
+    GstBuffer *buffer;
+    gint width, height;
+
+    if (!gst_video_aggregator_pad_has_current_buffer (vpad)) {
+      GST_OBJECT_LOCK (pad);
+      gst_buffer_replace (&pad->last_buffer, NULL);
+      GST_OBJECT_UNLOCK (pad);
+      continue;
+    }
+
+    buffer = gst_video_aggregator_pad_get_current_buffer (vpad);
+
+    GST_OBJECT_LOCK (pad);
+    /* Pooled buffers are reused with new contents (and maybe no pts), so
+     * number the frames instead of comparing buffers across outputs */
+    if (gst_buffer_replace (&pad->last_buffer, buffer))
+      pad->serial = ++self->serial;
+
+    gst_rga_compositor_pad_get_output_size (pad, &width, &height);
+    layer.serial = pad->serial;
+    layer.rect.x = pad->xpos;
+    layer.rect.y = pad->ypos;
+    layer.rect.w = width;
+    layer.rect.h = height;
+    layer.alpha = CLAMP (pad->alpha * 255 + 0.5, 0, 255);
+    GST_OBJECT_UNLOCK (pad);
+
+    bounds.w = GST_VIDEO_INFO_WIDTH (&self->info);
+    bounds.h = GST_VIDEO_INFO_HEIGHT (&self->info);
+    if (!layer.alpha ||
+        !gst_rga_compositor_rect_intersect (&layer.rect, &bounds, &bounds))
+      continue;
+
+    layer.pad = pad;
+    layer.buffer = buffer;
+
+    g_array_append_vals (layers, &layer, 1);
+  }
+
+  return layers;
+}
+
+/* Figure out the region to recompose, given what the output already has */
+static void
+gst_rga_compositor_get_dirty_rect (GstRgaCompositor * self,
+    GArray * old_layers, GArray * layers, GstVideoRectangle * dirty)
+{
+  guint i;
+
+  dirty->x = dirty->y = dirty->w = dirty->h = 0;
+
+  if (!old_layers || old_layers->len != layers->len)
+    goto full;
+
+  for (i = 0; i < layers->len; i++) {
+    GstRgaCompositorLayer *old =
+        &g_array_index (old_layers, GstRgaCompositorLayer, i);
+    GstRgaCompositorLayer *layer =
+        &g_array_index (layers, GstRgaCompositorLayer, i);
+
+    /* Restacked or replaced pads have different serials here */
+    if (old->serial == layer->serial && old->alpha == layer->alpha &&
+        !memcmp (&old->rect, &layer->rect, sizeof (layer->rect)))
+      continue;
+
+    gst_rga_compositor_rect_union (dirty, &old->rect);
+    gst_rga_compositor_rect_union (dirty, &layer->rect);
+  }
+
+  if (!dirty->w || !dirty->h)
+    return;
+
+  /* RGA requires yuv image rect align to 2 */
+  dirty->w += dirty->x & 1;
+  dirty->h += dirty->y & 1;
+  dirty->x &= ~1;
+  dirty->y &= ~1;
+  dirty->w = MIN (GST_ROUND_UP_2 (dirty->w),
+      GST_VIDEO_INFO_WIDTH (&self->info) - dirty->x);
+  dirty->h = MIN (GST_ROUND_UP_2 (dirty->h),
+      GST_VIDEO_INFO_HEIGHT (&self->info) - dirty->y);
+  return;
+
+full:
+  dirty->w = GST_VIDEO_INFO_WIDTH (&self->info);
+  dirty->h = GST_VIDEO_INFO_HEIGHT (&self->info);
+}
+
+static GstFlowReturn
+gst_rga_compositor_aggregate_frames (GstVideoAggregator * vagg,
+    GstBuffer * outbuf)
+{
+  GstRgaCompositor *self = GST_RGA_COMPOSITOR (vagg);
+  GstMppRgaBatch *batch;
+  GstMemory *mem = gst_buffer_peek_memory (outbuf, 0);
+  GArray *layers, *old_layers = NULL;
+  GstVideoRectangle dirty;
+  gboolean ret;
+  guint i;
+
+  GST_OBJECT_LOCK (vagg);
+
+  layers = gst_rga_compositor_get_layers (self);
+
+  /* Shared memory might be changed behind us, the content is also dropped
+   * when it's mapped for writing (e.g. by an in-place downstream) */
+  if (gst_memory_is_writable (mem))
+    old_layers = gst_mpp_memory_get_content (mem);
+  else
+    gst_mpp_memory_set_content (mem, NULL, NULL);
+
+  gst_rga_compositor_get_dirty_rect (self, old_layers, layers, &dirty);
+
+  if (!dirty.w || !dirty.h) {
+    GST_OBJECT_UNLOCK (vagg);
+    GST_LOG_OBJECT (self, "nothing changed");
+    g_array_unref (layers);
+    return GST_FLOW_OK;
+  }
+
+  GST_LOG_OBJECT (self, "recompose <%d,%d,%d,%d> with %d layers",
+      dirty.x, dirty.y, dirty.w, dirty.h, layers->len);
+
+  batch = gst_mpp_rga_batch_new ();
+
+  ret = gst_mpp_rga_batch_add_fill (batch, mem, &self->info, &dirty,
+      RGA_COMPOSITOR_BACKGROUND);
+
+  for (i = 0; ret && i < layers->len; i++) {
+    GstRgaCompositorLayer *layer =
+        &g_array_index (layers, GstRgaCompositorLayer, i);
+    GstVideoInfo info = GST_VIDEO_AGGREGATOR_PAD (layer->pad)->info;
+    GstVideoRectangle src_rect, dst_rect;
+    GstVideoMeta *meta;
+    gint width = GST_VIDEO_INFO_WIDTH (&info);
+    gint height = GST_VIDEO_INFO_HEIGHT (&info);
+    guint j;
+
+    if (!gst_rga_compositor_rect_intersect (&layer->rect, &dirty, &dst_rect))
+      continue;
+
+    /* Map the visible part back to the source */
+    src_rect.x = (dst_rect.x - layer->rect.x) * width / layer->rect.w;
+    src_rect.y = (dst_rect.y - layer->rect.y) * height / layer->rect.h;
+    src_rect.w = MAX (dst_rect.w * width / layer->rect.w, 1);
+    src_rect.h = MAX (dst_rect.h * height / layer->rect.h, 1);
+    src_rect.w = MIN (src_rect.w, width - src_rect.x);
+    src_rect.h = MIN (src_rect.h, height - src_rect.y);
+
+    /* Respect upstream's strides */
+    meta = gst_buffer_get_video_meta (layer->buffer);
+    if (meta) {
+      for (j = 0; j < meta->n_planes; j++) {
+        GST_VIDEO_INFO_PLANE_OFFSET (&info, j) = meta->offset[j];
+        GST_VIDEO_INFO_PLANE_STRIDE (&info, j) = meta->stride[j];
+      }
+    }
+
+    ret = gst_mpp_rga_batch_add (batch, layer->buffer, &info, &src_rect,
+        mem, &self->info, &dst_rect, 0);
+
+    if (ret && layer->alpha != 255)
+      gst_mpp_rga_batch_set_alpha (batch, layer->alpha);
+  }
+
+  GST_OBJECT_UNLOCK (vagg);
+
+  if (ret)
+    ret = gst_mpp_rga_batch_submit (batch, FALSE);
+
+  gst_mpp_rga_batch_free (batch);
+
+  if (!ret) {
+    /* Unknown content now, recompose all next time */
+    gst_mpp_memory_set_content (mem, NULL, NULL);
+    g_array_unref (layers);
+
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("failed to composite"),
+        (NULL));
+    return GST_FLOW_ERROR;
+  }
+
+  for (i = 0; i < layers->len; i++) {
+    GstRgaCompositorLayer *layer =
+        &g_array_index (layers, GstRgaCompositorLayer, i);
+
+    layer->pad = NULL;
+    layer->buffer = NULL;
+  }
+
+  if (gst_memory_is_writable (mem))
+    gst_mpp_memory_set_content (mem, layers, (GDestroyNotify) g_array_unref);
+  else
+    g_array_unref (layers);
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_rga_compositor_finalize (GObject * object)
+{
+  GstRgaCompositor *self = GST_RGA_COMPOSITOR (object);
+
+  if (self->allocator)
+    gst_object_unref (self->allocator);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_rga_compositor_init (GstRgaCompositor * self)
+{
+  self->allocator = gst_mpp_allocator_new ();
+  if (!self->allocator)
+    GST_WARNING_OBJECT (self, "failed to create MPP allocator");
+}
+
+static void
+gst_rga_compositor_class_init (GstRgaCompositorClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstAggregatorClass *agg_class = GST_AGGREGATOR_CLASS (klass);
+  GstVideoAggregatorClass *vagg_class = GST_VIDEO_AGGREGATOR_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, "rgacompositor", 0,
+      "RGA compositor");
+
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_rga_compositor_finalize);
+
+  agg_class->fixate_src_caps =
+      GST_DEBUG_FUNCPTR (gst_rga_compositor_fixate_src_caps);
+  agg_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_rga_compositor_decide_allocation);
+
+  vagg_class->create_output_buffer =
+      GST_DEBUG_FUNCPTR (gst_rga_compositor_create_output_buffer);
+  vagg_class->aggregate_frames =
+      GST_DEBUG_FUNCPTR (gst_rga_compositor_aggregate_frames);
+
+  gst_element_class_add_static_pad_template_with_gtype (element_class,
+      &gst_rga_compositor_sink_template, GST_TYPE_RGA_COMPOSITOR_PAD);
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_rga_compositor_src_template);
+
+  gst_element_class_set_static_metadata (element_class,
+      "Rockchip's RGA compositor", "Filter/Editor/Video/Compositor",
+      "Composite multiple video streams with RGA",
+      "Jeffy Chen <jeffy.chen@rock-chips.com>");
+}
+
+gboolean
+gst_rga_compositor_register (GstPlugin * plugin, guint rank)
+{
+  return gst_element_register (plugin, "rgacompositor", rank,
+      gst_rga_compositor_get_type ());
+}
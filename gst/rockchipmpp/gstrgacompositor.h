@@ -0,0 +1,43 @@
+/*
+ * Copyright 2021 Rockchip Electronics Co., Ltd
+ *     Author: Jeffy Chen <jeffy.chen@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef  __GST_RGA_COMPOSITOR_H__
+#define  __GST_RGA_COMPOSITOR_H__
+
+#include <gst/video/gstvideoaggregator.h>
+
+#include "gstmpp.h"
+
+G_BEGIN_DECLS;
+
+#define GST_TYPE_RGA_COMPOSITOR_PAD (gst_rga_compositor_pad_get_type())
+G_DECLARE_FINAL_TYPE (GstRgaCompositorPad, gst_rga_compositor_pad, GST,
+    RGA_COMPOSITOR_PAD, GstVideoAggregatorPad);
+
+#define GST_TYPE_RGA_COMPOSITOR (gst_rga_compositor_get_type())
+G_DECLARE_FINAL_TYPE (GstRgaCompositor, gst_rga_compositor, GST,
+    RGA_COMPOSITOR, GstVideoAggregator);
+
+gboolean gst_rga_compositor_register (GstPlugin * plugin, guint rank);
+
+G_END_DECLS;
+
+#endif /* __GST_RGA_COMPOSITOR_H__ */
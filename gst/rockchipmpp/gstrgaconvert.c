@@ -0,0 +1,499 @@
+/*
+ * Copyright 2021 Rockchip Electronics Co., Ltd
+ *     Author: Jeffy Chen <jeffy.chen@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Converting, scaling, cropping (with GstVideoCropMeta) and flipping
+ * video frames with RGA, from and to dma-buf without CPU copies.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/allocators/gstdmabuf.h>
+
+#include "gstmppallocator.h"
+#include "gstrgaconvert.h"
+
+#define GST_CAT_DEFAULT rga_convert_debug
+GST_DEBUG_CATEGORY (GST_CAT_DEFAULT);
+
+struct _GstRgaConvert
+{
+  GstBaseTransform parent;
+
+  GstAllocator *allocator;
+
+  GstVideoInfo in_info;
+
+  /* aligned output video info */
+  GstVideoInfo out_info;
+
+  GstVideoOrientationMethod method;
+};
+
+#define parent_class gst_rga_convert_parent_class
+G_DEFINE_TYPE (GstRgaConvert, gst_rga_convert, GST_TYPE_BASE_TRANSFORM);
+
+#define DEFAULT_PROP_VIDEO_DIRECTION GST_VIDEO_ORIENTATION_IDENTITY
+
+enum
+{
+  PROP_0,
+  PROP_VIDEO_DIRECTION,
+  PROP_LAST,
+};
+
+#define GST_RGA_CONVERT_CAPS GST_VIDEO_CAPS_MAKE ("{" GST_RGA_FORMATS "}")
+
+static GstStaticPadTemplate gst_rga_convert_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_RGA_CONVERT_CAPS));
+
+static GstStaticPadTemplate gst_rga_convert_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_RGA_CONVERT_CAPS));
+
+static gboolean
+gst_rga_convert_method_rotated (GstVideoOrientationMethod method)
+{
+  return method == GST_VIDEO_ORIENTATION_90R ||
+      method == GST_VIDEO_ORIENTATION_90L;
+}
+
+static void
+gst_rga_convert_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (object);
+  GstRgaConvert *self = GST_RGA_CONVERT (object);
+
+  switch (prop_id) {
+    case PROP_VIDEO_DIRECTION:{
+      GstVideoOrientationMethod method = g_value_get_enum (value);
+
+      if (method == GST_VIDEO_ORIENTATION_UL_LR ||
+          method == GST_VIDEO_ORIENTATION_UR_LL ||
+          method == GST_VIDEO_ORIENTATION_AUTO ||
+          method == GST_VIDEO_ORIENTATION_CUSTOM) {
+        GST_WARNING_OBJECT (self, "unsupported video direction");
+        return;
+      }
+
+      GST_OBJECT_LOCK (self);
+      if (self->method == method) {
+        GST_OBJECT_UNLOCK (self);
+        return;
+      }
+
+      self->method = method;
+      GST_OBJECT_UNLOCK (self);
+
+      gst_base_transform_reconfigure_src (trans);
+      break;
+    }
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_rga_convert_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstRgaConvert *self = GST_RGA_CONVERT (object);
+
+  switch (prop_id) {
+    case PROP_VIDEO_DIRECTION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->method);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static GstCaps *
+gst_rga_convert_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction UNUSED, GstCaps * caps, GstCaps * filter)
+{
+  GstCaps *ret;
+  GstStructure *s;
+  GstCapsFeatures *f;
+  guint i;
+
+  ret = gst_caps_new_empty ();
+
+  /* Any format and size is reachable */
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    s = gst_structure_copy (gst_caps_get_structure (caps, i));
+    f = gst_caps_features_copy (gst_caps_get_features (caps, i));
+
+    if (!gst_caps_features_is_any (f)) {
+      gst_structure_set (s, "width", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+          "height", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+      gst_structure_remove_fields (s, "format", "colorimetry", "chroma-site",
+          NULL);
+
+      if (gst_structure_has_field (s, "pixel-aspect-ratio"))
+        gst_structure_set (s, "pixel-aspect-ratio", GST_TYPE_FRACTION_RANGE,
+            1, G_MAXINT, G_MAXINT, 1, NULL);
+    }
+
+    if (gst_caps_is_subset_structure_full (ret, s, f)) {
+      gst_structure_free (s);
+      gst_caps_features_free (f);
+      continue;
+    }
+
+    gst_caps_append_structure_full (ret, s, f);
+  }
+
+  if (filter) {
+    GstCaps *tmp = ret;
+
+    ret = gst_caps_intersect_full (filter, tmp, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (tmp);
+  }
+
+  GST_DEBUG_OBJECT (trans, "transformed %" GST_PTR_FORMAT " into %"
+      GST_PTR_FORMAT, caps, ret);
+
+  return ret;
+}
+
+static GstCaps *
+gst_rga_convert_fixate_caps (GstBaseTransform * trans,
+    GstPadDirection direction UNUSED, GstCaps * caps, GstCaps * othercaps)
+{
+  GstRgaConvert *self = GST_RGA_CONVERT (trans);
+  GstStructure *ins, *outs;
+  const gchar *format;
+  gint width, height, fps_n, fps_d;
+
+  othercaps = gst_caps_truncate (othercaps);
+  othercaps = gst_caps_make_writable (othercaps);
+
+  ins = gst_caps_get_structure (caps, 0);
+  outs = gst_caps_get_structure (othercaps, 0);
+
+  /* Prefer doing as little work as possible */
+  format = gst_structure_get_string (ins, "format");
+  if (format)
+    gst_structure_fixate_field_string (outs, "format", format);
+
+  if (gst_structure_get_int (ins, "width", &width) &&
+      gst_structure_get_int (ins, "height", &height)) {
+    GST_OBJECT_LOCK (self);
+    if (gst_rga_convert_method_rotated (self->method))
+      SWAP (width, height);
+    GST_OBJECT_UNLOCK (self);
+
+    gst_structure_fixate_field_nearest_int (outs, "width", width);
+    gst_structure_fixate_field_nearest_int (outs, "height", height);
+  }
+
+  if (gst_structure_get_fraction (ins, "framerate", &fps_n, &fps_d))
+    gst_structure_fixate_field_nearest_fraction (outs, "framerate",
+        fps_n, fps_d);
+
+  if (gst_structure_has_field (outs, "pixel-aspect-ratio"))
+    gst_structure_fixate_field_nearest_fraction (outs, "pixel-aspect-ratio",
+        1, 1);
+
+  return gst_caps_fixate (othercaps);
+}
+
+static gboolean
+gst_rga_convert_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstRgaConvert *self = GST_RGA_CONVERT (trans);
+  gboolean passthrough;
+
+  if (!gst_video_info_from_caps (&self->in_info, incaps) ||
+      !gst_video_info_from_caps (&self->out_info, outcaps)) {
+    GST_ERROR_OBJECT (self, "invalid caps");
+    return FALSE;
+  }
+
+  if (!gst_mpp_video_info_align (&self->out_info, 0, 0))
+    return FALSE;
+
+  GST_OBJECT_LOCK (self);
+  passthrough = self->method == GST_VIDEO_ORIENTATION_IDENTITY &&
+      gst_caps_is_equal (incaps, outcaps);
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "%s %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT,
+      passthrough ? "passthrough" : "convert", incaps, outcaps);
+
+  /* The crop meta is left to downstream when passthrough */
+  gst_base_transform_set_passthrough (trans, passthrough);
+  return TRUE;
+}
+
+static gboolean
+gst_rga_convert_propose_allocation (GstBaseTransform * trans,
+    GstQuery * decide_query, GstQuery * query)
+{
+  GstBaseTransformClass *pclass = GST_BASE_TRANSFORM_CLASS (parent_class);
+
+  if (!pclass->propose_allocation (trans, decide_query, query))
+    return FALSE;
+
+  /* Passthrough forwarded the query */
+  if (!decide_query)
+    return TRUE;
+
+  /* Allow upstream to crop and stride without copying */
+  gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  gst_query_add_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE, NULL);
+  return TRUE;
+}
+
+static gboolean
+gst_rga_convert_start (GstBaseTransform * trans)
+{
+  GstRgaConvert *self = GST_RGA_CONVERT (trans);
+
+  if (!self->allocator) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED,
+        ("failed to create MPP allocator"), (NULL));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_rga_convert_decide_allocation (GstBaseTransform * trans, GstQuery * query)
+{
+  GstRgaConvert *self = GST_RGA_CONVERT (trans);
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstCaps *caps;
+  guint min = 0, max = 0;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (!caps)
+    return FALSE;
+
+  if (!self->allocator) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED,
+        ("failed to create MPP allocator"), (NULL));
+    return FALSE;
+  }
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, NULL, NULL, &min, &max);
+
+  min = MAX (min, 2);
+  if (max)
+    max = MAX (max, min);
+
+  /* RGA needs dma-buf outputs, use our own pool */
+  pool = gst_buffer_pool_new ();
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      GST_VIDEO_INFO_SIZE (&self->out_info), min, max);
+  gst_buffer_pool_config_set_allocator (config, self->allocator, NULL);
+
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    GST_ERROR_OBJECT (self, "failed to config pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "output pool %" GST_PTR_FORMAT " (%d-%d)",
+      pool, min, max);
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_set_nth_allocation_pool (query, 0, pool,
+        GST_VIDEO_INFO_SIZE (&self->out_info), min, max);
+  else
+    gst_query_add_allocation_pool (query, pool,
+        GST_VIDEO_INFO_SIZE (&self->out_info), min, max);
+
+  gst_object_unref (pool);
+  return TRUE;
+}
+
+static gboolean
+gst_rga_convert_transform_meta (GstBaseTransform * trans, GstBuffer * outbuf,
+    GstMeta * meta, GstBuffer * inbuf)
+{
+  GstBaseTransformClass *pclass = GST_BASE_TRANSFORM_CLASS (parent_class);
+
+  /* The crop is applied by the conversion */
+  if (meta->info->api == GST_VIDEO_CROP_META_API_TYPE)
+    return FALSE;
+
+  return pclass->transform_meta (trans, outbuf, meta, inbuf);
+}
+
+static GstFlowReturn
+gst_rga_convert_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstRgaConvert *self = GST_RGA_CONVERT (trans);
+  GstVideoInfo src_info = self->in_info;
+  GstVideoInfo *dst_info = &self->out_info;
+  GstVideoRectangle src_rect = { 0, };
+  GstVideoOrientationMethod method;
+  GstVideoCropMeta *crop_meta;
+  GstVideoMeta *meta;
+  GstMppRgaBatch *batch;
+  GstMemory *mem;
+  gboolean ret;
+  guint i;
+
+  mem = gst_buffer_peek_memory (outbuf, 0);
+  if (gst_buffer_n_memory (outbuf) != 1 || !gst_is_dmabuf_memory (mem)) {
+    GST_ERROR_OBJECT (self, "output buffer is not dma-buf");
+    return GST_FLOW_ERROR;
+  }
+
+  /* Respect upstream's strides */
+  meta = gst_buffer_get_video_meta (inbuf);
+  if (meta) {
+    for (i = 0; i < meta->n_planes; i++) {
+      GST_VIDEO_INFO_PLANE_OFFSET (&src_info, i) = meta->offset[i];
+      GST_VIDEO_INFO_PLANE_STRIDE (&src_info, i) = meta->stride[i];
+    }
+  }
+
+  crop_meta = gst_buffer_get_video_crop_meta (inbuf);
+  if (crop_meta) {
+    src_rect.x = crop_meta->x;
+    src_rect.y = crop_meta->y;
+    src_rect.w = crop_meta->width;
+    src_rect.h = crop_meta->height;
+  }
+
+  GST_OBJECT_LOCK (self);
+  method = self->method;
+  GST_OBJECT_UNLOCK (self);
+
+  batch = gst_mpp_rga_batch_new ();
+
+  ret = gst_mpp_rga_batch_add (batch, inbuf, &src_info, &src_rect, mem,
+      dst_info, NULL, 0) &&
+      gst_mpp_rga_batch_set_orientation (batch, method) &&
+      gst_mpp_rga_batch_submit (batch, FALSE);
+
+  gst_mpp_rga_batch_free (batch);
+
+  if (!ret) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("failed to convert"), (NULL));
+    return GST_FLOW_ERROR;
+  }
+
+  gst_buffer_add_video_meta_full (outbuf, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (dst_info), GST_VIDEO_INFO_WIDTH (dst_info),
+      GST_VIDEO_INFO_HEIGHT (dst_info), GST_VIDEO_INFO_N_PLANES (dst_info),
+      dst_info->offset, dst_info->stride);
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_rga_convert_finalize (GObject * object)
+{
+  GstRgaConvert *self = GST_RGA_CONVERT (object);
+
+  if (self->allocator)
+    gst_object_unref (self->allocator);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_rga_convert_init (GstRgaConvert * self)
+{
+  self->allocator = gst_mpp_allocator_new ();
+  if (!self->allocator)
+    GST_WARNING_OBJECT (self, "failed to create MPP allocator");
+
+  self->method = DEFAULT_PROP_VIDEO_DIRECTION;
+}
+
+static void
+gst_rga_convert_class_init (GstRgaConvertClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, "rgaconvert", 0,
+      "RGA video converter");
+
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_rga_convert_finalize);
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_rga_convert_set_property);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_rga_convert_get_property);
+
+  g_object_class_install_property (gobject_class, PROP_VIDEO_DIRECTION,
+      g_param_spec_enum ("video-direction", "Video direction",
+          "Video direction: rotation and flipping",
+          GST_TYPE_VIDEO_ORIENTATION_METHOD, DEFAULT_PROP_VIDEO_DIRECTION,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+
+  trans_class->transform_caps =
+      GST_DEBUG_FUNCPTR (gst_rga_convert_transform_caps);
+  trans_class->fixate_caps = GST_DEBUG_FUNCPTR (gst_rga_convert_fixate_caps);
+  trans_class->set_caps = GST_DEBUG_FUNCPTR (gst_rga_convert_set_caps);
+  trans_class->propose_allocation =
+      GST_DEBUG_FUNCPTR (gst_rga_convert_propose_allocation);
+  trans_class->start = GST_DEBUG_FUNCPTR (gst_rga_convert_start);
+  trans_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_rga_convert_decide_allocation);
+  trans_class->transform_meta =
+      GST_DEBUG_FUNCPTR (gst_rga_convert_transform_meta);
+  trans_class->transform = GST_DEBUG_FUNCPTR (gst_rga_convert_transform);
+
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_rga_convert_sink_template);
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_rga_convert_src_template);
+
+  gst_element_class_set_static_metadata (element_class,
+      "Rockchip's RGA video converter", "Filter/Converter/Video/Scaler",
+      "Convert, scale, crop and flip video with RGA",
+      "Jeffy Chen <jeffy.chen@rock-chips.com>");
+}
+
+gboolean
+gst_rga_convert_register (GstPlugin * plugin, guint rank)
+{
+  return gst_element_register (plugin, "rgaconvert", rank,
+      gst_rga_convert_get_type ());
+}